@@ -5,9 +5,6 @@
 
 -- Common code for new netfilter framework and legacy iptables dnsblock example
 
-local linux = require("linux")
-local string = require("string")
-
 local common = {}
 
 local udp = 0x11
@@ -18,14 +15,15 @@ local blacklist = {
 	"gitlab.com",
 }
 
+-- returns the length of the domain name, which is searched in place
 local function get_domain(skb, off)
-	local _, _, name = skb:getstring(off):find("([^\0]*)")
-	return name
+	local nul = skb:find("\0", off, nil, true)
+	return nul and nul - off
 end
 
-local function check_blacklist(name)
+local function check_blacklist(skb, off, len)
 	for _, v in ipairs(blacklist) do
-		if string.find(name, v) ~= nil then
+		if skb:find(v, off, len) ~= nil then
 			return true
 		end
 	end
@@ -34,12 +32,12 @@ end
 
 function common.hook(skb, thoff, proto)
 	if proto == udp then
-		local dstport = linux.ntoh16(skb:getuint16(thoff + 2))
+		local dstport = skb:unpack(">H", thoff + 2)
 		if dstport == dns then
 			local qoff = thoff + 20
-			local name = get_domain(skb, qoff)
-			if check_blacklist(name) then
-				print("DNS query for " .. name .. " blocked\n")
+			local len = get_domain(skb, qoff)
+			if len and check_blacklist(skb, qoff, len) then
+				print("DNS query for " .. skb:getstring(qoff, len) .. " blocked\n")
 				return true
 			end
 		end
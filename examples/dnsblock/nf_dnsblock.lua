@@ -13,9 +13,8 @@ local hooks = nf.inet_hooks
 local priority = nf.ip_priority
 
 local function dnsblock_hook(skb)
-	local proto = skb:getuint8(9)
-	local ihl = (skb:getuint8(0) & 0x0F)
-	local thoff = ihl * 4
+	local vihl, _, proto = skb:unpack("Bc8B")
+	local thoff = (vihl & 0x0F) * 4
 
 	return common.hook(skb, thoff, proto) and action.DROP or action.ACCEPT
 end
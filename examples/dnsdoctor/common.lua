@@ -36,7 +36,12 @@ function common.hook(skb, thoff, target_dns, target_ip, dst_ip, packet_dst)
 			for i = 1, nanswers do
 				local atype = linux.hton16(skb:getuint16(dnsoff + 2))
 				if atype == 1 then
-					skb:setuint32(dnsoff + 12, linux.hton32(target_ip))
+					local old = skb:getuint32(dnsoff + 12)
+					local new = linux.hton32(target_ip)
+					skb:setuint32(dnsoff + 12, new)
+					if skb:getuint16(thoff + 6) ~= 0 then -- UDP checksum is optional over IPv4
+						skb:csumprotoreplace4(thoff + 6, old, new)
+					end
 				end
 				dnsoff = dnsoff + 16
 			end
@@ -14,8 +14,8 @@ local shouldstop = thread.shouldstop
 local task = linux.task
 local sock = socket.sock
 
-local control = data.new(2)
-control:setbyte(1, 1) -- alive
+local control = data.new(8)
+control:atomic_set_release(4, 1) -- alive
 
 local server = inet.tcp()
 server:bind(inet.localhost, 1337)
@@ -29,7 +29,7 @@ local function daemon()
 	while (not shouldstop()) do
 		local ok, session = pcall(server.accept, server, sock.NONBLOCK)
 		if ok then
-			control:setbyte(0, n) -- #workers
+			control:atomic_set_release(0, n) -- #workers
 			local runtime = lunatik.runtime("examples/" .. worker)
 			runtime:resume(control, session)
 			thread.run(runtime, worker .. n)
@@ -38,7 +38,7 @@ local function daemon()
 			linux.schedule(100)
 		end
 	end
-	control:setbyte(1, 0) -- dead
+	control:atomic_set_release(4, 0) -- dead
 	print("echod [daemon]: stopped")
 end
 
@@ -15,7 +15,7 @@ local function info(id, message)
 end
 
 local function alive(control)
-	return control:getbyte(1) ~= 0
+	return control:atomic_read_acquire(4) ~= 0
 end
 
 local function echo(session)
@@ -26,7 +26,7 @@ end
 
 local function worker(control, session)
 	return function ()
-		local id = control:getbyte(0)
+		local id = control:atomic_read_acquire(0)
 
 		info(id, "started")
 		repeat
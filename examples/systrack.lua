@@ -6,6 +6,7 @@
 local linux  = require("linux")
 local probe  = require("probe")
 local device = require("device")
+local data   = require("data")
 local systab = require("syscall.table")
 
 local syscalls = {"openat", "read", "write", "readv", "writev", "close"}
@@ -15,11 +16,12 @@ local driver = {name = "systrack", mode = s.IRUGO}
 
 local track = {}
 local toggle = true
+local log = data.buffer()
 function driver:read()
-	local log = ""
+	log:resize(0)
 	if toggle then
 		for symbol, counter in pairs(track) do
-			log = log .. string.format("%s: %d\n", symbol, counter)
+			log:append(symbol, ": ", counter, "\n")
 		end
 	end
 	toggle = not toggle
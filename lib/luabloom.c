@@ -0,0 +1,466 @@
+/*
+* SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+* SPDX-License-Identifier: MIT OR GPL-2.0-only
+*/
+
+/***
+* Probabilistic membership filters.
+* This library provides Bloom filters for large sets of keys (e.g., domain
+* blocklists) that must be checked on the packet path. A filter answers
+* whether a key *might* belong to the set: there are no false negatives, and
+* false positives happen at a rate chosen when the filter is built.
+*
+* Filters are blocked: all bits of a key fall into a single cache line, so a
+* lookup touches one cache line, regardless of the number of hashes. Keys are
+* hashed with `siphash` under a random key, drawn anew on each build.
+*
+* Lookups are lockless and filters can be shared among runtimes (e.g., through
+* `lunatik._ENV`). A build publishes a whole new generation at once, using RCU;
+* thus, readers see either the old set or the new one, never a mix.
+*
+* @module bloom
+*/
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/bitops.h>
+#include <linux/log2.h>
+#include <linux/random.h>
+#include <linux/rcupdate.h>
+#include <linux/siphash.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include <lunatik.h>
+
+#include "luadata.h"
+
+#define LUABLOOM_BLOCKBITS	(512) /* a cache line */
+#define LUABLOOM_MAXCAPACITY	(1UL << 24)
+#define LUABLOOM_MAXRATE	(1U << 20)
+#define LUABLOOM_DEFAULTRATE	(100)
+#define LUABLOOM_MAXKEY		(256) /* of non-linear packets, hashed from an on-stack copy (e.g., DNS names) */
+
+typedef struct luabloom_filter_s {
+	struct rcu_head rcu;
+	siphash_key_t key;
+	atomic_long_t count;
+	size_t capacity;
+	size_t size; /* in bytes */
+	unsigned int rate;
+	unsigned int nhashes;
+	unsigned int nblocks;
+	unsigned long bits[];
+} luabloom_filter_t;
+
+typedef struct luabloom_s {
+	luabloom_filter_t __rcu *filter;
+	spinlock_t lock;
+} luabloom_t;
+
+LUNATIK_PRIVATECHECKER(luabloom_check, luabloom_t *);
+
+/* the upper half of the hash selects the block; probes inside it follow double hashing */
+typedef struct luabloom_hash_s {
+	unsigned long base;
+	u32 h1;
+	u32 h2;
+} luabloom_hash_t;
+
+#define luabloom_bit(h, i)	((h)->base + (((h)->h1 + (i) * (h)->h2) % LUABLOOM_BLOCKBITS))
+
+static inline void luabloom_hash(luabloom_filter_t *filter, const char *key, size_t len, luabloom_hash_t *h)
+{
+	u64 hash = siphash(key, len, &filter->key);
+
+	h->base = (unsigned long)reciprocal_scale((u32)(hash >> 32), filter->nblocks) * LUABLOOM_BLOCKBITS;
+	h->h1 = (u32)hash;
+	h->h2 = (u32)(hash >> 16) | 1; /* odd; thus, probes don't repeat within a block */
+}
+
+static inline void luabloom_add(luabloom_filter_t *filter, const char *key, size_t len)
+{
+	luabloom_hash_t h;
+	unsigned int i;
+
+	luabloom_hash(filter, key, len, &h);
+	for (i = 0; i < filter->nhashes; i++)
+		set_bit(luabloom_bit(&h, i), filter->bits);
+	atomic_long_inc(&filter->count);
+}
+
+static inline bool luabloom_contains(luabloom_filter_t *filter, const char *key, size_t len)
+{
+	luabloom_hash_t h;
+	unsigned int i;
+
+	luabloom_hash(filter, key, len, &h);
+	for (i = 0; i < filter->nhashes; i++)
+		if (!test_bit(luabloom_bit(&h, i), filter->bits))
+			return false;
+	return true;
+}
+
+/*
+* A false-positive rate of 1/rate takes log2(rate) hashes and log2(rate)/ln(2) bits per key;
+* we round both up, which also makes up for the slightly higher rate of blocked filters.
+*/
+static luabloom_filter_t *luabloom_newfilter(size_t capacity, unsigned int rate, gfp_t gfp)
+{
+	unsigned int nhashes = max_t(unsigned int, order_base_2(rate), 1);
+	size_t nbits = DIV_ROUND_UP(max_t(size_t, capacity, 1) * nhashes * 3, 2);
+	unsigned int nblocks = DIV_ROUND_UP(nbits, LUABLOOM_BLOCKBITS);
+	size_t size = struct_size((luabloom_filter_t *)NULL, bits, BITS_TO_LONGS(nblocks * LUABLOOM_BLOCKBITS));
+	luabloom_filter_t *filter = kvzalloc(size, gfp);
+
+	if (filter == NULL)
+		return NULL;
+
+	get_random_bytes(&filter->key, sizeof(siphash_key_t));
+	atomic_long_set(&filter->count, 0);
+	filter->capacity = capacity;
+	filter->size = size;
+	filter->rate = rate;
+	filter->nhashes = nhashes;
+	filter->nblocks = nblocks;
+	return filter;
+}
+
+static inline luabloom_filter_t *luabloom_checkfilter(lua_State *L, lua_Integer capacity, int cix,
+	lua_Integer rate, int rix)
+{
+	luabloom_filter_t *filter;
+
+	luaL_argcheck(L, capacity >= 0 && capacity <= LUABLOOM_MAXCAPACITY, cix, "invalid capacity");
+	luaL_argcheck(L, rate > 1 && rate <= LUABLOOM_MAXRATE, rix, "invalid rate");
+	if ((filter = luabloom_newfilter((size_t)capacity, (unsigned int)rate, lunatik_gfp(lunatik_toruntime(L)))) == NULL)
+		luaL_error(L, "not enough memory");
+	return filter;
+}
+
+static inline bool luabloom_apply(luabloom_t *bloom, bool add, const char *key, size_t len)
+{
+	luabloom_filter_t *filter;
+	bool found = true;
+
+	rcu_read_lock();
+	filter = rcu_dereference(bloom->filter);
+	if (add)
+		luabloom_add(filter, key, len);
+	else
+		found = luabloom_contains(filter, key, len);
+	rcu_read_unlock();
+	return found;
+}
+
+typedef struct luabloom_key_s {
+	luabloom_t *bloom;
+	bool add;
+	bool done;
+	bool found;
+} luabloom_key_t;
+
+/* called under the lock of data objects (see luadata_checkscan()); a key handed in chunks is too long */
+static size_t luabloom_scankey(void *ctx, const char *chunk, size_t len, size_t rest)
+{
+	luabloom_key_t *key = (luabloom_key_t *)ctx;
+
+	if (rest > 0)
+		return 0;
+
+	key->found = luabloom_apply(key->bloom, key->add, chunk, len);
+	key->done = true;
+	return len;
+}
+
+/* keys are hashed in place; only keys in fragments of non-linear packets are copied */
+static bool luabloom_checkkey(lua_State *L, int ix, luabloom_t *bloom, bool add)
+{
+	lua_Integer offset = luaL_optinteger(L, ix + 1, 0);
+	lua_Integer length = luaL_optinteger(L, ix + 2, -1);
+	luabloom_key_t key = {.bloom = bloom, .add = add, .done = false, .found = false};
+	char buffer[LUABLOOM_MAXKEY];
+
+	luaL_argcheck(L, offset >= 0, ix + 1, "out of bounds");
+	luaL_argcheck(L, length >= 0 || lua_isnoneornil(L, ix + 2), ix + 2, "out of bounds");
+	luadata_checkscan(L, ix, offset, length, buffer, sizeof(buffer), luabloom_scankey, &key);
+	if (!key.done) {
+		size_t len;
+		const char *s = luadata_checkregion(L, ix, offset, length, &len);
+
+		key.found = luabloom_apply(bloom, add, s, len);
+	}
+	return key.found;
+}
+
+/***
+* Represents a Bloom filter.
+* This is a userdata object returned by `bloom.new()`.
+* @type bloom
+*/
+
+/***
+* Adds a key to the filter.
+* Keys added while a build is in progress might be lost.
+* @function add
+* @tparam string|data key The key.
+* @tparam[opt=0] integer offset The offset of the key inside `key`.
+* @tparam[opt] integer length The length of the key (defaults to the rest of `key`).
+* @raise Error if the key is out of bounds.
+*/
+static int luabloom_addkey(lua_State *L)
+{
+	luabloom_checkkey(L, 2, luabloom_check(L, 1), true);
+	return 0;
+}
+
+/***
+* Checks whether a key might be in the filter.
+* The filter is read without locks; thus, the check can be issued from any hook.
+* Keys in data objects (e.g., packets) are hashed in place, while their lock is held.
+* @function contains
+* @tparam string|data key The key (e.g., a packet).
+* @tparam[opt=0] integer offset The offset of the key inside `key`.
+* @tparam[opt] integer length The length of the key (defaults to the rest of `key`).
+* @treturn boolean `false` if the key is not in the filter; `true` if it probably is.
+* @raise Error if the key is out of bounds.
+* @usage
+*   if blocklist:contains(skb, qoff, len) then return action.DROP end
+*/
+static int luabloom_containskey(lua_State *L)
+{
+	lua_pushboolean(L, luabloom_checkkey(L, 2, luabloom_check(L, 1), false));
+	return 1;
+}
+
+static size_t luabloom_countlines(const char *keys, size_t len)
+{
+	const char *end = keys + len;
+	size_t n = 0;
+
+	while (keys < end) {
+		const char *nl = memchr(keys, '\n', end - keys);
+		const char *next = nl != NULL ? nl : end;
+
+		n += next > keys;
+		keys = next + 1;
+	}
+	return n;
+}
+
+static void luabloom_addlines(luabloom_filter_t *filter, const char *keys, size_t len)
+{
+	const char *end = keys + len;
+
+	while (keys < end) {
+		const char *nl = memchr(keys, '\n', end - keys);
+		const char *next = nl != NULL ? nl : end;
+
+		if (next > keys) /* skip empty lines */
+			luabloom_add(filter, keys, next - keys);
+		keys = next + 1;
+	}
+}
+
+/* returns false if the array holds a non-key value */
+static bool luabloom_addarray(lua_State *L, int ix, luabloom_filter_t *filter, size_t n)
+{
+	size_t i;
+
+	for (i = 1; i <= n; i++) {
+		const char *key;
+		size_t len;
+
+		lua_rawgeti(L, ix, (lua_Integer)i);
+		key = luadata_tolstring(L, -1, &len);
+		if (key != NULL)
+			luabloom_add(filter, key, len);
+		lua_pop(L, 1);
+		if (key == NULL)
+			return false;
+	}
+	return true;
+}
+
+/***
+* Builds a new generation of the filter from a set of keys.
+* The new generation is filled apart and then replaces the current one at once;
+* thus, concurrent lookups keep using the previous set until the build is done.
+* @function build
+* @tparam table|string|data keys An array of keys or a newline-separated list of keys
+*   (e.g., the contents of a blocklist file); empty lines are ignored.
+* @tparam[opt] integer rate The expected false-positive rate, as `1/rate`
+*   (defaults to the rate of the current generation).
+* @tparam[opt] integer capacity The number of keys the new generation is sized for
+*   (defaults to the number of keys).
+* @raise Error if a key is invalid or if memory allocation fails.
+* @usage
+*   blocklist:build({"github.com", "gitlab.com"}, 10000)
+*/
+static int luabloom_build(lua_State *L)
+{
+	luabloom_t *bloom = luabloom_check(L, 1);
+	luabloom_filter_t *filter, *old;
+	const char *keys = NULL;
+	lua_Integer rate, capacity;
+	size_t len, n;
+
+	if (lua_istable(L, 2))
+		n = lua_rawlen(L, 2);
+	else {
+		keys = luadata_checklstring(L, 2, &len);
+		n = luabloom_countlines(keys, len);
+	}
+
+	rcu_read_lock();
+	rate = rcu_dereference(bloom->filter)->rate;
+	rcu_read_unlock();
+
+	rate = luaL_optinteger(L, 3, rate);
+	capacity = luaL_optinteger(L, 4, (lua_Integer)n);
+	filter = luabloom_checkfilter(L, capacity, 4, rate, 3);
+
+	if (keys != NULL)
+		luabloom_addlines(filter, keys, len);
+	else if (!luabloom_addarray(L, 2, filter, n)) {
+		kvfree(filter);
+		luaL_argerror(L, 2, "invalid key");
+	}
+
+	spin_lock_bh(&bloom->lock);
+	old = rcu_replace_pointer(bloom->filter, filter, lockdep_is_held(&bloom->lock));
+	spin_unlock_bh(&bloom->lock);
+
+	kvfree_rcu(old, rcu);
+	return 0;
+}
+
+/***
+* Returns the statistics of the filter.
+* @function stats
+* @treturn table A table with the fields:
+*
+*   - `entries`: number of added keys.
+*   - `capacity`: number of keys the filter is sized for.
+*   - `rate`: expected false-positive rate, as `1/rate`, up to `capacity` keys.
+*   - `hashes`: number of bits set per key.
+*   - `bits`: size of the bit array.
+*   - `memory`: memory used by the filter, in bytes.
+*
+* @usage
+*   local s = blocklist:stats()
+*   print(s.entries, s.memory)
+*/
+static int luabloom_stats(lua_State *L)
+{
+	luabloom_t *bloom = luabloom_check(L, 1);
+	luabloom_filter_t *filter;
+	size_t entries, capacity, size;
+	unsigned int rate, nhashes, nblocks;
+
+	rcu_read_lock();
+	filter = rcu_dereference(bloom->filter);
+	entries = atomic_long_read(&filter->count);
+	capacity = filter->capacity;
+	size = filter->size;
+	rate = filter->rate;
+	nhashes = filter->nhashes;
+	nblocks = filter->nblocks;
+	rcu_read_unlock();
+
+	lua_createtable(L, 0, 6);
+	lua_pushinteger(L, (lua_Integer)entries);
+	lua_setfield(L, -2, "entries");
+	lua_pushinteger(L, (lua_Integer)capacity);
+	lua_setfield(L, -2, "capacity");
+	lua_pushinteger(L, (lua_Integer)rate);
+	lua_setfield(L, -2, "rate");
+	lua_pushinteger(L, (lua_Integer)nhashes);
+	lua_setfield(L, -2, "hashes");
+	lua_pushinteger(L, (lua_Integer)nblocks * LUABLOOM_BLOCKBITS);
+	lua_setfield(L, -2, "bits");
+	lua_pushinteger(L, (lua_Integer)(sizeof(luabloom_t) + size));
+	lua_setfield(L, -2, "memory");
+	return 1;
+}
+
+/* there are no readers left; thus, the filter is released right away */
+static void luabloom_release(void *private)
+{
+	luabloom_t *bloom = (luabloom_t *)private;
+	kvfree(rcu_dereference_protected(bloom->filter, true));
+}
+
+static int luabloom_new(lua_State *L);
+
+/***
+* Creates a new, empty Bloom filter.
+* Keys can be added one by one (`add`) or the whole set can be built at once (`build`).
+* @function new
+* @tparam integer capacity The number of keys the filter is sized for.
+* @tparam[opt=100] integer rate The expected false-positive rate, as `1/rate`.
+* @treturn bloom A new filter.
+* @raise Error if the capacity or the rate is invalid or if memory allocation fails.
+* @usage
+*   local bloom = require("bloom")
+*   local blocklist = bloom.new(2000000, 1000) -- 1 false positive per 1000 lookups
+* @within bloom
+*/
+static const luaL_Reg luabloom_lib[] = {
+	{"new", luabloom_new},
+	{NULL, NULL}
+};
+
+static const luaL_Reg luabloom_mt[] = {
+	{"__gc", lunatik_deleteobject},
+	{"add", luabloom_addkey},
+	{"contains", luabloom_containskey},
+	{"build", luabloom_build},
+	{"stats", luabloom_stats},
+	{NULL, NULL}
+};
+
+/* filters have their own synchronization; thus, they aren't monitored */
+static const lunatik_class_t luabloom_class = {
+	.name = "bloom",
+	.methods = luabloom_mt,
+	.release = luabloom_release,
+	.sleep = false,
+};
+
+static int luabloom_new(lua_State *L)
+{
+	lua_Integer capacity = luaL_checkinteger(L, 1);
+	lua_Integer rate = luaL_optinteger(L, 2, LUABLOOM_DEFAULTRATE);
+	lunatik_object_t *object = lunatik_newobject(L, &luabloom_class, sizeof(luabloom_t));
+	luabloom_t *bloom = (luabloom_t *)object->private;
+
+	RCU_INIT_POINTER(bloom->filter, NULL);
+	spin_lock_init(&bloom->lock);
+	RCU_INIT_POINTER(bloom->filter, luabloom_checkfilter(L, capacity, 1, rate, 2));
+	return 1; /* object */
+}
+
+LUNATIK_NEWLIB(bloom, luabloom_lib, &luabloom_class, NULL);
+
+static int __init luabloom_init(void)
+{
+	return 0;
+}
+
+static void __exit luabloom_exit(void)
+{
+	rcu_barrier(); /* wait for pending kvfree_rcu() */
+}
+
+module_init(luabloom_init);
+module_exit(luabloom_exit);
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_AUTHOR("Lourival Vieira Neto <lourival.neto@ring-0.io>");
+
@@ -27,6 +27,7 @@
 #include <lauxlib.h>
 #include <lunatik.h>
 
+#include "luadata.h"
 #include "luacrypto.h"
 
 LUNATIK_PRIVATECHECKER(luacrypto_aead_check, struct crypto_aead *);
@@ -90,8 +91,7 @@ static int luacrypto_aead_authsize(lua_State *L) {
 	return 1;
 }
 
-static inline struct aead_request *luacrypto_aead_newrequest(lua_State *L, const char **combined, u8 **iv,
-	size_t *combined_len, size_t *aad_len, size_t *crypt_len, unsigned int *authsize)
+static inline struct aead_request *luacrypto_aead_newrequest(lua_State *L, u8 **iv)
 {
 	struct crypto_aead *tfm = luacrypto_aead_check(L, 1);
 
@@ -99,27 +99,17 @@ static inline struct aead_request *luacrypto_aead_newrequest(lua_State *L, const
 	const char *l_iv = luaL_checklstring(L, 2, &iv_len);
 	luaL_argcheck(L, iv_len == crypto_aead_ivsize(tfm), 2, "incorrect IV length");
 
-	*combined = luaL_checklstring(L, 3, combined_len);
-
-	*aad_len = (size_t)luaL_checkinteger(L, 4);
-	lunatik_checkbounds(L, 4, *aad_len, 0, *combined_len);
-
-	*crypt_len = *combined_len - *aad_len;
-
 	gfp_t gfp = lunatik_gfp(lunatik_toruntime(L));
 	struct aead_request *request = lunatik_checknull(L, aead_request_alloc(tfm, gfp));
 	*iv = (u8 *)lunatik_checkalloc(L, iv_len);
 	memcpy(*iv, l_iv, iv_len);
-	*authsize = crypto_aead_authsize(tfm);
 
 	return request;
 }
 
-static inline void luacrypto_aead_setrequest(lua_State *L, struct aead_request *request, const char *combined, u8 *iv,
-	size_t combined_len, size_t aad_len, size_t crypt_len, char *buffer, size_t buffer_len)
+static inline void luacrypto_aead_setrequest(lua_State *L, struct aead_request *request, u8 *iv,
+	size_t aad_len, size_t crypt_len, char *buffer, size_t buffer_len)
 {
-	memcpy(buffer, combined, combined_len);
-
 	struct scatterlist sg_work;
 	sg_init_one(&sg_work, buffer, buffer_len);
 
@@ -139,19 +129,21 @@ LUACRYPTO_FREEREQUEST(aead, struct aead_request, aead_request_free);
 
 #define LUACRYPTO_AEAD_NEWCRYPT(name, NAME, res_factor)									\
 static int luacrypto_aead_##name(lua_State *L) {									\
-	const char *combined;												\
 	u8 *iv;														\
-	unsigned int authsize;												\
-	size_t combined_len, aad_len, crypt_len;									\
-	struct aead_request *request = luacrypto_aead_newrequest(L, &combined, &iv, &combined_len,			\
-		&aad_len, &crypt_len, &authsize); 									\
+	unsigned int authsize = crypto_aead_authsize(luacrypto_aead_check(L, 1));					\
+	size_t combined_len = luadata_checklength(L, 3);								\
+	size_t aad_len = (size_t)luaL_checkinteger(L, 4);								\
+	lunatik_checkbounds(L, 4, aad_len, 0, combined_len);								\
+	size_t crypt_len = combined_len - aad_len;									\
 															\
 	LUACRYPTO_AEAD_CHECK_##NAME(L, 3, crypt_len, authsize);								\
 	size_t buffer_len = LUACRYPTO_AEAD_LEN_##NAME(combined_len, authsize);						\
 															\
 	luaL_Buffer B;													\
 	char *buffer = luaL_buffinitsize(L, &B, buffer_len);								\
-	luacrypto_aead_setrequest(L, request, combined, iv, combined_len, aad_len, crypt_len, buffer, buffer_len);	\
+	luadata_checkcopy(L, 3, 0, buffer, combined_len); /* see luadata_checkcopy() */				\
+	struct aead_request *request = luacrypto_aead_newrequest(L, &iv);						\
+	luacrypto_aead_setrequest(L, request, iv, aad_len, crypt_len, buffer, buffer_len);				\
 	int ret = crypto_aead_##name(request);										\
 	luacrypto_aead_freerequest(request, iv);									\
 	if (ret < 0)													\
@@ -166,7 +158,7 @@ static int luacrypto_aead_##name(lua_State *L) {									\
 * The IV (nonce) must be unique for each encryption operation with the same key.
 * @function encrypt
 * @tparam string iv The Initialization Vector (nonce). Its length must match `ivsize()`.
-* @tparam string combined_data A string containing AAD (Additional Authenticated Data) concatenated with the plaintext (format: AAD || Plaintext).
+* @tparam string|data combined_data A string (or `data` object) containing AAD (Additional Authenticated Data) concatenated with the plaintext (format: AAD || Plaintext).
 * @tparam integer aad_len The length of the AAD part in `combined_data`.
 * @treturn string The encrypted data, formatted as (AAD || Ciphertext || Tag).
 * @raise Error on encryption failure, incorrect IV length, or allocation issues.
@@ -178,7 +170,7 @@ LUACRYPTO_AEAD_NEWCRYPT(encrypt, ENCRYPT, 1);
 * The IV (nonce) and AAD must match those used during encryption.
 * @function decrypt
 * @tparam string iv The Initialization Vector (nonce). Its length must match `ivsize()`.
-* @tparam string combined_data A string containing AAD (Additional Authenticated Data) concatenated with the ciphertext and tag (format: AAD || Ciphertext || Tag).
+* @tparam string|data combined_data A string (or `data` object) containing AAD (Additional Authenticated Data) concatenated with the ciphertext and tag (format: AAD || Ciphertext || Tag).
 * @tparam integer aad_len The length of the AAD part in `combined_data`.
 * @treturn string The decrypted data, formatted as (AAD || Plaintext).
 * @raise Error on decryption failure (e.g., authentication error - EBADMSG), incorrect IV length, input data too short, or allocation issues.
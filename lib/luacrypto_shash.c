@@ -26,6 +26,7 @@
 #include <lauxlib.h>
 #include <lunatik.h>
 
+#include "luadata.h"
 #include "luacrypto.h"
 
 LUNATIK_PRIVATECHECKER(luacrypto_shash_check, struct shash_desc *);
@@ -75,19 +76,22 @@ static int luacrypto_shash_setkey(lua_State *L) {
 * For HMAC, `setkey()` must have been called first.
 * This function initializes, updates, and finalizes the hash calculation.
 * @function digest
-* @tparam string data The data to hash.
+* @tparam string|data data The data to hash.
 * @treturn string The computed digest (hash output).
 * @raise Error on failure (e.g., allocation error, crypto API error).
 */
 static int luacrypto_shash_digest(lua_State *L) {
 	struct shash_desc *sdesc = luacrypto_shash_check(L, 1);
-	size_t datalen;
-	const char *data = luaL_checklstring(L, 2, &datalen);
 	unsigned int digestsize = crypto_shash_digestsize(sdesc->tfm);
 	luaL_Buffer b;
 	u8 *digest_buf = luaL_buffinitsize(L, &b, digestsize);
+	size_t datalen;
+	const char *data = luadata_borrow(L, 2, &datalen); /* see luadata_borrow() */
+	int ret = crypto_shash_digest(sdesc, data, datalen, digest_buf);
 
-	lunatik_try(L, crypto_shash_digest, sdesc, data, datalen, digest_buf);
+	luadata_unborrow(L, 2);
+	if (ret < 0)
+		lunatik_throw(L, ret);
 	luaL_pushresultsize(&b, digestsize);
 	return 1;
 }
@@ -109,15 +113,18 @@ static int luacrypto_shash_init_method(lua_State *L) {
 * Updates the hash state with more data.
 * Must be called after `init()`. Can be called multiple times.
 * @function update
-* @tparam string data The data chunk to add to the hash.
+* @tparam string|data data The data chunk to add to the hash.
 * @raise Error on failure.
 */
 static int luacrypto_shash_update(lua_State *L) {
 	struct shash_desc *sdesc = luacrypto_shash_check(L, 1);
 	size_t datalen;
-	const char *data = luaL_checklstring(L, 2, &datalen);
+	const char *data = luadata_borrow(L, 2, &datalen); /* see luadata_borrow() */
+	int ret = crypto_shash_update(sdesc, data, datalen);
 
-	lunatik_try(L, crypto_shash_update, sdesc, data, datalen);
+	luadata_unborrow(L, 2);
+	if (ret < 0)
+		lunatik_throw(L, ret);
 	return 0;
 }
 
@@ -144,19 +151,22 @@ static int luacrypto_shash_final(lua_State *L) {
 * Updates the hash state with the given data, then finalizes and returns the digest.
 * `init()` must have been called prior to calling `finup()`.
 * @function finup
-* @tparam string data The final data chunk.
+* @tparam string|data data The final data chunk.
 * @treturn string The computed digest.
 * @raise Error on failure.
 */
 static int luacrypto_shash_finup(lua_State *L) {
 	struct shash_desc *sdesc = luacrypto_shash_check(L, 1);
-	size_t datalen;
-	const char *data = luaL_checklstring(L, 2, &datalen);
 	unsigned int digestsize = crypto_shash_digestsize(sdesc->tfm);
 	luaL_Buffer b;
 	u8 *digest_buf = luaL_buffinitsize(L, &b, digestsize);
+	size_t datalen;
+	const char *data = luadata_borrow(L, 2, &datalen); /* see luadata_borrow() */
+	int ret = crypto_shash_finup(sdesc, data, datalen, digest_buf);
 
-	lunatik_try(L, crypto_shash_finup, sdesc, data, datalen, digest_buf);
+	luadata_unborrow(L, 2);
+	if (ret < 0)
+		lunatik_throw(L, ret);
 	luaL_pushresultsize(&b, digestsize);
 	return 1;
 }
@@ -28,6 +28,7 @@
 #include <lauxlib.h>
 #include <lunatik.h>
 
+#include "luadata.h"
 #include "luacrypto.h"
 
 LUNATIK_PRIVATECHECKER(luacrypto_skcipher_check, struct crypto_skcipher *);
@@ -78,8 +79,7 @@ static int luacrypto_skcipher_blocksize(lua_State *L) {
 	return 1;
 }
 
-static inline struct skcipher_request *luacrypto_skcipher_newrequest(lua_State *L, const char **data, u8 **iv,
-	size_t *data_len)
+static inline struct skcipher_request *luacrypto_skcipher_newrequest(lua_State *L, u8 **iv)
 {
 	struct crypto_skcipher *tfm = luacrypto_skcipher_check(L, 1);
 
@@ -87,8 +87,6 @@ static inline struct skcipher_request *luacrypto_skcipher_newrequest(lua_State *
 	const char *l_iv = luaL_checklstring(L, 2, &iv_len);
 	luaL_argcheck(L, iv_len == crypto_skcipher_ivsize(tfm), 2, "incorrect IV length");
 
-	*data = luaL_checklstring(L, 3, data_len);
-
 	gfp_t gfp = lunatik_gfp(lunatik_toruntime(L));
 	struct skcipher_request *request = lunatik_checknull(L, skcipher_request_alloc(tfm, gfp));
 	*iv = (u8 *)lunatik_checkalloc(L, iv_len);
@@ -97,11 +95,9 @@ static inline struct skcipher_request *luacrypto_skcipher_newrequest(lua_State *
 	return request;
 }
 
-static inline void luacrypto_skcipher_setrequest(lua_State *L, struct skcipher_request *request, const char *data, u8 *iv,
+static inline void luacrypto_skcipher_setrequest(lua_State *L, struct skcipher_request *request, u8 *iv,
 	size_t data_len, char *buffer)
 {
-	memcpy(buffer, data, data_len);
-
 	struct scatterlist sg_work;
 	sg_init_one(&sg_work, buffer, data_len);
 
@@ -113,14 +109,14 @@ LUACRYPTO_FREEREQUEST(skcipher, struct skcipher_request, skcipher_request_free);
 
 #define LUACRYPTO_SKCIPHER_NEWCRYPT(name)								\
 static int luacrypto_skcipher_##name(lua_State *L) {							\
-	const char *data;										\
 	u8 *iv;												\
-	size_t data_len;										\
-	struct skcipher_request *request = luacrypto_skcipher_newrequest(L, &data, &iv, &data_len);	\
+	size_t data_len = luadata_checklength(L, 3);							\
 													\
 	luaL_Buffer B;											\
 	char *buffer = luaL_buffinitsize(L, &B, data_len);						\
-	luacrypto_skcipher_setrequest(L, request, data, iv, data_len, buffer);				\
+	luadata_checkcopy(L, 3, 0, buffer, data_len); /* see luadata_checkcopy() */			\
+	struct skcipher_request *request = luacrypto_skcipher_newrequest(L, &iv);			\
+	luacrypto_skcipher_setrequest(L, request, iv, data_len, buffer);				\
 	int ret = crypto_skcipher_##name(request);							\
 	luacrypto_skcipher_freerequest(request, iv);							\
 	if (ret < 0)											\
@@ -136,7 +132,7 @@ static int luacrypto_skcipher_##name(lua_State *L) {							\
 * Plaintext length should be appropriate for the cipher mode (e.g., multiple of blocksize).
 * @function encrypt
 * @tparam string iv The Initialization Vector. Its length must match `ivsize()`.
-* @tparam string plaintext The data to encrypt.
+* @tparam string|data plaintext The data to encrypt.
 * @treturn string The ciphertext.
 * @raise Error on encryption failure, incorrect IV length, or allocation issues.
 */
@@ -148,7 +144,7 @@ LUACRYPTO_SKCIPHER_NEWCRYPT(encrypt);
 * Ciphertext length should be appropriate for the cipher mode.
 * @function decrypt
 * @tparam string iv The Initialization Vector. Its length must match `ivsize()`.
-* @tparam string ciphertext The data to decrypt.
+* @tparam string|data ciphertext The data to decrypt.
 * @treturn string The plaintext.
 * @raise Error on decryption failure, incorrect IV length, or allocation issues.
 */
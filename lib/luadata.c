@@ -23,6 +23,15 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/skbuff.h>
+#include <linux/ip.h>
+#include <linux/ipv6.h>
+#include <net/checksum.h>
+#include <net/ip6_checksum.h>
+#include <linux/jhash.h>
+#include <linux/siphash.h>
+#include <linux/percpu.h>
+#include <linux/atomic.h>
+#include <linux/ctype.h>
 
 #include <lua.h>
 #include <lualib.h>
@@ -32,20 +41,58 @@
 
 #include "luadata.h"
 
-#define LUADATA_TOPTR(d)  ((d)->opt & LUADATA_OPT_SKB ? (((struct sk_buff *)(d)->ptr)->data) : (d)->ptr)
+/* per-CPU data is accessed with preemption disabled (see luadata_index()) */
+#define LUADATA_TOBASE(d) ((d)->opt & LUADATA_OPT_PERCPU ? raw_cpu_ptr((void __percpu *)(d)->ptr) : (d)->ptr)
+#define LUADATA_TOPTR(d)  (((d)->opt & LUADATA_OPT_SKB ? (((struct sk_buff *)(d)->ptr)->data) : LUADATA_TOBASE(d)) + (d)->offset)
 #define LUADATA_TOSKB(d)  ((struct sk_buff *)(d)->ptr)
 
 typedef struct luadata_s {
 	void *ptr;
 	size_t size;
+	size_t capacity;		/* of allocated memory (i.e., LUADATA_OPT_FREE) */
 	uint8_t opt;
+	ssize_t offset;			/* of a slice, within its parent memory; or of the data, within skb->data */
+	lunatik_object_t *parent;	/* of a slice; NULL, otherwise */
+	unsigned int generation;	/* incremented whenever the memory is reset */
+	bool pinned;			/* memory can't be moved anymore (see luadata_pin()) */
+	unsigned int borrowers;		/* of the memory, which can't be moved meanwhile (see luadata_borrow()) */
 } luadata_t;
 
+#define luadata_isslice(d)	((d)->parent != NULL)
+#define luadata_toparent(d)	((luadata_t *)(d)->parent->private)
+#define luadata_ispercpu(d)	((d)->opt & LUADATA_OPT_PERCPU)
+/* it must be checked with the lock of the parent held (see luadata_toguard()) */
+#define luadata_isstale(d)	(luadata_isslice(d) && luadata_toparent(d)->generation != (d)->generation)
+
 #define LUADATA_NUMBER_SZ	(sizeof(lua_Integer))
 
 static int luadata_lnew(lua_State *L);
+static const lunatik_class_t luadata_class;
+static const lunatik_class_t luadata_layout_class;
+
+LUNATIK_PRIVATECHECKER(luadata_checkprivate, luadata_t *);
+
+/* slices share the memory of their parent; thus, they are guarded by its lock */
+static inline lunatik_object_t *luadata_toguard(lunatik_object_t *object)
+{
+	luadata_t *data = (luadata_t *)object->private;
+	return luadata_isslice(data) ? data->parent : object;
+}
+
+static inline luadata_t *luadata_check(lua_State *L, int ix)
+{
+	luadata_t *data = luadata_checkprivate(L, ix);
+	luaL_argcheck(L, !luadata_isstale(data), ix, "invalidated slice");
+	return data;
+}
 
-LUNATIK_PRIVATECHECKER(luadata_check, luadata_t *);
+/* for data objects passed as arguments of other methods */
+static inline lunatik_object_t *luadata_checkobject(lua_State *L, int ix)
+{
+	lunatik_object_t *object = lunatik_checkobject(L, ix);
+	luaL_argcheck(L, object->class == &luadata_class, ix, "data expected");
+	return object;
+}
 
 /***
  * Bounds-checked pointer calculation. Returns pointer on success, raises Lua error on failure.
@@ -56,15 +103,77 @@ LUNATIK_PRIVATECHECKER(luadata_check, luadata_t *);
  * @param length Access length
  * @return Valid pointer within bounds
  */
+#define luadata_checkrange(L, ix, data, offset, length)	\
+	luaL_argcheck((L), (offset) >= 0 && (length) > 0 && (offset) + (length) <= (data)->size, (ix), "out of bounds")
+
 static inline void *luadata_checkbounds(lua_State *L, int ix, luadata_t *data, lua_Integer offset, lua_Integer length)
 {
-	int bounds = offset >= 0 && length > 0 && offset + length <= data->size;
-	luaL_argcheck(L, bounds, ix, "out of bounds");
+	luadata_checkrange(L, ix, data, offset, length);
 	return (LUADATA_TOPTR(data) + offset);
 }
 
 #define luadata_checkwritable(L, data)	luaL_argcheck((L), !((data)->opt & LUADATA_OPT_READONLY), 1, "read only")
 
+/* socket buffers might be non-linear (e.g., GSO/GRO packets); thus, regions that
+ * aren't in the linear area are copied from and to their fragments */
+#define luadata_skboffset(d, offset)		((int)((d)->offset + (offset)))
+#define luadata_skblinear(d, offset, length)	\
+	(luadata_skboffset((d), (offset)) + (length) <= skb_headlen(LUADATA_TOSKB(d)))
+
+/***
+ * Bounds-checked pointer for reading. For non-linear socket buffers, the region
+ * is copied into buffer or, if it is NULL, into a new userdata pushed on the stack.
+ */
+static void *luadata_checkread(lua_State *L, int ix, luadata_t *data, lua_Integer offset, lua_Integer length, void *buffer)
+{
+	void *ptr;
+
+	if (!(data->opt & LUADATA_OPT_SKB))
+		return luadata_checkbounds(L, ix, data, offset, length);
+
+	luadata_checkrange(L, ix, data, offset, length);
+	if (buffer == NULL && !luadata_skblinear(data, offset, length))
+		buffer = lua_newuserdatauv(L, length, 0);
+
+	if ((ptr = skb_header_pointer(LUADATA_TOSKB(data), luadata_skboffset(data, offset), length, buffer)) == NULL)
+		luaL_error(L, "couldn't read skb");
+	return ptr;
+}
+
+/***
+ * Bounds-checked pointer for writing; it must be followed by luadata_commit().
+ * For non-linear socket buffers, the region is written into buffer or, if it is NULL,
+ * into a new userdata pushed on the stack; then, luadata_commit() stores it.
+ */
+static void *luadata_checkwrite(lua_State *L, int ix, luadata_t *data, lua_Integer offset, lua_Integer length, void *buffer)
+{
+	struct sk_buff *skb;
+
+	luadata_checkwritable(L, data);
+	if (!(data->opt & LUADATA_OPT_SKB))
+		return luadata_checkbounds(L, ix, data, offset, length);
+
+	luadata_checkrange(L, ix, data, offset, length);
+	skb = LUADATA_TOSKB(data);
+	if (unlikely(skb_unclone(skb, GFP_ATOMIC) != 0))
+		luaL_error(L, "couldn't write skb");
+
+	/* skb_store_bits() writes fragments in place; thus, shared ones must be copied first */
+	if (!luadata_skblinear(data, offset, length) && unlikely(skb_has_shared_frag(skb)) && skb_linearize(skb) != 0)
+		luaL_error(L, "couldn't write skb");
+
+	if (luadata_skblinear(data, offset, length))
+		return skb->data + luadata_skboffset(data, offset);
+	return buffer != NULL ? buffer : lua_newuserdatauv(L, length, 0);
+}
+
+static inline void luadata_commit(lua_State *L, luadata_t *data, lua_Integer offset, const void *ptr, lua_Integer length)
+{
+	if ((data->opt & LUADATA_OPT_SKB) && !luadata_skblinear(data, offset, length) &&
+	    skb_store_bits(LUADATA_TOSKB(data), luadata_skboffset(data, offset), ptr, length) != 0)
+		luaL_error(L, "couldn't write skb");
+}
+
 /***
 * Extracts a signed 8-bit integer from the data object.
 * @function getint8
@@ -84,7 +193,8 @@ static int luadata_get##T(lua_State *L) \
 {					\
 	luadata_t *data = luadata_check(L, 1);					\
 	lua_Integer offset = luaL_checkinteger(L, 2);				\
-	T##_t value = *(T##_t *)luadata_checkbounds(L, 2, data, offset, sizeof(T##_t));		\
+	T##_t buffer;								\
+	T##_t value = *(T##_t *)luadata_checkread(L, 2, data, offset, sizeof(T##_t), &buffer);	\
 	lua_pushinteger(L, (lua_Integer)value);	\
 	return 1;			\
 }
@@ -94,9 +204,10 @@ static int luadata_set##T(lua_State *L)		\
 {						\
 	luadata_t *data = luadata_check(L, 1);					\
 	lua_Integer offset = luaL_checkinteger(L, 2);				\
-	T##_t *ptr = luadata_checkbounds(L, 2, data, offset, sizeof(T##_t));		\
-	luadata_checkwritable(L, data);		\
-	*ptr = (T##_t)luaL_checkinteger(L, 3);	\
+	T##_t value = (T##_t)luaL_checkinteger(L, 3);				\
+	T##_t *ptr = luadata_checkwrite(L, 2, data, offset, sizeof(T##_t), &value);	\
+	*ptr = value;				\
+	luadata_commit(L, data, offset, ptr, sizeof(T##_t));	\
 	return 0;				\
 }
 
@@ -189,69 +300,2039 @@ LUADATA_NEWINT(int32);
 */
 LUADATA_NEWINT(uint32);
 
-#ifdef __LP64__
-/***
-* Extracts a signed 64-bit integer from the data object.
-* Assumes host byte order.
-* @function getint64
-* @tparam integer offset Byte offset from the start of the data block (0-indexed).
-* @treturn integer The signed 64-bit integer value at the specified offset.
-* @raise Error if offset is out of bounds.
-*/
+#ifdef __LP64__
+/***
+* Extracts a signed 64-bit integer from the data object.
+* Assumes host byte order.
+* @function getint64
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @treturn integer The signed 64-bit integer value at the specified offset.
+* @raise Error if offset is out of bounds.
+*/
+/***
+* Inserts a signed 64-bit integer into the data object.
+* Assumes host byte order.
+* @function setint64
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @tparam integer value The signed 64-bit integer value to write.
+* @raise Error if offset is out of bounds or the data object is read-only.
+*/
+LUADATA_NEWINT(int64);
+#endif
+
+/***
+* Extracts a string from the data object.
+* @function getstring
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @tparam[opt] integer length Number of bytes to read. If omitted, reads all bytes from `offset` to the end of the data block.
+* @treturn string The string containing the bytes read from the data object.
+* @raise Error if offset/length is out of bounds.
+*/
+static int luadata_getstring(lua_State *L)
+{
+	luadata_t *data = luadata_check(L, 1);
+	lua_Integer offset = luaL_checkinteger(L, 2);
+	lua_Integer length = luaL_optinteger(L, 3, data->size - offset);
+	char *str = (char *)luadata_checkread(L, 2, data, offset, length, NULL);
+
+	lua_pushlstring(L, str, length);
+	return 1;
+}
+
+/***
+* Inserts a string into the data object.
+* @function setstring
+* @tparam integer offset Byte offset from the start of the data block (0-indexed) where writing will begin.
+* @tparam string s The string to write into the data object.
+* @raise Error if the write operation (offset + length of string) goes out of bounds, or if the data object is read-only.
+*/
+static int luadata_setstring(lua_State *L)
+{
+	size_t length;
+	luadata_t *data = luadata_check(L, 1);
+	lua_Integer offset = luaL_checkinteger(L, 2);
+	const char *str = luaL_checklstring(L, 3, &length);
+	void *ptr = luadata_checkwrite(L, 2, data, offset, length, (void *)str);
+
+	if (ptr != str)
+		memcpy(ptr, str, length);
+	luadata_commit(L, data, offset, str, length);
+	return 0;
+}
+
+/* data:pack() and data:unpack() follow the format of string.pack() and string.unpack() */
+#define LUADATA_MAXINTSIZE	(16)
+#define LUADATA_MAXALIGN	(__alignof__(lua_Integer))
+#define LUADATA_NB		(8)
+#define LUADATA_MC		((1 << LUADATA_NB) - 1)
+
+#ifdef __LITTLE_ENDIAN
+#define LUADATA_NATIVELITTLE	(true)
+#else
+#define LUADATA_NATIVELITTLE	(false)
+#endif
+
+typedef enum luadata_kopt_e {
+	LUADATA_KINT,		/* signed integers */
+	LUADATA_KUINT,		/* unsigned integers */
+	LUADATA_KCHAR,		/* fixed-length strings */
+	LUADATA_KSTRING,	/* strings with prefixed length */
+	LUADATA_KZSTR,		/* zero-terminated strings */
+	LUADATA_KPADDING,	/* padding */
+	LUADATA_KPADDALIGN,	/* padding for alignment */
+	LUADATA_KNOP,		/* no-op (configuration or spaces) */
+} luadata_kopt_t;
+
+typedef struct luadata_header_s {
+	lua_State *L;
+	bool little;
+	int maxalign;
+} luadata_header_t;
+
+#define luadata_isdigit(c)	((c) >= '0' && (c) <= '9')
+
+static int luadata_getnum(const char **fmt, int df)
+{
+	int a = 0;
+
+	if (!luadata_isdigit(**fmt))
+		return df;
+
+	do {
+		a = a * 10 + (*((*fmt)++) - '0');
+	} while (luadata_isdigit(**fmt) && a <= (INT_MAX - 9) / 10);
+	return a;
+}
+
+static int luadata_getnumlimit(luadata_header_t *h, const char **fmt, int df)
+{
+	int size = luadata_getnum(fmt, df);
+	if (unlikely(size > LUADATA_MAXINTSIZE || size <= 0))
+		luaL_error(h->L, "integral size (%d) out of limits [1,%d]", size, LUADATA_MAXINTSIZE);
+	return size;
+}
+
+static luadata_kopt_t luadata_getoption(luadata_header_t *h, const char **fmt, int *size)
+{
+	int opt = *((*fmt)++);
+
+	*size = 0;
+	switch (opt) {
+	case 'b': *size = sizeof(char); return LUADATA_KINT;
+	case 'B': *size = sizeof(char); return LUADATA_KUINT;
+	case 'h': *size = sizeof(short); return LUADATA_KINT;
+	case 'H': *size = sizeof(short); return LUADATA_KUINT;
+	case 'l': *size = sizeof(long); return LUADATA_KINT;
+	case 'L': *size = sizeof(long); return LUADATA_KUINT;
+	case 'j': *size = sizeof(lua_Integer); return LUADATA_KINT;
+	case 'J': *size = sizeof(lua_Integer); return LUADATA_KUINT;
+	case 'T': *size = sizeof(size_t); return LUADATA_KUINT;
+	case 'i': *size = luadata_getnumlimit(h, fmt, sizeof(int)); return LUADATA_KINT;
+	case 'I': *size = luadata_getnumlimit(h, fmt, sizeof(int)); return LUADATA_KUINT;
+	case 's': *size = luadata_getnumlimit(h, fmt, sizeof(size_t)); return LUADATA_KSTRING;
+	case 'c':
+		if ((*size = luadata_getnum(fmt, -1)) == -1)
+			luaL_error(h->L, "missing size for format option 'c'");
+		return LUADATA_KCHAR;
+	case 'z': return LUADATA_KZSTR;
+	case 'x': *size = 1; return LUADATA_KPADDING;
+	case 'X': return LUADATA_KPADDALIGN;
+	case ' ': break;
+	case '<': h->little = true; break;
+	case '>': h->little = false; break;
+	case '=': h->little = LUADATA_NATIVELITTLE; break;
+	case '!': h->maxalign = luadata_getnumlimit(h, fmt, LUADATA_MAXALIGN); break;
+	default: luaL_error(h->L, "invalid format option '%c'", opt); /* there are no floats in the kernel */
+	}
+	return LUADATA_KNOP;
+}
+
+static luadata_kopt_t luadata_getdetails(luadata_header_t *h, size_t pos, const char **fmt, int *size, int *ntoalign)
+{
+	luadata_kopt_t opt = luadata_getoption(h, fmt, size);
+	int align = *size; /* usually, alignment follows size */
+
+	if (opt == LUADATA_KPADDALIGN) { /* 'X' gets alignment from following option */
+		if (**fmt == '\0' || luadata_getoption(h, fmt, &align) == LUADATA_KCHAR || align == 0)
+			luaL_error(h->L, "invalid next option for option 'X'");
+	}
+
+	if (align <= 1 || opt == LUADATA_KCHAR)
+		*ntoalign = 0;
+	else {
+		if (align > h->maxalign)
+			align = h->maxalign;
+		if (unlikely((align & (align - 1)) != 0))
+			luaL_error(h->L, "format asks for alignment not power of 2");
+		*ntoalign = (align - (int)(pos & (align - 1))) & (align - 1);
+	}
+	return opt;
+}
+
+#define luadata_initheader(L, h)	\
+	luadata_header_t h = {.L = (L), .little = LUADATA_NATIVELITTLE, .maxalign = 1}
+
+#define luadata_byteix(h, i, size)	((h)->little ? (i) : (size) - 1 - (i))
+
+static lua_Integer luadata_unpackint(luadata_header_t *h, const uint8_t *ptr, int size, bool issigned)
+{
+	lua_Unsigned res = 0;
+	int limit = size <= LUADATA_NUMBER_SZ ? size : LUADATA_NUMBER_SZ;
+	int i;
+
+	for (i = limit - 1; i >= 0; i--) {
+		res <<= LUADATA_NB;
+		res |= (lua_Unsigned)ptr[luadata_byteix(h, i, size)];
+	}
+
+	if (size < LUADATA_NUMBER_SZ) {
+		if (issigned) { /* sign extension */
+			lua_Unsigned mask = (lua_Unsigned)1 << (size * LUADATA_NB - 1);
+			res = ((res ^ mask) - mask);
+		}
+	}
+	else if (size > LUADATA_NUMBER_SZ) { /* must check unread bytes */
+		int mask = (!issigned || (lua_Integer)res >= 0) ? 0 : LUADATA_MC;
+		for (i = limit; i < size; i++) {
+			if (unlikely(ptr[luadata_byteix(h, i, size)] != mask))
+				luaL_error(h->L, "%d-byte integer does not fit into Lua Integer", size);
+		}
+	}
+	return (lua_Integer)res;
+}
+
+static void luadata_packint(luadata_header_t *h, uint8_t *ptr, lua_Unsigned n, int size, bool neg)
+{
+	int i;
+
+	ptr[luadata_byteix(h, 0, size)] = (uint8_t)(n & LUADATA_MC);
+	for (i = 1; i < size; i++) {
+		n >>= LUADATA_NB;
+		ptr[luadata_byteix(h, i, size)] = (uint8_t)(n & LUADATA_MC);
+	}
+
+	if (neg && size > LUADATA_NUMBER_SZ) { /* sign extension */
+		for (i = LUADATA_NUMBER_SZ; i < size; i++)
+			ptr[luadata_byteix(h, i, size)] = (uint8_t)LUADATA_MC;
+	}
+}
+
+/* returns the length of the fixed-size prefix of fmt; sets variable if it has 's' or 'z' options */
+static size_t luadata_fixedsize(lua_State *L, const char *fmt, size_t offset, bool *variable)
+{
+	luadata_initheader(L, h);
+	size_t pos = offset;
+
+	*variable = false;
+	while (*fmt != '\0') {
+		int size, ntoalign;
+		luadata_kopt_t opt = luadata_getdetails(&h, pos, &fmt, &size, &ntoalign);
+
+		if (opt == LUADATA_KSTRING || opt == LUADATA_KZSTR) {
+			*variable = true;
+			break;
+		}
+		pos += ntoalign + size;
+	}
+	return pos - offset;
+}
+
+#define luadata_at(ptr, offset, pos)	((ptr) + ((pos) - (offset)))
+
+#define luadata_checkavailable(L, data, pos, n, checked)	\
+	luaL_argcheck((L), (checked) || (n) <= (data)->size - (pos), 2, "data too short")
+
+/* strings of non-linear socket buffers are scanned in chunks, so only the string itself is copied */
+#define LUADATA_ZCHUNK	(64)
+
+static size_t luadata_zlength(lua_State *L, luadata_t *data, size_t pos)
+{
+	char buffer[LUADATA_ZCHUNK];
+	size_t len = 0;
+
+	while (pos + len < data->size) {
+		size_t n = data->size - pos - len;
+		size_t z;
+		const char *chunk;
+
+		if (data->opt & LUADATA_OPT_SKB)
+			n = min(n, sizeof(buffer));
+		chunk = (const char *)luadata_checkread(L, 2, data, pos + len, n, buffer);
+		z = strnlen(chunk, n);
+		len += z;
+		if (z < n)
+			return len;
+	}
+	luaL_argerror(L, 2, "unfinished string for format 'z'");
+	return 0;
+}
+
+/* pushes a string read from the data object, dropping the copy of non-linear socket buffers */
+static void luadata_pushbytes(lua_State *L, luadata_t *data, size_t pos, size_t len)
+{
+	int top = lua_gettop(L);
+	const char *s = len > 0 ? (const char *)luadata_checkread(L, 2, data, pos, len, NULL) : "";
+
+	lua_pushlstring(L, s, len);
+	if (lua_gettop(L) > top + 1)
+		lua_remove(L, -2);
+}
+
+/***
+* Unpacks values from the data object, as `string.unpack` does from a string.
+* All integer formats are supported, including the endianness (`<`, `>` and `=`) and
+* alignment (`!` and `X`) options, as well as `c`, `s`, `z` and `x`; floating-point
+* formats are not. The prefix of fixed size of the format is bounds-checked once for
+* the whole call; the values that follow an `s` or `z` option are checked (and, for
+* non-linear socket buffers, read) on their own.
+* @function unpack
+* @tparam string fmt Format string (see `string.unpack`).
+* @tparam[opt=0] integer offset Byte offset from the start of the data block (0-indexed).
+* @return The unpacked values, followed by the offset of the first unread byte.
+* @raise Error if the format is invalid or the unpacked values are out of bounds.
+* @usage
+*   local ihl_version, tos, len, id, frag, ttl, proto = skb:unpack(">BBHHHBB", 0)
+*/
+static int luadata_unpack(lua_State *L)
+{
+	luadata_t *data = luadata_check(L, 1);
+	const char *fmt = luaL_checkstring(L, 2);
+	lua_Integer offset = luaL_optinteger(L, 3, 0);
+	luadata_initheader(L, h);
+	uint8_t buffer[LUADATA_MAXINTSIZE];
+	size_t pos, fixed;
+	uint8_t *ptr = NULL;
+	bool variable;
+	int n = 0;
+
+	luaL_argcheck(L, offset >= 0 && offset <= data->size, 3, "out of bounds");
+	fixed = luadata_fixedsize(L, fmt, offset, &variable);
+	if (fixed > 0)
+		ptr = (uint8_t *)luadata_checkread(L, 3, data, offset, fixed, NULL);
+
+	pos = (size_t)offset;
+	while (*fmt != '\0') {
+		int size, ntoalign;
+		luadata_kopt_t opt = luadata_getdetails(&h, pos, &fmt, &size, &ntoalign);
+		bool checked = pos - offset + ntoalign + size <= fixed;
+		const uint8_t *item;
+
+		luadata_checkavailable(L, data, pos, (size_t)ntoalign + size, checked);
+		pos += ntoalign;
+		luaL_checkstack(L, 3, "too many results");
+		n++;
+		switch (opt) {
+		case LUADATA_KINT:
+		case LUADATA_KUINT:
+			item = checked ? luadata_at(ptr, offset, pos) : luadata_checkread(L, 2, data, pos, size, buffer);
+			lua_pushinteger(L, luadata_unpackint(&h, item, size, opt == LUADATA_KINT));
+			break;
+		case LUADATA_KCHAR:
+			if (checked)
+				lua_pushlstring(L, (const char *)luadata_at(ptr, offset, pos), size);
+			else
+				luadata_pushbytes(L, data, pos, size);
+			break;
+		case LUADATA_KSTRING: {
+			size_t len;
+
+			item = luadata_checkread(L, 2, data, pos, size, buffer);
+			len = (size_t)luadata_unpackint(&h, item, size, false);
+			luadata_checkavailable(L, data, pos + size, len, false);
+			luadata_pushbytes(L, data, pos + size, len);
+			pos += len;
+			break;
+		}
+		case LUADATA_KZSTR: {
+			size_t len = luadata_zlength(L, data, pos);
+			luadata_pushbytes(L, data, pos, len);
+			pos += len + 1;
+			break;
+		}
+		case LUADATA_KPADDALIGN: case LUADATA_KPADDING: case LUADATA_KNOP:
+			n--;
+			break;
+		}
+		pos += size;
+	}
+	lua_pushinteger(L, (lua_Integer)pos);
+	return n + 1;
+}
+
+/* returns the length of the packed values, validating them beforehand so that nothing is written on errors */
+static size_t luadata_packsize(lua_State *L, const char *fmt, size_t offset)
+{
+	luadata_initheader(L, h);
+	size_t pos = offset;
+	int arg = 3;
+
+	while (*fmt != '\0') {
+		int size, ntoalign;
+		luadata_kopt_t opt = luadata_getdetails(&h, pos, &fmt, &size, &ntoalign);
+
+		pos += ntoalign + size;
+		switch (opt) {
+		case LUADATA_KINT: {
+			lua_Integer n = luaL_checkinteger(L, ++arg);
+			if (size < LUADATA_NUMBER_SZ) {
+				lua_Integer lim = (lua_Integer)1 << ((size * LUADATA_NB) - 1);
+				luaL_argcheck(L, -lim <= n && n < lim, arg, "integer overflow");
+			}
+			break;
+		}
+		case LUADATA_KUINT: {
+			lua_Integer n = luaL_checkinteger(L, ++arg);
+			if (size < LUADATA_NUMBER_SZ)
+				luaL_argcheck(L, (lua_Unsigned)n < ((lua_Unsigned)1 << (size * LUADATA_NB)), arg, "unsigned overflow");
+			break;
+		}
+		case LUADATA_KCHAR: {
+			size_t len;
+			luaL_checklstring(L, ++arg, &len);
+			luaL_argcheck(L, len <= (size_t)size, arg, "string longer than given size");
+			break;
+		}
+		case LUADATA_KSTRING: {
+			size_t len;
+			luaL_checklstring(L, ++arg, &len);
+			luaL_argcheck(L, size >= (int)sizeof(size_t) || len < ((size_t)1 << (size * LUADATA_NB)),
+				arg, "string length does not fit in given size");
+			pos += len;
+			break;
+		}
+		case LUADATA_KZSTR: {
+			size_t len;
+			const char *s = luaL_checklstring(L, ++arg, &len);
+			luaL_argcheck(L, strlen(s) == len, arg, "string contains zeros");
+			pos += len + 1;
+			break;
+		}
+		case LUADATA_KPADDING: case LUADATA_KPADDALIGN: case LUADATA_KNOP:
+			break;
+		}
+	}
+	return pos - offset;
+}
+
+/***
+* Packs values into the data object, as `string.pack` does into a string.
+* It supports the same formats as `unpack`. All values are validated and the whole
+* packed length is bounds-checked once, before anything is written.
+* @function pack
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @tparam string fmt Format string (see `string.pack`).
+* @param ... Values to be packed.
+* @treturn integer The offset of the first byte after the packed values.
+* @raise Error if the format or the values are invalid, if the packed values are out of bounds,
+*   or if the data object is read-only.
+* @usage
+*   skb:pack(thoff, ">HH", sport, dport)
+*/
+static int luadata_pack(lua_State *L)
+{
+	luadata_t *data = luadata_check(L, 1);
+	lua_Integer offset = luaL_checkinteger(L, 2);
+	const char *fmt = luaL_checkstring(L, 3);
+	luadata_initheader(L, h);
+	size_t pos, total;
+	uint8_t *ptr = NULL;
+	int arg = 3;
+
+	luadata_checkwritable(L, data);
+	luaL_argcheck(L, offset >= 0 && offset <= data->size, 2, "out of bounds");
+	if ((total = luadata_packsize(L, fmt, offset)) > 0)
+		ptr = (uint8_t *)luadata_checkwrite(L, 2, data, offset, total, NULL);
+
+	pos = (size_t)offset;
+	while (*fmt != '\0') {
+		int size, ntoalign;
+		luadata_kopt_t opt = luadata_getdetails(&h, pos, &fmt, &size, &ntoalign);
+
+		memset(luadata_at(ptr, offset, pos), 0, ntoalign); /* alignment padding */
+		pos += ntoalign;
+		switch (opt) {
+		case LUADATA_KINT:
+		case LUADATA_KUINT: {
+			lua_Integer n = lua_tointeger(L, ++arg);
+			luadata_packint(&h, luadata_at(ptr, offset, pos), (lua_Unsigned)n, size, n < 0);
+			break;
+		}
+		case LUADATA_KCHAR: {
+			size_t len;
+			const char *s = lua_tolstring(L, ++arg, &len);
+			memcpy(luadata_at(ptr, offset, pos), s, len);
+			memset(luadata_at(ptr, offset, pos) + len, 0, size - len);
+			break;
+		}
+		case LUADATA_KSTRING: {
+			size_t len;
+			const char *s = lua_tolstring(L, ++arg, &len);
+			luadata_packint(&h, luadata_at(ptr, offset, pos), (lua_Unsigned)len, size, false);
+			memcpy(luadata_at(ptr, offset, pos) + size, s, len);
+			pos += len;
+			break;
+		}
+		case LUADATA_KZSTR: {
+			size_t len;
+			const char *s = lua_tolstring(L, ++arg, &len);
+			memcpy(luadata_at(ptr, offset, pos), s, len + 1);
+			pos += len + 1;
+			break;
+		}
+		case LUADATA_KPADDING:
+			*luadata_at(ptr, offset, pos) = 0;
+			break;
+		case LUADATA_KPADDALIGN: case LUADATA_KNOP:
+			break;
+		}
+		pos += size;
+	}
+
+	if (total > 0)
+		luadata_commit(L, data, offset, ptr, total);
+	lua_pushinteger(L, (lua_Integer)pos);
+	return 1;
+}
+
+static __wsum luadata_csum(lua_State *L, int ix, luadata_t *data, lua_Integer offset, lua_Integer length, __wsum seed)
+{
+	if (data->opt & LUADATA_OPT_SKB) {
+		luadata_checkrange(L, ix, data, offset, length);
+		return skb_checksum(LUADATA_TOSKB(data), luadata_skboffset(data, offset), length, seed);
+	}
+	return csum_partial(luadata_checkbounds(L, ix, data, offset, length), length, seed);
+}
+
+/***
+* Computes the Internet checksum (RFC 1071) of a region of the data object.
+* It uses the architecture-optimized `csum_partial` of the kernel.
+* @function checksum
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @tparam integer length Number of bytes to be summed.
+* @tparam[opt=0] integer seed A partial sum to be added (e.g., the second return of a previous call).
+* @treturn integer The folded checksum, ready to be stored with `setuint16`.
+* @treturn integer The unfolded 32-bit partial sum, to be used as the seed of a further call.
+* @raise Error if offset/length is out of bounds.
+* @usage
+*   skb:setuint16(10, 0)
+*   skb:setuint16(10, skb:checksum(0, 20)) -- IPv4 header checksum
+*/
+static int luadata_checksum(lua_State *L)
+{
+	luadata_t *data = luadata_check(L, 1);
+	lua_Integer offset = luaL_checkinteger(L, 2);
+	lua_Integer length = luaL_checkinteger(L, 3);
+	__wsum seed = (__force __wsum)(u32)luaL_optinteger(L, 4, 0);
+	__wsum csum = luadata_csum(L, 2, data, offset, length, seed);
+
+	lua_pushinteger(L, (lua_Integer)(__force u16)csum_fold(csum));
+	lua_pushinteger(L, (lua_Integer)(__force u32)csum);
+	return 2;
+}
+
+static inline __sum16 luadata_getsum(lua_State *L, luadata_t *data, lua_Integer offset)
+{
+	__sum16 buffer;
+	return *(__sum16 *)luadata_checkread(L, 2, data, offset, sizeof(__sum16), &buffer);
+}
+
+static inline void luadata_setsum(lua_State *L, luadata_t *data, lua_Integer offset, __sum16 sum)
+{
+	__sum16 *ptr = (__sum16 *)luadata_checkwrite(L, 2, data, offset, sizeof(__sum16), &sum);
+	*ptr = sum;
+	luadata_commit(L, data, offset, ptr, sizeof(__sum16));
+}
+
+#define luadata_checkbe16(L, ix)	((__force __be16)(u16)luaL_checkinteger((L), (ix)))
+#define luadata_checkbe32(L, ix)	((__force __be32)(u32)luaL_checkinteger((L), (ix)))
+
+/***
+* Incrementally updates a checksum stored in the data object after a 16-bit field has changed.
+* It mirrors `csum_replace2` of the kernel; values are in network byte order, as read by `getuint16`.
+* @function csumreplace2
+* @tparam integer offset Byte offset of the 16-bit checksum field.
+* @tparam integer from The old value of the changed field.
+* @tparam integer to The new value of the changed field.
+* @raise Error if offset is out of bounds or the data object is read-only.
+*/
+static int luadata_csumreplace2(lua_State *L)
+{
+	luadata_t *data = luadata_check(L, 1);
+	lua_Integer offset = luaL_checkinteger(L, 2);
+	__sum16 sum = luadata_getsum(L, data, offset);
+
+	csum_replace2(&sum, luadata_checkbe16(L, 3), luadata_checkbe16(L, 4));
+	luadata_setsum(L, data, offset, sum);
+	return 0;
+}
+
+/***
+* Incrementally updates a checksum stored in the data object after a 32-bit field has changed.
+* It mirrors `csum_replace4` of the kernel; values are in network byte order, as read by `getuint32`.
+* @function csumreplace4
+* @tparam integer offset Byte offset of the 16-bit checksum field.
+* @tparam integer from The old value of the changed field.
+* @tparam integer to The new value of the changed field.
+* @raise Error if offset is out of bounds or the data object is read-only.
+* @usage
+*   local old = skb:getuint32(16)
+*   skb:setuint32(16, new)
+*   skb:csumreplace4(10, old, new) -- IPv4 header checksum
+*/
+static int luadata_csumreplace4(lua_State *L)
+{
+	luadata_t *data = luadata_check(L, 1);
+	lua_Integer offset = luaL_checkinteger(L, 2);
+	__sum16 sum = luadata_getsum(L, data, offset);
+
+	csum_replace4(&sum, luadata_checkbe32(L, 3), luadata_checkbe32(L, 4));
+	luadata_setsum(L, data, offset, sum);
+	return 0;
+}
+
+/***
+* Incrementally updates a transport-layer checksum after a 32-bit field has changed.
+* It mirrors `inet_proto_csum_replace4` of the kernel; thus, on packets, it also keeps
+* the checksum state of the socket buffer consistent (e.g., `CHECKSUM_PARTIAL`).
+* @function csumprotoreplace4
+* @tparam integer offset Byte offset of the 16-bit checksum field (e.g., of the TCP or UDP header).
+* @tparam integer from The old value of the changed field.
+* @tparam integer to The new value of the changed field.
+* @tparam[opt=false] boolean pseudohdr `true` if the changed field is part of the pseudo-header (e.g., an IP address).
+* @raise Error if offset is out of bounds or the data object is read-only.
+*/
+static int luadata_csumprotoreplace4(lua_State *L)
+{
+	luadata_t *data = luadata_check(L, 1);
+	lua_Integer offset = luaL_checkinteger(L, 2);
+	__be32 from = luadata_checkbe32(L, 3);
+	__be32 to = luadata_checkbe32(L, 4);
+	bool pseudohdr = lua_toboolean(L, 5);
+	__sum16 sum = luadata_getsum(L, data, offset);
+
+	if (data->opt & LUADATA_OPT_SKB)
+		inet_proto_csum_replace4(&sum, LUADATA_TOSKB(data), from, to, pseudohdr);
+	else
+		csum_replace4(&sum, from, to);
+	luadata_setsum(L, data, offset, sum);
+	return 0;
+}
+
+/***
+* Computes the checksum of a transport-layer segment, including the IPv4 or IPv6 pseudo-header.
+* The checksum field of the segment must be zeroed beforehand. For UDP, a zero checksum
+* is returned as `0xFFFF`.
+* @function l4checksum
+* @tparam integer iphoff Byte offset of the IP header.
+* @tparam integer l4off Byte offset of the transport header.
+* @tparam[opt] integer length Length of the segment. If omitted, it goes up to the end of the data block.
+* @tparam[opt] integer proto Transport protocol. If omitted, it is read from the IP header.
+* @treturn integer The folded checksum, ready to be stored with `setuint16`.
+* @raise Error if the IP version is unknown or offset/length is out of bounds.
+* @usage
+*   skb:setuint16(thoff + 6, 0)
+*   skb:setuint16(thoff + 6, skb:l4checksum(0, thoff)) -- UDP checksum
+*/
+static int luadata_l4checksum(lua_State *L)
+{
+	luadata_t *data = luadata_check(L, 1);
+	lua_Integer iphoff = luaL_checkinteger(L, 2);
+	lua_Integer l4off = luaL_checkinteger(L, 3);
+	lua_Integer length = luaL_optinteger(L, 4, data->size - l4off);
+	__wsum csum = luadata_csum(L, 3, data, l4off, length, 0);
+	u8 buffer, version = *(u8 *)luadata_checkread(L, 2, data, iphoff, sizeof(u8), &buffer) >> 4;
+	lua_Integer proto;
+	__sum16 sum;
+
+	if (version == 4) {
+		struct iphdr iphbuffer;
+		const struct iphdr *iph = luadata_checkread(L, 2, data, iphoff, sizeof(struct iphdr), &iphbuffer);
+
+		proto = luaL_optinteger(L, 5, iph->protocol);
+		sum = csum_tcpudp_magic(iph->saddr, iph->daddr, length, proto, csum);
+	}
+	else if (version == 6) {
+		struct ipv6hdr ip6hbuffer;
+		const struct ipv6hdr *ip6h = luadata_checkread(L, 2, data, iphoff, sizeof(struct ipv6hdr), &ip6hbuffer);
+
+		proto = luaL_optinteger(L, 5, ip6h->nexthdr);
+		sum = csum_ipv6_magic(&ip6h->saddr, &ip6h->daddr, length, proto, csum);
+	}
+	else
+		return luaL_argerror(L, 2, "unknown IP version");
+
+	if (proto == IPPROTO_UDP && sum == 0)
+		sum = CSUM_MANGLED_0;
+	lua_pushinteger(L, (lua_Integer)(__force u16)sum);
+	return 1;
+}
+
+#define LUADATA_HASH_MAXKEY	(128)
+
+static u64 luadata_dohash(lua_State *L, int ix, const void *ptr, size_t length)
+{
+	if (lua_type(L, ix) == LUA_TSTRING) {
+		siphash_key_t key;
+		size_t keylen;
+		const char *k = lua_tolstring(L, ix, &keylen);
+
+		luaL_argcheck(L, keylen == sizeof(siphash_key_t), ix, "siphash key must have 16 bytes");
+		memcpy(&key, k, sizeof(siphash_key_t));
+		return siphash(ptr, length, &key);
+	}
+	return jhash(ptr, length, (u32)luaL_optinteger(L, ix, 0));
+}
+
+/***
+* Hashes a region of the data object, without creating a Lua string.
+* It uses `jhash` with an integer seed or, if the seed is a 16-byte string, the keyed `siphash`,
+* which should be preferred when the hashed bytes are controlled by a remote peer.
+* @function hash
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @tparam integer length Number of bytes to be hashed.
+* @tparam[opt=0] integer|string seed The `jhash` seed or the `siphash` key.
+* @treturn integer The hash value (32-bit for `jhash`; 64-bit for `siphash`).
+* @raise Error if offset/length is out of bounds.
+* @usage
+*   local flow = skb:hash(12, 8, key) -- IPv4 source and destination addresses
+*/
+static int luadata_hash(lua_State *L)
+{
+	luadata_t *data = luadata_check(L, 1);
+	lua_Integer offset = luaL_checkinteger(L, 2);
+	lua_Integer length = luaL_checkinteger(L, 3);
+	const void *ptr = luadata_checkread(L, 2, data, offset, length, NULL);
+
+	lua_pushinteger(L, (lua_Integer)luadata_dohash(L, 4, ptr, length));
+	return 1;
+}
+
+/***
+* Hashes several non-contiguous regions of the data object at once, as if they were contiguous.
+* It is meant for flow keys (e.g., a 5-tuple) made of distinct header fields.
+* @function hashranges
+* @tparam integer|string|nil seed The `jhash` seed or the `siphash` key (see `hash`).
+* @tparam integer offset Byte offset of the first region.
+* @tparam integer length Length of the first region.
+* @param ... Further pairs of offset and length.
+* @treturn integer The hash value.
+* @raise Error if any region is out of bounds or if they sum up to more than 128 bytes.
+* @usage
+*   local flow = skb:hashranges(seed, 9, 1, 12, 8, thoff, 4) -- protocol, addresses and ports
+*/
+static int luadata_hashranges(lua_State *L)
+{
+	luadata_t *data = luadata_check(L, 1);
+	int nargs = lua_gettop(L);
+	u8 key[LUADATA_HASH_MAXKEY];
+	size_t keylen = 0;
+	int ix;
+
+	luaL_argcheck(L, nargs >= 4 && (nargs % 2) == 0, nargs, "expected pairs of offset and length");
+	for (ix = 3; ix < nargs; ix += 2) {
+		lua_Integer offset = luaL_checkinteger(L, ix);
+		lua_Integer length = luaL_checkinteger(L, ix + 1);
+		const void *ptr;
+
+		luaL_argcheck(L, length > 0 && length <= LUADATA_HASH_MAXKEY - keylen, ix + 1, "key too long");
+		ptr = luadata_checkread(L, ix, data, offset, length, key + keylen);
+		if (ptr != key + keylen)
+			memcpy(key + keylen, ptr, length);
+		keylen += length;
+	}
+
+	lua_pushinteger(L, (lua_Integer)luadata_dohash(L, 2, key, keylen));
+	return 1;
+}
+
+/*
+* Methods that access another data object run with both locks held. The object itself is already
+* locked by its monitor (see luadata_index()); thus, to avoid ABBA deadlocks (e.g., a:copy(b) racing with
+* b:copy(a)), the other is locked in address order, releasing the former when it must come second.
+* The operation runs in protected mode, so errors don't leak the other lock. Slices are represented by the
+* lock of their parent (see luadata_toguard()).
+*/
+static int luadata_lockother(lua_State *L, int ix, lua_CFunction op)
+{
+	lunatik_object_t *self = luadata_toguard(lunatik_toobject(L, 1));
+	lunatik_object_t *other = luadata_toguard(luadata_checkobject(L, ix));
+	bool locked = !luadata_ispercpu(luadata_checkprivate(L, 1)); /* per-CPU data isn't monitored */
+	int ret, n = lua_gettop(L);
+
+	if (other == self)
+		return op(L);
+
+	lua_pushcfunction(L, op);
+	lua_insert(L, 1); /* stack: op, self, args */
+
+	if (!locked)
+		lunatik_lock(other);
+	else if (lunatik_trylock(other))
+		;
+	else if (self < other)
+		lunatik_locknested(other);
+	else {
+		lunatik_unlock(self);
+		lunatik_lock(other);
+		lunatik_locknested(self);
+	}
+	ret = lua_pcall(L, n, LUA_MULTRET, 0);
+	lunatik_unlock(other);
+
+	if (ret != LUA_OK)
+		lua_error(L);
+	return lua_gettop(L);
+}
+
+static int luadata_docopy(lua_State *L)
+{
+	luadata_t *src = luadata_check(L, 1);
+	luadata_t *dst = luadata_check(L, 2);
+	lua_Integer dstoff = luaL_checkinteger(L, 3);
+	lua_Integer srcoff = luaL_checkinteger(L, 4);
+	lua_Integer length = luaL_checkinteger(L, 5);
+	/* writing might reallocate the skb head; thus, the source must be read afterwards */
+	void *to = luadata_checkwrite(L, 3, dst, dstoff, length, NULL);
+	const void *from = luadata_checkread(L, 4, src, srcoff, length, NULL);
+
+	memmove(to, from, length);
+	luadata_commit(L, dst, dstoff, to, length);
+	return 0;
+}
+
+/***
+* Copies a region of the data object into another data object, without creating Lua strings.
+* Overlapping regions (e.g., within the same object) are handled correctly.
+* @function copy
+* @tparam data dst The destination data object (it might be the data object itself).
+* @tparam integer dstoff Byte offset in the destination (0-indexed).
+* @tparam integer srcoff Byte offset in the source (0-indexed).
+* @tparam integer length Number of bytes to be copied.
+* @raise Error if any region is out of bounds or if the destination is read-only.
+* @usage
+*   skb:copy(reply, 0, thoff + 8, 12) -- copies the DNS header into a reply buffer
+*/
+static int luadata_copy(lua_State *L)
+{
+	return luadata_lockother(L, 2, luadata_docopy);
+}
+
+/***
+* Fills a region of the data object with a byte value.
+* @function fill
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @tparam integer length Number of bytes to be filled.
+* @tparam[opt=0] integer byte The byte value (0-255).
+* @raise Error if offset/length is out of bounds or the data object is read-only.
+*/
+static int luadata_fill(lua_State *L)
+{
+	luadata_t *data = luadata_check(L, 1);
+	lua_Integer offset = luaL_checkinteger(L, 2);
+	lua_Integer length = luaL_checkinteger(L, 3);
+	int byte = (int)luaL_optinteger(L, 4, 0);
+	void *ptr = luadata_checkwrite(L, 2, data, offset, length, NULL);
+
+	memset(ptr, byte, length);
+	luadata_commit(L, data, offset, ptr, length);
+	return 0;
+}
+
+static int luadata_docompare(lua_State *L)
+{
+	luadata_t *data = luadata_check(L, 1);
+	lua_Integer offset = luaL_checkinteger(L, 2);
+	luadata_t *other = luadata_check(L, 3);
+	lua_Integer otheroff = luaL_checkinteger(L, 4);
+	lua_Integer length = luaL_checkinteger(L, 5);
+	const void *s1 = luadata_checkread(L, 2, data, offset, length, NULL);
+	const void *s2 = luadata_checkread(L, 4, other, otheroff, length, NULL);
+	int ret = memcmp(s1, s2, length);
+
+	lua_pushinteger(L, ret < 0 ? -1 : ret > 0);
+	return 1;
+}
+
+/***
+* Compares a region of the data object with a region of another data object.
+* @function compare
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @tparam data other The data object to compare with (it might be the data object itself).
+* @tparam integer otheroff Byte offset in the other data object (0-indexed).
+* @tparam integer length Number of bytes to be compared.
+* @treturn integer `0` if the regions are equal; `-1` or `1` if the first differing byte is lower or greater, respectively.
+* @raise Error if any region is out of bounds.
+*/
+static int luadata_compare(lua_State *L)
+{
+	return luadata_lockother(L, 3, luadata_docompare);
+}
+
+#define luadata_cpuptr(d, cpu, offset)	(per_cpu_ptr((void __percpu *)(d)->ptr, (cpu)) + (d)->offset + (offset))
+
+static inline luadata_t *luadata_checkpercpu(lua_State *L, int ix)
+{
+	luadata_t *data = luadata_check(L, ix);
+	luaL_argcheck(L, luadata_ispercpu(data), ix, "per-CPU data expected");
+	return data;
+}
+
+#define LUADATA_NEWSUM(T)						\
+static int luadata_sum##T(lua_State *L)					\
+{									\
+	luadata_t *data = luadata_checkpercpu(L, 1);			\
+	lua_Integer offset = luaL_checkinteger(L, 2);			\
+	u64 sum = 0;							\
+	int cpu;							\
+									\
+	luadata_checkrange(L, 2, data, offset, sizeof(u##T));		\
+	for_each_possible_cpu(cpu)					\
+		sum += READ_ONCE(*(u##T *)luadata_cpuptr(data, cpu, offset));	\
+	lua_pushinteger(L, (lua_Integer)sum);				\
+	return 1;							\
+}
+
+/***
+* Sums an unsigned 32-bit integer (host byte order) over the copies of all CPUs.
+* @function sum32
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @treturn integer The sum, which might exceed 32 bits.
+* @raise Error if offset is out of bounds or the data object isn't per-CPU.
+* @see percpu
+*/
+LUADATA_NEWSUM(32);
+
+/***
+* Sums an unsigned 64-bit integer (host byte order) over the copies of all CPUs.
+* @function sum64
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @treturn integer The sum, wrapping around at 64 bits.
+* @raise Error if offset is out of bounds or the data object isn't per-CPU.
+* @see percpu
+*/
+LUADATA_NEWSUM(64);
+
+/***
+* Copies the per-CPU data into a new, regular data object.
+* @function snapshot
+* @tparam[opt] integer cpu The CPU whose copy is taken. If omitted, the copies of all possible
+*   CPUs are laid out one after another, the copy of CPU `n` at offset `n * #data`.
+* @treturn data A new data object.
+* @raise Error if the CPU isn't possible or the data object isn't per-CPU.
+* @see percpu
+*/
+static int luadata_snapshot(lua_State *L)
+{
+	luadata_t *data = luadata_checkpercpu(L, 1);
+	bool all = lua_isnoneornil(L, 2);
+	lua_Integer cpu = luaL_optinteger(L, 2, 0);
+	size_t size = all ? data->size * nr_cpu_ids : data->size;
+	luadata_t *snapshot;
+
+	luaL_argcheck(L, cpu >= 0 && cpu < (lua_Integer)nr_cpu_ids && cpu_possible(cpu), 2, "invalid CPU");
+	lua_pushcfunction(L, luadata_lnew);
+	lua_pushinteger(L, (lua_Integer)size);
+	lua_call(L, 1, 1);
+	snapshot = luadata_checkprivate(L, -1);
+
+	if (!all)
+		memcpy(snapshot->ptr, luadata_cpuptr(data, cpu, 0), data->size);
+	else {
+		memset(snapshot->ptr, 0, size);
+		for_each_possible_cpu(cpu)
+			memcpy(snapshot->ptr + cpu * data->size, luadata_cpuptr(data, cpu, 0), data->size);
+	}
+	return 1; /* snapshot */
+}
+
+/*
+* Atomic operations aren't monitored; thus, the first one pins the memory of the object (i.e., of the
+* parent of a slice), which is validated under its lock. Pinned memory is owned by the object and is
+* never moved (i.e., resize() and append() can't grow it beyond its capacity), so later operations
+* access it without locking. Per-CPU memory can't be moved at all.
+*/
+static void luadata_pin(lua_State *L, int ix)
+{
+	lunatik_object_t *object = luadata_checkobject(L, ix);
+	lunatik_object_t *guard = luadata_toguard(object);
+	luadata_t *data = (luadata_t *)object->private;
+	luadata_t *owner = (luadata_t *)guard->private;
+	bool stale, pinned;
+
+	if (luadata_ispercpu(data) || READ_ONCE(owner->pinned))
+		return;
+
+	lunatik_lock(guard);
+	stale = luadata_isstale(data);
+	pinned = !stale && (owner->opt & LUADATA_OPT_FREE);
+	if (pinned)
+		WRITE_ONCE(owner->pinned, true);
+	lunatik_unlock(guard);
+
+	luaL_argcheck(L, !stale, ix, "invalidated slice");
+	luaL_argcheck(L, pinned, ix, "atomic operations on external memory aren't supported");
+}
+
+static void *luadata_checkaligned(lua_State *L, luadata_t *data, lua_Integer offset, size_t size, bool write)
+{
+	void *ptr;
+
+	luaL_argcheck(L, !(data->opt & LUADATA_OPT_SKB), 1, "atomic operations on packets aren't supported");
+	luadata_pin(L, 1);
+	if (write)
+		luadata_checkwritable(L, data);
+	ptr = luadata_checkbounds(L, 2, data, offset, size);
+	luaL_argcheck(L, IS_ALIGNED((uintptr_t)ptr, size), 2, "unaligned offset");
+	return ptr;
+}
+
+#define luadata_toatomic(L, A, write)	\
+	((A##_t *)luadata_checkaligned((L), luadata_checkprivate((L), 1), luaL_checkinteger((L), 2), sizeof(A##_t), (write)))
+
+#define LUADATA_NEWATOMIC_OP(A, op)				\
+static int luadata_##A##_##op(lua_State *L)			\
+{								\
+	A##_t *v = luadata_toatomic(L, A, true);		\
+	A##_##op(luaL_checkinteger(L, 3), v);			\
+	return 0;						\
+}
+
+#define LUADATA_NEWATOMIC_FETCHOP(A, op)			\
+static int luadata_##A##_##op(lua_State *L)			\
+{								\
+	A##_t *v = luadata_toatomic(L, A, true);		\
+	lua_pushinteger(L, (lua_Integer)A##_##op(luaL_checkinteger(L, 3), v));	\
+	return 1;						\
+}
+
+#define LUADATA_NEWATOMIC(A)					\
+LUADATA_NEWATOMIC_OP(A, add);					\
+LUADATA_NEWATOMIC_OP(A, or);					\
+LUADATA_NEWATOMIC_OP(A, and);					\
+LUADATA_NEWATOMIC_FETCHOP(A, fetch_add);			\
+static int luadata_##A##_xchg(lua_State *L)			\
+{								\
+	A##_t *v = luadata_toatomic(L, A, true);		\
+	lua_pushinteger(L, (lua_Integer)A##_xchg(v, luaL_checkinteger(L, 3)));	\
+	return 1;						\
+}								\
+static int luadata_##A##_cmpxchg(lua_State *L)			\
+{								\
+	A##_t *v = luadata_toatomic(L, A, true);		\
+	lua_Integer old = luaL_checkinteger(L, 3);		\
+	lua_pushinteger(L, (lua_Integer)A##_cmpxchg(v, old, luaL_checkinteger(L, 4)));	\
+	return 1;						\
+}								\
+static int luadata_##A##_read_acquire(lua_State *L)		\
+{								\
+	A##_t *v = luadata_toatomic(L, A, false);		\
+	lua_pushinteger(L, (lua_Integer)A##_read_acquire(v));	\
+	return 1;						\
+}								\
+static int luadata_##A##_set_release(lua_State *L)		\
+{								\
+	A##_t *v = luadata_toatomic(L, A, true);		\
+	A##_set_release(v, luaL_checkinteger(L, 3));		\
+	return 0;						\
+}
+
+/***
+* Atomically adds a value to a signed 32-bit integer (host byte order) of the data object.
+* Atomic operations don't lock the data object, so they are cheap for counters and flags shared
+* among runtimes; the offset must be aligned to the integer size. They are supported by data objects
+* created by `data.new`, `data.buffer` and `data.percpu` (and their slices) only, whose memory can't be
+* grown beyond its capacity by `resize` or `append` after the first atomic operation.
+* The `atomic64_` variants (e.g., `atomic64_add`) operate on 64-bit integers.
+* @function atomic_add
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @tparam integer value The value to be added.
+* @raise Error if offset is out of bounds or unaligned, or if the data object is read-only.
+*/
+/***
+* Atomically adds a value to a signed 32-bit integer and returns its previous value.
+* @function atomic_fetch_add
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @tparam integer value The value to be added.
+* @treturn integer The value before the addition.
+* @see atomic_add
+*/
+/***
+* Atomically replaces a signed 32-bit integer and returns its previous value.
+* @function atomic_xchg
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @tparam integer value The new value.
+* @treturn integer The value before the exchange.
+* @see atomic_add
+*/
+/***
+* Atomically replaces a signed 32-bit integer if it is equal to an expected value.
+* @function atomic_cmpxchg
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @tparam integer old The expected value.
+* @tparam integer new The new value.
+* @treturn integer The value before the operation; the exchange succeeded if it is equal to `old`.
+* @see atomic_add
+*/
+/***
+* Atomically ORs a signed 32-bit integer with a mask.
+* @function atomic_or
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @tparam integer mask The mask.
+* @see atomic_add
+*/
+/***
+* Atomically ANDs a signed 32-bit integer with a mask.
+* @function atomic_and
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @tparam integer mask The mask.
+* @see atomic_add
+*/
+/***
+* Reads a signed 32-bit integer with acquire ordering; that is, memory accesses that follow it
+* can't be reordered before it.
+* @function atomic_read_acquire
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @treturn integer The value.
+* @see atomic_set_release
+*/
+/***
+* Writes a signed 32-bit integer with release ordering; that is, memory accesses that precede it
+* can't be reordered after it. Paired with `atomic_read_acquire`, it publishes data written before.
+* @function atomic_set_release
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @tparam integer value The value.
+*/
+LUADATA_NEWATOMIC(atomic);
+LUADATA_NEWATOMIC(atomic64);
+
+static const luaL_Reg luadata_atomic_mt[] = {
+	{"atomic_add", luadata_atomic_add},
+	{"atomic_fetch_add", luadata_atomic_fetch_add},
+	{"atomic_xchg", luadata_atomic_xchg},
+	{"atomic_cmpxchg", luadata_atomic_cmpxchg},
+	{"atomic_or", luadata_atomic_or},
+	{"atomic_and", luadata_atomic_and},
+	{"atomic_read_acquire", luadata_atomic_read_acquire},
+	{"atomic_set_release", luadata_atomic_set_release},
+	{"atomic64_add", luadata_atomic64_add},
+	{"atomic64_fetch_add", luadata_atomic64_fetch_add},
+	{"atomic64_xchg", luadata_atomic64_xchg},
+	{"atomic64_cmpxchg", luadata_atomic64_cmpxchg},
+	{"atomic64_or", luadata_atomic64_or},
+	{"atomic64_and", luadata_atomic64_and},
+	{"atomic64_read_acquire", luadata_atomic64_read_acquire},
+	{"atomic64_set_release", luadata_atomic64_set_release},
+	{NULL, NULL}
+};
+
+/* atomic operations live in their own table, so they are told apart from monitored methods by lookup */
+#define LUADATA_ATOMICS	"data.atomics"
+
+static void luadata_getatomics(lua_State *L)
+{
+	if (luaL_getmetatable(L, LUADATA_ATOMICS) == LUA_TNIL) {
+		lua_pop(L, 1);
+		luaL_newmetatable(L, LUADATA_ATOMICS);
+		luaL_setfuncs(L, luadata_atomic_mt, 0);
+	}
+}
+
+/***
+* Represents a compiled struct layout.
+* This is a userdata object returned by `data.layout()`. It maps field names to their
+* offsets and types, so protocol headers can be accessed by name in a single call.
+* @type layout
+*/
+
+#define LUADATA_LAYOUT_MAXNAME	(32)
+
+typedef struct luadata_field_s {
+	char name[LUADATA_LAYOUT_MAXNAME];
+	size_t offset;
+	int size;
+	luadata_kopt_t kind;
+	bool little;
+} luadata_field_t;
+
+typedef struct luadata_layout_s {
+	size_t size;
+	size_t nfields;
+	luadata_field_t fields[];
+} luadata_layout_t;
+
+static inline luadata_layout_t *luadata_checklayout(lua_State *L, int ix)
+{
+	lunatik_object_t *object = lunatik_checkobject(L, ix);
+	luaL_argcheck(L, object->class == &luadata_layout_class, ix, "layout expected");
+	return (luadata_layout_t *)object->private;
+}
+
+/* layouts and append() access data objects out of their monitor; thus, they lock them as data methods do */
+static int luadata_lockdata(lua_State *L, int ix, lua_CFunction op)
+{
+	lunatik_object_t *object = luadata_toguard(luadata_checkobject(L, ix));
+	bool percpu = luadata_ispercpu(luadata_checkprivate(L, ix));
+	int ret, n = lua_gettop(L);
+
+	lua_pushcfunction(L, op);
+	lua_insert(L, 1); /* stack: op, args */
+
+	if (percpu)
+		preempt_disable();
+	else
+		lunatik_lock(object);
+	ret = lua_pcall(L, n, LUA_MULTRET, 0);
+	if (percpu)
+		preempt_enable();
+	else
+		lunatik_unlock(object);
+
+	if (ret != LUA_OK)
+		lua_error(L);
+	return lua_gettop(L);
+}
+
+static const luadata_field_t *luadata_checkfield(lua_State *L, int ix, luadata_layout_t *layout)
+{
+	const char *name = luaL_checkstring(L, ix);
+	size_t i;
+
+	for (i = 0; i < layout->nfields; i++)
+		if (strcmp(layout->fields[i].name, name) == 0)
+			return &layout->fields[i];
+	luaL_error(L, "unknown field '%s'", name);
+	return NULL;
+}
+
+static void luadata_pushfield(lua_State *L, const luadata_field_t *field, const uint8_t *ptr)
+{
+	if (field->kind == LUADATA_KCHAR)
+		lua_pushlstring(L, (const char *)ptr, field->size);
+	else {
+		luadata_header_t h = {.L = L, .little = field->little, .maxalign = 1};
+		lua_pushinteger(L, luadata_unpackint(&h, ptr, field->size, field->kind == LUADATA_KINT));
+	}
+}
+
+/* packs the value on the top of the stack */
+static void luadata_packfield(lua_State *L, const luadata_field_t *field, uint8_t *ptr)
+{
+	int size = field->size;
+
+	if (field->kind == LUADATA_KCHAR) {
+		size_t len;
+		const char *s = lua_tolstring(L, -1, &len);
+
+		if (s == NULL || len > (size_t)size)
+			luaL_error(L, "invalid string for field '%s'", field->name);
+		memcpy(ptr, s, len);
+		memset(ptr + len, 0, size - len);
+	}
+	else {
+		luadata_header_t h = {.L = L, .little = field->little, .maxalign = 1};
+		int isnum;
+		lua_Integer n = lua_tointegerx(L, -1, &isnum);
+
+		if (!isnum)
+			luaL_error(L, "invalid integer for field '%s'", field->name);
+		else if (size < LUADATA_NUMBER_SZ && field->kind == LUADATA_KINT) {
+			lua_Integer lim = (lua_Integer)1 << ((size * LUADATA_NB) - 1);
+			if (n < -lim || n >= lim)
+				luaL_error(L, "integer overflow for field '%s'", field->name);
+		}
+		else if (size < LUADATA_NUMBER_SZ && (lua_Unsigned)n >= ((lua_Unsigned)1 << (size * LUADATA_NB)))
+			luaL_error(L, "unsigned overflow for field '%s'", field->name);
+		luadata_packint(&h, ptr, (lua_Unsigned)n, size, n < 0);
+	}
+}
+
+static int luadata_layout_doget(lua_State *L)
+{
+	luadata_layout_t *layout = luadata_checklayout(L, 1);
+	luadata_t *data = luadata_check(L, 2);
+	lua_Integer base = luaL_checkinteger(L, 3);
+	const luadata_field_t *field = luadata_checkfield(L, 4, layout);
+	const uint8_t *ptr = luadata_checkread(L, 3, data, base + field->offset, field->size, NULL);
+
+	luadata_pushfield(L, field, ptr);
+	return 1;
+}
+
+/***
+* Reads a single field of the layout from a data object.
+* @function get
+* @tparam data d The data object.
+* @tparam integer base Byte offset of the struct within the data object.
+* @tparam string name The field name.
+* @treturn integer|string The field value.
+* @raise Error if the field is unknown or out of bounds.
+*/
+static int luadata_layout_get(lua_State *L)
+{
+	return luadata_lockdata(L, 2, luadata_layout_doget);
+}
+
+static int luadata_layout_doread(lua_State *L)
+{
+	luadata_layout_t *layout = luadata_checklayout(L, 1);
+	luadata_t *data = luadata_check(L, 2);
+	lua_Integer base = luaL_checkinteger(L, 3);
+	const uint8_t *ptr = luadata_checkread(L, 3, data, base, layout->size, NULL);
+	size_t i;
+
+	if (lua_istable(L, 4))
+		lua_pushvalue(L, 4);
+	else
+		lua_createtable(L, 0, layout->nfields);
+
+	for (i = 0; i < layout->nfields; i++) {
+		const luadata_field_t *field = &layout->fields[i];
+		luadata_pushfield(L, field, ptr + field->offset);
+		lua_setfield(L, -2, field->name);
+	}
+	return 1; /* table */
+}
+
+/***
+* Reads all fields of the layout from a data object at once.
+* @function read
+* @tparam data d The data object.
+* @tparam integer base Byte offset of the struct within the data object.
+* @tparam[opt] table t A table to be filled, which can be reused among calls. If omitted, a new table is created.
+* @treturn table The table mapping field names to their values.
+* @raise Error if the struct is out of bounds.
+*/
+static int luadata_layout_read(lua_State *L)
+{
+	return luadata_lockdata(L, 2, luadata_layout_doread);
+}
+
+static int luadata_layout_dowrite(lua_State *L)
+{
+	luadata_layout_t *layout = luadata_checklayout(L, 1);
+	luadata_t *data = luadata_check(L, 2);
+	lua_Integer base = luaL_checkinteger(L, 3);
+	uint8_t *ptr;
+	size_t i;
+
+	luaL_checktype(L, 4, LUA_TTABLE);
+	ptr = luadata_checkwrite(L, 3, data, base, layout->size, NULL);
+	/* fields absent from the table must be preserved on non-linear socket buffers */
+	if ((data->opt & LUADATA_OPT_SKB) && !luadata_skblinear(data, base, layout->size) &&
+	    skb_copy_bits(LUADATA_TOSKB(data), luadata_skboffset(data, base), ptr, layout->size) != 0)
+		luaL_error(L, "couldn't read skb");
+
+	for (i = 0; i < layout->nfields; i++) {
+		const luadata_field_t *field = &layout->fields[i];
+		if (lua_getfield(L, 4, field->name) != LUA_TNIL)
+			luadata_packfield(L, field, ptr + field->offset);
+		lua_pop(L, 1);
+	}
+	luadata_commit(L, data, base, ptr, layout->size);
+	return 0;
+}
+
+/***
+* Writes the fields of the layout present in a table into a data object at once.
+* Fields absent from the table are left untouched.
+* @function write
+* @tparam data d The data object.
+* @tparam integer base Byte offset of the struct within the data object.
+* @tparam table t The table mapping field names to their values.
+* @raise Error if the struct is out of bounds, a value doesn't fit its field or the data object is read-only.
+*/
+static int luadata_layout_write(lua_State *L)
+{
+	return luadata_lockdata(L, 2, luadata_layout_dowrite);
+}
+
+/***
+* Returns the size of the layout in bytes; that is, the end of its last field.
+* @function __len
+* @treturn integer The size of the struct.
+*/
+static int luadata_layout_length(lua_State *L)
+{
+	luadata_layout_t *layout = luadata_checklayout(L, 1);
+	lua_pushinteger(L, (lua_Integer)layout->size);
+	return 1;
+}
+
+static const luaL_Reg luadata_layout_mt[] = {
+	{"__gc", lunatik_deleteobject},
+	{"__len", luadata_layout_length},
+	{"get", luadata_layout_get},
+	{"read", luadata_layout_read},
+	{"write", luadata_layout_write},
+	{NULL, NULL}
+};
+
+/* layouts are immutable; thus, they aren't monitored */
+static const lunatik_class_t luadata_layout_class = {
+	.name = "data.layout",
+	.methods = luadata_layout_mt,
+	.sleep = false,
+};
+
+/* types are "cN" (N-byte strings) or [u|i|be|le]N (N-bit integers); "u" and "i" are unsigned and
+ * signed integers in host byte order; "be" and "le" are unsigned in big and little endian */
+static void luadata_checktype(lua_State *L, const char *type, luadata_field_t *field)
+{
+	const char *p = type;
+	int size;
+
+	field->kind = LUADATA_KUINT;
+	field->little = LUADATA_NATIVELITTLE;
+	if (*p == 'c') {
+		p++;
+		field->kind = LUADATA_KCHAR;
+		size = luadata_getnum(&p, 0);
+	}
+	else {
+		if (strncmp(p, "be", 2) == 0 || strncmp(p, "le", 2) == 0) {
+			field->little = *p == 'l';
+			p += 2;
+		}
+		else if (*p == 'i' || *p == 'u')
+			field->kind = *p++ == 'i' ? LUADATA_KINT : LUADATA_KUINT;
+		else
+			p = ""; /* invalid */
+
+		size = luadata_getnum(&p, 0);
+		size = (size == 8 || size == 16 || size == 32 || size == 64) ? size / 8 : 0;
+	}
+
+	if (*p != '\0' || size <= 0)
+		luaL_error(L, "invalid type '%s' for field '%s'", type, field->name);
+	field->size = size;
+}
+
+/***
+* Compiles a struct layout from a list of fields.
+* Each field is a table `{name, type [, offset]}`, where `type` is `"u8"`, `"i8"`, `"u16"`, `"i16"`,
+* `"u32"`, `"i32"`, `"u64"` or `"i64"` (host byte order), `"be16"`, `"be32"`, `"be64"`, `"le16"`, `"le32"`
+* or `"le64"` (unsigned, in big or little endian) or `"cN"` (N-byte string). If `offset` is omitted,
+* the field follows the previous one, without padding.
+* @function layout
+* @tparam table fields The list of fields.
+* @treturn layout A new layout object.
+* @raise Error if a field is invalid.
+* @within data
+* @usage
+*   local udp = data.layout{ {"sport", "be16"}, {"dport", "be16"}, {"len", "be16"}, {"check", "be16"} }
+*   if udp:get(skb, thoff, "dport") == 53 then ... end
+*   local hdr = udp:read(skb, thoff, hdr) -- reuses the table
+*/
+static int luadata_llayout(lua_State *L)
+{
+	lunatik_object_t *object;
+	luadata_layout_t *layout;
+	size_t i, nfields, pos = 0;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	nfields = lua_rawlen(L, 1);
+	luaL_argcheck(L, nfields > 0, 1, "empty layout");
+
+	lunatik_checkclass(L, &luadata_layout_class);
+	if (luaL_getmetatable(L, luadata_layout_class.name) == LUA_TNIL)
+		lunatik_newclass(L, &luadata_layout_class);
+	lua_pop(L, 1);
+
+	object = lunatik_newobject(L, &luadata_layout_class, struct_size(layout, fields, nfields));
+	layout = (luadata_layout_t *)object->private;
+	layout->size = 0;
+	layout->nfields = 0;
+
+	for (i = 0; i < nfields; i++) {
+		luadata_field_t *field = &layout->fields[i];
+		size_t len;
+		const char *name;
+
+		luaL_argcheck(L, lua_rawgeti(L, 1, i + 1) == LUA_TTABLE, 1, "field must be a table");
+		lua_rawgeti(L, -1, 1);
+		lua_rawgeti(L, -2, 2);
+		lua_rawgeti(L, -3, 3); /* stack: field, name, type, offset */
+
+		luaL_argcheck(L, lua_type(L, -3) == LUA_TSTRING, 1, "invalid field name");
+		name = lua_tolstring(L, -3, &len);
+		luaL_argcheck(L, len < LUADATA_LAYOUT_MAXNAME, 1, "field name too long");
+		strscpy(field->name, name, LUADATA_LAYOUT_MAXNAME);
+
+		luadata_checktype(L, luaL_checkstring(L, -2), field);
+		if (!lua_isnil(L, -1)) {
+			lua_Integer offset = lua_tointeger(L, -1);
+			luaL_argcheck(L, lua_isinteger(L, -1) && offset >= 0, 1, "invalid field offset");
+			pos = (size_t)offset;
+		}
+		field->offset = pos;
+		pos += field->size;
+		layout->size = max(layout->size, pos);
+		layout->nfields++;
+		lua_pop(L, 4); /* field, name, type, offset */
+	}
+	return 1; /* layout */
+}
+
+/* pattern matching over data objects, based on Lua's lstrlib.c; unlike Lua strings, data isn't
+ * zero-terminated, so the subject is never read at src_end */
+#define LUADATA_ESC		'%'
+#define LUADATA_SPECIALS	"^$*+?.([%-"
+#define LUADATA_MAXCCALLS	(200)
+#define LUADATA_CAP_UNFINISHED	(-1)
+#define LUADATA_CAP_POSITION	(-2)
+
+typedef struct luadata_matchstate_s {
+	const char *src_init;
+	const char *src_end;
+	const char *p_end;
+	lua_State *L;
+	lua_Integer base;	/* offset of src_init within the data object */
+	int matchdepth;
+	unsigned char level;
+	struct {
+		const char *init;
+		ptrdiff_t len;
+	} capture[LUA_MAXCAPTURES];
+} luadata_matchstate_t;
+
+#define luadata_uchar(c)	((unsigned char)(c))
+
+static const char *luadata_domatch(luadata_matchstate_t *ms, const char *s, const char *p);
+
+static int luadata_checkcapture(luadata_matchstate_t *ms, int l)
+{
+	l -= '1';
+	if (unlikely(l < 0 || l >= ms->level || ms->capture[l].len == LUADATA_CAP_UNFINISHED))
+		return luaL_error(ms->L, "invalid capture index %%%d", l + 1);
+	return l;
+}
+
+static int luadata_capturetoclose(luadata_matchstate_t *ms)
+{
+	int level = ms->level;
+
+	for (level--; level >= 0; level--)
+		if (ms->capture[level].len == LUADATA_CAP_UNFINISHED)
+			return level;
+	return luaL_error(ms->L, "invalid pattern capture");
+}
+
+static const char *luadata_classend(luadata_matchstate_t *ms, const char *p)
+{
+	switch (*p++) {
+	case LUADATA_ESC:
+		if (unlikely(p == ms->p_end))
+			luaL_error(ms->L, "malformed pattern (ends with '%%')");
+		return p + 1;
+	case '[':
+		if (*p == '^')
+			p++;
+		do { /* look for a ']' */
+			if (unlikely(p == ms->p_end))
+				luaL_error(ms->L, "malformed pattern (missing ']')");
+			if (*(p++) == LUADATA_ESC && p < ms->p_end)
+				p++; /* skip escapes (e.g., '%]') */
+		} while (*p != ']');
+		return p + 1;
+	default:
+		return p;
+	}
+}
+
+static int luadata_matchclass(int c, int cl)
+{
+	int res;
+
+	switch (tolower(cl)) {
+	case 'a': res = isalpha(c); break;
+	case 'c': res = iscntrl(c); break;
+	case 'd': res = isdigit(c); break;
+	case 'g': res = isgraph(c); break;
+	case 'l': res = islower(c); break;
+	case 'p': res = ispunct(c); break;
+	case 's': res = isspace(c); break;
+	case 'u': res = isupper(c); break;
+	case 'w': res = isalnum(c); break;
+	case 'x': res = isxdigit(c); break;
+	default: return cl == c;
+	}
+	return isupper(cl) ? !res : res;
+}
+
+static int luadata_matchbracket(int c, const char *p, const char *ec)
+{
+	int sig = 1;
+
+	if (*(p + 1) == '^') {
+		sig = 0;
+		p++; /* skip the '^' */
+	}
+	while (++p < ec) {
+		if (*p == LUADATA_ESC) {
+			p++;
+			if (luadata_matchclass(c, luadata_uchar(*p)))
+				return sig;
+		}
+		else if (*(p + 1) == '-' && p + 2 < ec) {
+			p += 2;
+			if (luadata_uchar(*(p - 2)) <= c && c <= luadata_uchar(*p))
+				return sig;
+		}
+		else if (luadata_uchar(*p) == c)
+			return sig;
+	}
+	return !sig;
+}
+
+static int luadata_singlematch(luadata_matchstate_t *ms, const char *s, const char *p, const char *ep)
+{
+	int c;
+
+	if (s >= ms->src_end)
+		return 0;
+
+	c = luadata_uchar(*s);
+	switch (*p) {
+	case '.': return 1; /* matches any char */
+	case LUADATA_ESC: return luadata_matchclass(c, luadata_uchar(*(p + 1)));
+	case '[': return luadata_matchbracket(c, p, ep - 1);
+	default: return luadata_uchar(*p) == c;
+	}
+}
+
+static const char *luadata_matchbalance(luadata_matchstate_t *ms, const char *s, const char *p)
+{
+	int b, e, cont = 1;
+
+	if (unlikely(p >= ms->p_end - 1))
+		luaL_error(ms->L, "malformed pattern (missing arguments to '%%b')");
+	if (s >= ms->src_end || *s != *p)
+		return NULL;
+
+	b = *p;
+	e = *(p + 1);
+	while (++s < ms->src_end) {
+		if (*s == e) {
+			if (--cont == 0)
+				return s + 1;
+		}
+		else if (*s == b)
+			cont++;
+	}
+	return NULL; /* data ends out of balance */
+}
+
+static const char *luadata_maxexpand(luadata_matchstate_t *ms, const char *s, const char *p, const char *ep)
+{
+	ptrdiff_t i = 0;
+
+	while (luadata_singlematch(ms, s + i, p, ep))
+		i++;
+	for (; i >= 0; i--) { /* try with maximum repetitions first */
+		const char *res = luadata_domatch(ms, s + i, ep + 1);
+		if (res != NULL)
+			return res;
+	}
+	return NULL;
+}
+
+static const char *luadata_minexpand(luadata_matchstate_t *ms, const char *s, const char *p, const char *ep)
+{
+	for (;;) {
+		const char *res = luadata_domatch(ms, s, ep + 1);
+		if (res != NULL)
+			return res;
+		else if (luadata_singlematch(ms, s, p, ep))
+			s++;
+		else
+			return NULL;
+	}
+}
+
+static const char *luadata_startcapture(luadata_matchstate_t *ms, const char *s, const char *p, int what)
+{
+	const char *res;
+	int level = ms->level;
+
+	if (level >= LUA_MAXCAPTURES)
+		luaL_error(ms->L, "too many captures");
+	ms->capture[level].init = s;
+	ms->capture[level].len = what;
+	ms->level = level + 1;
+	if ((res = luadata_domatch(ms, s, p)) == NULL)
+		ms->level--; /* undo capture */
+	return res;
+}
+
+static const char *luadata_endcapture(luadata_matchstate_t *ms, const char *s, const char *p)
+{
+	int l = luadata_capturetoclose(ms);
+	const char *res;
+
+	ms->capture[l].len = s - ms->capture[l].init;
+	if ((res = luadata_domatch(ms, s, p)) == NULL)
+		ms->capture[l].len = LUADATA_CAP_UNFINISHED; /* undo capture */
+	return res;
+}
+
+static const char *luadata_matchcapture(luadata_matchstate_t *ms, const char *s, int l)
+{
+	size_t len;
+
+	l = luadata_checkcapture(ms, l);
+	len = ms->capture[l].len;
+	if ((size_t)(ms->src_end - s) >= len && memcmp(ms->capture[l].init, s, len) == 0)
+		return s + len;
+	return NULL;
+}
+
+static const char *luadata_domatch(luadata_matchstate_t *ms, const char *s, const char *p)
+{
+	if (unlikely(ms->matchdepth-- == 0))
+		luaL_error(ms->L, "pattern too complex");
+init:
+	if (p == ms->p_end)
+		goto out;
+
+	switch (*p) {
+	case '(':
+		if (*(p + 1) == ')') /* position capture */
+			s = luadata_startcapture(ms, s, p + 2, LUADATA_CAP_POSITION);
+		else
+			s = luadata_startcapture(ms, s, p + 1, LUADATA_CAP_UNFINISHED);
+		break;
+	case ')':
+		s = luadata_endcapture(ms, s, p + 1);
+		break;
+	case '$':
+		if (p + 1 != ms->p_end) /* is not the last char in pattern? */
+			goto dflt;
+		s = s == ms->src_end ? s : NULL;
+		break;
+	case LUADATA_ESC:
+		switch (*(p + 1)) {
+		case 'b':
+			if ((s = luadata_matchbalance(ms, s, p + 2)) != NULL) {
+				p += 4;
+				goto init;
+			}
+			break;
+		case 'f': {
+			const char *ep;
+			int previous, current;
+
+			p += 2;
+			if (unlikely(*p != '['))
+				luaL_error(ms->L, "missing '[' after '%%f' in pattern");
+			ep = luadata_classend(ms, p);
+			previous = s == ms->src_init ? '\0' : luadata_uchar(*(s - 1));
+			current = s == ms->src_end ? '\0' : luadata_uchar(*s);
+			if (!luadata_matchbracket(previous, p, ep - 1) && luadata_matchbracket(current, p, ep - 1)) {
+				p = ep;
+				goto init;
+			}
+			s = NULL;
+			break;
+		}
+		case '0': case '1': case '2': case '3': case '4':
+		case '5': case '6': case '7': case '8': case '9':
+			if ((s = luadata_matchcapture(ms, s, luadata_uchar(*(p + 1)))) != NULL) {
+				p += 2;
+				goto init;
+			}
+			break;
+		default:
+			goto dflt;
+		}
+		break;
+	default: dflt: {
+		const char *ep = luadata_classend(ms, p);
+
+		if (!luadata_singlematch(ms, s, p, ep)) {
+			if (*ep == '*' || *ep == '?' || *ep == '-') { /* accept empty? */
+				p = ep + 1;
+				goto init;
+			}
+			s = NULL;
+			break;
+		}
+
+		switch (*ep) {
+		case '?': {
+			const char *res = luadata_domatch(ms, s + 1, ep + 1);
+			if (res == NULL) {
+				p = ep + 1;
+				goto init;
+			}
+			s = res;
+			break;
+		}
+		case '+':
+			s = luadata_maxexpand(ms, s + 1, p, ep);
+			break;
+		case '*':
+			s = luadata_maxexpand(ms, s, p, ep);
+			break;
+		case '-':
+			s = luadata_minexpand(ms, s, p, ep);
+			break;
+		default:
+			s++;
+			p = ep;
+			goto init;
+		}
+		break;
+	}
+	}
+out:
+	ms->matchdepth++;
+	return s;
+}
+
+static void luadata_pushcapture(luadata_matchstate_t *ms, int i, const char *s, const char *e)
+{
+	ptrdiff_t len;
+
+	if (i >= ms->level) {
+		if (unlikely(i != 0))
+			luaL_error(ms->L, "invalid capture index %%%d", i + 1);
+		lua_pushlstring(ms->L, s, e - s); /* whole match */
+		return;
+	}
+
+	len = ms->capture[i].len;
+	if (unlikely(len == LUADATA_CAP_UNFINISHED))
+		luaL_error(ms->L, "unfinished capture");
+	else if (len == LUADATA_CAP_POSITION)
+		lua_pushinteger(ms->L, ms->base + (ms->capture[i].init - ms->src_init));
+	else
+		lua_pushlstring(ms->L, ms->capture[i].init, len);
+}
+
+static int luadata_pushcaptures(luadata_matchstate_t *ms, const char *s, const char *e)
+{
+	int i, nlevels = (ms->level == 0 && s != NULL) ? 1 : ms->level;
+
+	luaL_checkstack(ms->L, nlevels, "too many captures");
+	for (i = 0; i < nlevels; i++)
+		luadata_pushcapture(ms, i, s, e);
+	return nlevels;
+}
+
+static bool luadata_nospecials(const char *p, size_t lp)
+{
+	size_t i;
+
+	for (i = 0; i < lp; i++)
+		if (p[i] != '\0' && strchr(LUADATA_SPECIALS, p[i]) != NULL)
+			return false;
+	return true;
+}
+
+/* plain search; memchr() skips to candidates for the first byte */
+static const char *luadata_memfind(const char *s, size_t ls, const char *p, size_t lp)
+{
+	const char *init;
+
+	if (lp == 0)
+		return s;
+	else if (lp > ls)
+		return NULL;
+
+	lp--; /* first byte is checked by memchr() */
+	ls -= lp; /* p cannot be found after that */
+	while (ls > 0 && (init = (const char *)memchr(s, *p, ls)) != NULL) {
+		init++;
+		if (memcmp(init, p + 1, lp) == 0)
+			return init - 1;
+		ls -= init - s;
+		s = init;
+	}
+	return NULL;
+}
+
+static int luadata_findaux(lua_State *L, bool find)
+{
+	luadata_t *data = luadata_check(L, 1);
+	size_t lp;
+	const char *p = luaL_checklstring(L, 2, &lp);
+	lua_Integer offset = luaL_optinteger(L, 3, 0);
+	lua_Integer length = luaL_optinteger(L, 4, data->size - offset);
+	luadata_matchstate_t ms;
+	const char *s, *s1;
+	bool anchor;
+
+	luaL_argcheck(L, offset >= 0 && offset <= data->size, 3, "out of bounds");
+	s = length == 0 ? "" : (const char *)luadata_checkread(L, 3, data, offset, length, NULL);
+
+	if (find && (lua_toboolean(L, 5) || luadata_nospecials(p, lp))) {
+		const char *s2 = luadata_memfind(s, length, p, lp);
+		if (s2 != NULL) {
+			lua_pushinteger(L, offset + (s2 - s));
+			lua_pushinteger(L, offset + (s2 - s) + lp);
+			return 2;
+		}
+		lua_pushnil(L);
+		return 1;
+	}
+
+	if ((anchor = *p == '^')) {
+		p++;
+		lp--;
+	}
+	ms.L = L;
+	ms.src_init = s;
+	ms.src_end = s + length;
+	ms.p_end = p + lp;
+	ms.base = offset;
+	s1 = s;
+	do {
+		const char *res;
+
+		ms.level = 0;
+		ms.matchdepth = LUADATA_MAXCCALLS;
+		if ((res = luadata_domatch(&ms, s1, p)) != NULL) {
+			if (find) {
+				lua_pushinteger(L, offset + (s1 - s));
+				lua_pushinteger(L, offset + (res - s));
+				return luadata_pushcaptures(&ms, NULL, NULL) + 2;
+			}
+			return luadata_pushcaptures(&ms, s1, res);
+		}
+	} while (s1++ < ms.src_end && !anchor);
+
+	lua_pushnil(L);
+	return 1;
+}
+
 /***
-* Inserts a signed 64-bit integer into the data object.
-* Assumes host byte order.
-* @function setint64
-* @tparam integer offset Byte offset from the start of the data block (0-indexed).
-* @tparam integer value The signed 64-bit integer value to write.
-* @raise Error if offset is out of bounds or the data object is read-only.
+* Looks for the first match of a pattern in the data object, without copying it into a Lua string.
+* It works as `string.find` does, but offsets are 0-indexed and the end offset is exclusive.
+* Plain searches (or patterns without special characters) use `memchr` and `memcmp`.
+* @function find
+* @tparam string pattern A Lua pattern or, if `plain` is true, a literal.
+* @tparam[opt=0] integer offset Byte offset where the search starts, which is also the subject start for '^' anchors.
+* @tparam[opt] integer length Number of bytes to search. If omitted, it goes up to the end of the data block.
+* @tparam[opt=false] boolean plain Whether the pattern is a literal.
+* @treturn integer The offset where the match starts, or `nil` if there is no match.
+* @treturn integer The offset where the match ends (exclusive).
+* @treturn ... The captures of the pattern, if any. Position captures are offsets in the data object.
+* @raise Error if offset/length is out of bounds or the pattern is malformed.
+* @usage
+*   local s, e = skb:find("\0", qoff, nil, true) -- end of a DNS name
 */
-LUADATA_NEWINT(int64);
-#endif
+static int luadata_find(lua_State *L)
+{
+	return luadata_findaux(L, true);
+}
 
 /***
-* Extracts a string from the data object.
-* @function getstring
-* @tparam integer offset Byte offset from the start of the data block (0-indexed).
-* @tparam[opt] integer length Number of bytes to read. If omitted, reads all bytes from `offset` to the end of the data block.
-* @treturn string The string containing the bytes read from the data object.
-* @raise Error if offset/length is out of bounds.
+* Looks for the first match of a pattern in the data object, as `string.match` does.
+* Only the captures (or the whole match) are copied into Lua strings.
+* @function match
+* @tparam string pattern A Lua pattern.
+* @tparam[opt=0] integer offset Byte offset where the search starts.
+* @tparam[opt] integer length Number of bytes to search. If omitted, it goes up to the end of the data block.
+* @treturn ... The captures of the pattern, the whole match if it has none, or `nil` if there is no match.
+* @raise Error if offset/length is out of bounds or the pattern is malformed.
+* @usage
+*   local host = payload:match("Host: ([^\r]*)")
 */
-static int luadata_getstring(lua_State *L)
+static int luadata_match(lua_State *L)
 {
-	luadata_t *data = luadata_check(L, 1);
-	lua_Integer offset = luaL_checkinteger(L, 2);
-	lua_Integer length = luaL_optinteger(L, 3, data->size - offset);
-	char *str = (char *)luadata_checkbounds(L, 2, data, offset, length);
+	return luadata_findaux(L, false);
+}
 
-	lua_pushlstring(L, str, length);
-	return 1;
+static inline void luadata_checkmovable(lua_State *L, luadata_t *data)
+{
+	if (data->pinned)
+		luaL_error(L, "cannot move memory used by atomic operations");
+	else if (data->borrowers > 0)
+		luaL_error(L, "cannot move memory borrowed by other modules");
+}
+
+static void luadata_grow(lua_State *L, luadata_t *data, size_t n)
+{
+	size_t size = data->size + n;
+
+	if (size > data->capacity) {
+		size_t capacity = max(size, data->capacity * 2);
+
+		luadata_checkmovable(L, data);
+		data->ptr = lunatik_checknull(L, lunatik_realloc(L, data->ptr, capacity));
+		data->capacity = capacity;
+		data->generation++; /* memory might have been moved */
+	}
 }
 
+#define LUADATA_MAXNUMBER	(32)
+
 /***
-* Inserts a string into the data object.
-* @function setstring
-* @tparam integer offset Byte offset from the start of the data block (0-indexed) where writing will begin.
-* @tparam string s The string to write into the data object.
-* @raise Error if the write operation (offset + length of string) goes out of bounds, or if the data object is read-only.
+* Appends values to the end of the data object, growing its memory geometrically.
+* Integers are formatted in decimal; strings and data objects are appended as they are
+* (use `slice` to append a range of a data object). Only data objects created by `data.new`
+* or `data.buffer` can grow.
+* @function append
+* @param ... Integers, strings or data objects.
+* @treturn data The data object itself, for chaining.
+* @raise Error if the data object can't grow or an argument has an invalid type.
+* @usage
+*   local log = data.buffer()
+*   log:append(symbol, ": ", counter, "\n")
 */
-static int luadata_setstring(lua_State *L)
+static int luadata_doappend(lua_State *L)
 {
-	size_t length;
 	luadata_t *data = luadata_check(L, 1);
-	lua_Integer offset = luaL_checkinteger(L, 2);
-	const char *str = luaL_checklstring(L, 3, &length);
-	void *ptr = luadata_checkbounds(L, 2, data, offset, length);
-	
+	int i, n = lua_gettop(L);
+
 	luadata_checkwritable(L, data);
-	memcpy(ptr, str, length);
-	return 0;
+	luaL_argcheck(L, (data->opt & LUADATA_OPT_FREE) && !luadata_ispercpu(data) && !luadata_isslice(data),
+		1, "cannot grow external memory");
+
+	for (i = 2; i <= n; i++) {
+		char number[LUADATA_MAXNUMBER];
+		const char *s;
+		size_t len;
+
+		if (lua_isinteger(L, i)) {
+			len = scnprintf(number, LUADATA_MAXNUMBER, LUA_INTEGER_FMT, (LUAI_UACINT)lua_tointeger(L, i));
+			s = number;
+		}
+		else if (lua_isuserdata(L, i)) { /* copy of a data object (see luadata_append()) */
+			s = (const char *)lua_touserdata(L, i);
+			len = lua_rawlen(L, i);
+		}
+		else
+			s = luaL_checklstring(L, i, &len);
+
+		luadata_grow(L, data, len);
+		memcpy(data->ptr + data->size, s, len);
+		data->size += len;
+	}
+	lua_settop(L, 1);
+	return 1; /* data */
+}
+
+/* data arguments (including the object itself) are copied under their own lock before it is locked; thus,
+ * it isn't monitored (see luadata_index()) */
+static int luadata_append(lua_State *L)
+{
+	int i, n = lua_gettop(L);
+
+	luadata_checkobject(L, 1);
+	for (i = 2; i <= n; i++) {
+		size_t len;
+
+		if (!lua_isinteger(L, i) && lua_isuserdata(L, i))
+			luadata_checklstring(L, i, &len);
+	}
+	return luadata_lockdata(L, 1, luadata_doappend);
 }
 
 /***
 * Resizes an SKB (socket buffer) to the specified size.
 * Expands the buffer using skb_put() if new_size > current size,
-* or shrinks it using skb_trim() if new_size < current size.
+* or shrinks it using pskb_trim() if new_size < current size.
 * @param L Lua state for error reporting
 * @param data luadata object wrapping the SKB
 * @param new_size The desired size in bytes
@@ -266,8 +2347,8 @@ static void luadata_skb_resize(lua_State *L, luadata_t *data, size_t new_size)
 			luaL_error(L, "insufficient tailroom for resize");
 		skb_put(skb, needed);
 	}
-	else if (new_size < data->size)
-		skb_trim(skb, new_size);
+	else if (new_size < data->size && pskb_trim(skb, luadata_skboffset(data, new_size)) != 0)
+		luaL_error(L, "couldn't trim skb");
 }
 
 /***
@@ -284,18 +2365,67 @@ static int luadata_resize(lua_State *L)
     size_t new_size = (size_t)luaL_checkinteger(L, 2);
     
     luadata_checkwritable(L, data);
+    luaL_argcheck(L, !luadata_isslice(data), 1, "cannot resize a slice");
+    luaL_argcheck(L, !luadata_ispercpu(data), 1, "cannot resize per-CPU data");
 
     if (data->opt & LUADATA_OPT_SKB)
 		luadata_skb_resize(L, data, new_size); 
-	else if (data->opt & LUADATA_OPT_FREE)
-		data->ptr = lunatik_checknull(L, lunatik_realloc(L, data->ptr, new_size)); 
+	else if (data->opt & LUADATA_OPT_FREE) {
+		if (new_size > data->capacity) {
+			luadata_checkmovable(L, data);
+			data->ptr = lunatik_checknull(L, lunatik_realloc(L, data->ptr, new_size));
+			data->capacity = new_size;
+		}
+	}
 	else
 		luaL_error(L, "cannot resize external memory");
 
     data->size = new_size;
+    data->generation++; /* memory might have been moved */
     return 0;
 }
 
+/***
+* Creates a view over a region of the data object, without copying it.
+* The slice shares the memory of the data object, keeps it alive and inherits its
+* read-only flag. Slices of slices refer to the original memory. A slice is
+* invalidated, raising an error when used, whenever the original object is resized
+* or reset (e.g., a packet buffer after its hook returns). Methods of a slice lock
+* the original object.
+* @function slice
+* @tparam integer offset Byte offset from the start of the data block (0-indexed).
+* @tparam[opt] integer length Number of bytes of the slice. If omitted, it goes up to the end of the data block.
+* @treturn data A new data object representing the region.
+* @raise Error if offset/length is out of bounds.
+* @usage
+*   local payload = skb:slice(thoff + 8) -- UDP payload
+*/
+static int luadata_slice(lua_State *L)
+{
+	luadata_t *data = luadata_check(L, 1);
+	lua_Integer offset = luaL_checkinteger(L, 2);
+	lua_Integer length = luaL_optinteger(L, 3, data->size - offset);
+	lunatik_object_t *parent = luadata_isslice(data) ? data->parent : lunatik_toobject(L, 1);
+	lunatik_object_t *object;
+	luadata_t *slice;
+
+	luaL_argcheck(L, offset >= 0 && length >= 0 && offset + length <= data->size, 2, "out of bounds");
+
+	object = lunatik_newobject(L, &luadata_class, sizeof(luadata_t));
+	slice = (luadata_t *)object->private;
+	slice->ptr = data->ptr;
+	slice->size = (size_t)length;
+	slice->capacity = 0;
+	slice->opt = data->opt & (LUADATA_OPT_READONLY | LUADATA_OPT_SKB | LUADATA_OPT_PERCPU);
+	slice->offset = data->offset + (size_t)offset;
+	slice->generation = data->generation;
+	slice->pinned = false;
+	slice->borrowers = 0;
+	lunatik_getobject(parent);
+	slice->parent = parent;
+	return 1; /* slice */
+}
+
 /***
 * Returns the length of the data object in bytes.
 * This is the Lua `__len` metamethod, allowing use of the `#` operator.
@@ -318,15 +2448,89 @@ static int luadata_length(lua_State *L)
 static int luadata_tostring(lua_State *L)
 {
 	luadata_t *data = luadata_check(L, 1);
-	lua_pushlstring(L, (char *)LUADATA_TOPTR(data), data->size);
+
+	if (data->size == 0)
+		lua_pushliteral(L, "");
+	else
+		lua_pushlstring(L, (char *)luadata_checkread(L, 1, data, 0, data->size, NULL), data->size);
 	return 1;
 }
 
 static void luadata_release(void *private)
 {
 	luadata_t *data = (luadata_t *)private;
-	if (data->opt & LUADATA_OPT_FREE)
+	if ((data->opt & LUADATA_OPT_FREE) && luadata_ispercpu(data))
+		free_percpu((void __percpu *)data->ptr);
+	else if (data->opt & LUADATA_OPT_FREE)
 		lunatik_free(data->ptr);
+	if (luadata_isslice(data))
+		lunatik_putobject(data->parent);
+}
+
+/* as lunatik_monitor(), but slices lock their parent (see luadata_toguard()) */
+static int luadata_monitor(lua_State *L)
+{
+	lunatik_object_t *guard = luadata_toguard(lunatik_checkobject(L, 1));
+	int ret, n = lua_gettop(L);
+
+	lua_pushvalue(L, lua_upvalueindex(1)); /* method */
+	lua_insert(L, 1); /* stack: method, object, args */
+
+	lunatik_lock(guard);
+	ret = lua_pcall(L, n, LUA_MULTRET, 0);
+	lunatik_unlock(guard);
+
+	if (ret != LUA_OK)
+		lua_error(L);
+	return lua_gettop(L);
+}
+
+static int luadata_percpu(lua_State *L)
+{
+	int ret, n = lua_gettop(L);
+
+	lua_pushvalue(L, lua_upvalueindex(1)); /* method */
+	lua_insert(L, 1); /* stack: method, object, args */
+
+	preempt_disable();
+	ret = lua_pcall(L, n, LUA_MULTRET, 0);
+	preempt_enable();
+
+	if (ret != LUA_OK)
+		lua_error(L);
+	return lua_gettop(L);
+}
+
+#define luadata_isaggregator(m)	((m) == luadata_sum32 || (m) == luadata_sum64 || (m) == luadata_snapshot)
+#define luadata_islocking(m)	((m) == luadata_append)
+
+/* per-CPU data isn't locked; instead, its methods run with preemption disabled, so they access
+ * the copy of a single CPU; aggregators read the copies of all CPUs and might sleep. Atomic
+ * operations aren't locked either (see luadata_pin()) and append() locks the object on its own.
+ * Other methods are monitored (see luadata_monitor()). */
+static int luadata_index(lua_State *L)
+{
+	bool percpu = luadata_ispercpu(luadata_checkprivate(L, 1));
+	int type;
+
+	lua_settop(L, 2);
+	lua_getmetatable(L, 1);
+	lua_pushvalue(L, 2);
+	if ((type = lua_rawget(L, 3)) == LUA_TFUNCTION) { /* stack: object, key, metatable, method */
+		lua_CFunction method = lua_tocfunction(L, -1);
+
+		if (method != lunatik_deleteobject && !luadata_isaggregator(method) && !luadata_islocking(method))
+			lua_pushcclosure(L, percpu ? luadata_percpu : luadata_monitor, 1);
+		return 1;
+	}
+	else if (type != LUA_TNIL)
+		return 1;
+
+	luadata_getatomics(L);
+	lua_pushvalue(L, 2);
+	if (lua_rawget(L, -2) == LUA_TFUNCTION && percpu)
+		lua_pushcclosure(L, luadata_percpu, 1);
+	return 1;
 }
 
 /***
@@ -337,13 +2541,49 @@ static void luadata_release(void *private)
 * @raise Error if memory allocation fails.
 * @within data
 */
+/***
+* Creates a new per-CPU data object, allocating a zeroed copy of the memory block for each CPU.
+* Its methods access the copy of the current CPU without locking the object; thus, it is meant for
+* counters updated at high rates (e.g., by hooks), which are aggregated by `sum32`, `sum64` or `snapshot`.
+* A read-modify-write sequence (e.g., `getuint32` followed by `setuint32`) might still be interleaved
+* with an interrupt on the same CPU.
+* @function percpu
+* @tparam integer size The number of bytes of each copy.
+* @treturn data A new, writable per-CPU data object.
+* @raise Error if memory allocation fails.
+* @within data
+* @usage
+*   local counters = data.percpu(8)
+*   counters:setuint64(0, counters:getuint64(0) + 1) -- on the packet path
+*   print(counters:sum64(0))
+*/
+/***
+* Creates a new, empty data object meant to be filled by `append`.
+* As a buffer grows geometrically, it is cheaper than string concatenation; moreover, it can be
+* passed to functions that take strings, such as `socket:send`, `fifo:push`, `device` read callbacks
+* and crypto operations, without being converted into a Lua string. Its memory is lent to them and
+* can't be moved (e.g., grown by `append` beyond its capacity) meanwhile; ciphers, which transform
+* their output in place, read it once, straight into that output. Other data objects, such as
+* packets, are copied instead.
+* @function buffer
+* @tparam[opt=256] integer capacity The initial capacity, in bytes.
+* @treturn data A new, writable data object of length 0.
+* @raise Error if memory allocation fails.
+* @within data
+*/
+static int luadata_lbuffer(lua_State *L);
+static int luadata_lpercpu(lua_State *L);
+
 static const luaL_Reg luadata_lib[] = {
 	{"new", luadata_lnew},
+	{"percpu", luadata_lpercpu},
+	{"layout", luadata_llayout},
+	{"buffer", luadata_lbuffer},
 	{NULL, NULL}
 };
 
 static const luaL_Reg luadata_mt[] = {
-	{"__index", lunatik_monitorobject},
+	{"__index", luadata_index},
 	{"__gc", lunatik_deleteobject},
 	{"__len", luadata_length},
 	{"__tostring", luadata_tostring},
@@ -406,7 +2646,26 @@ static const luaL_Reg luadata_mt[] = {
 #endif
 	{"getstring", luadata_getstring},
 	{"setstring", luadata_setstring},
+	{"unpack", luadata_unpack},
+	{"pack", luadata_pack},
+	{"checksum", luadata_checksum},
+	{"csumreplace2", luadata_csumreplace2},
+	{"csumreplace4", luadata_csumreplace4},
+	{"csumprotoreplace4", luadata_csumprotoreplace4},
+	{"l4checksum", luadata_l4checksum},
+	{"hash", luadata_hash},
+	{"hashranges", luadata_hashranges},
+	{"copy", luadata_copy},
+	{"fill", luadata_fill},
+	{"compare", luadata_compare},
+	{"append", luadata_append},
+	{"find", luadata_find},
+	{"match", luadata_match},
+	{"sum32", luadata_sum32},
+	{"sum64", luadata_sum64},
+	{"snapshot", luadata_snapshot},
 	{"resize", luadata_resize},
+	{"slice", luadata_slice},
 	{NULL, NULL}
 };
 
@@ -423,14 +2682,387 @@ static int luadata_lnew(lua_State *L)
 	lunatik_object_t *object = lunatik_newobject(L, &luadata_class, sizeof(luadata_t));
 	luadata_t *data = (luadata_t *)object->private;
 
+	data->offset = 0;
+	data->parent = NULL;
+	data->generation = 0;
+	data->pinned = false;
+	data->borrowers = 0;
+	data->opt = LUADATA_OPT_NONE; /* lunatik_checkalloc() might fail */
 	data->ptr = lunatik_checkalloc(L, size);
 	data->size = size;
+	data->capacity = size;
+	data->opt = LUADATA_OPT_FREE;
+	return 1; /* object */
+}
+
+static int luadata_lbuffer(lua_State *L)
+{
+	size_t capacity = (size_t)luaL_optinteger(L, 1, LUAL_BUFFERSIZE);
+	lunatik_object_t *object;
+	luadata_t *data;
+
+	luaL_argcheck(L, capacity > 0, 1, "invalid capacity");
+	object = lunatik_newobject(L, &luadata_class, sizeof(luadata_t));
+	data = (luadata_t *)object->private;
+
+	data->offset = 0;
+	data->parent = NULL;
+	data->generation = 0;
+	data->pinned = false;
+	data->borrowers = 0;
+	data->opt = LUADATA_OPT_NONE; /* lunatik_checkalloc() might fail */
+	data->ptr = lunatik_checkalloc(L, capacity);
+	data->size = 0;
+	data->capacity = capacity;
 	data->opt = LUADATA_OPT_FREE;
 	return 1; /* object */
 }
 
+static int luadata_lpercpu(lua_State *L)
+{
+	size_t size = (size_t)luaL_checkinteger(L, 1);
+	gfp_t gfp = lunatik_gfp(lunatik_toruntime(L));
+	lunatik_object_t *object;
+	luadata_t *data;
+
+	luaL_argcheck(L, size > 0 && size <= PCPU_MIN_UNIT_SIZE, 1, "invalid size");
+	object = lunatik_newobject(L, &luadata_class, sizeof(luadata_t));
+	data = (luadata_t *)object->private;
+
+	data->offset = 0;
+	data->parent = NULL;
+	data->generation = 0;
+	data->pinned = false;
+	data->borrowers = 0;
+	data->opt = LUADATA_OPT_NONE; /* __alloc_percpu_gfp() might fail */
+	data->ptr = lunatik_checknull(L, (void __force *)__alloc_percpu_gfp(size, __alignof__(u64), gfp));
+	data->size = size;
+	data->capacity = size;
+	data->opt = LUADATA_OPT_FREE | LUADATA_OPT_PERCPU;
+	return 1; /* object */
+}
+
 LUNATIK_NEWLIB(data, luadata_lib, &luadata_class, NULL);
 
+/* per-CPU data isn't locked (see luadata_index()) */
+static inline void luadata_lockmemory(lunatik_object_t *object)
+{
+	if (luadata_ispercpu((luadata_t *)object->private))
+		preempt_disable();
+	else
+		lunatik_lock(luadata_toguard(object));
+}
+
+static inline void luadata_unlockmemory(lunatik_object_t *object)
+{
+	if (luadata_ispercpu((luadata_t *)object->private))
+		preempt_enable();
+	else
+		lunatik_unlock(luadata_toguard(object));
+}
+
+/* must be called with the memory locked; a negative length stands for the rest of the data */
+static inline int luadata_fitrange(luadata_t *data, lua_Integer offset, lua_Integer *length)
+{
+	size_t rest;
+
+	if (luadata_isstale(data))
+		return -ESTALE;
+	else if (offset < 0 || (size_t)offset > data->size)
+		return -ERANGE;
+
+	rest = data->size - (size_t)offset;
+	if (*length > 0 && (size_t)*length > rest)
+		return -ERANGE;
+	else if (*length < 0)
+		*length = (lua_Integer)rest;
+	return 0;
+}
+
+/* must be called with the memory locked; it returns -EAGAIN if the buffer isn't sized to the range */
+static int luadata_copyrange(luadata_t *data, lua_Integer offset, lua_Integer length, void *buffer, size_t *n)
+{
+	int ret;
+
+	if ((ret = luadata_fitrange(data, offset, &length)) != 0)
+		return ret;
+	else if ((size_t)length != *n) {
+		*n = (size_t)length;
+		return -EAGAIN;
+	}
+	else if (*n == 0)
+		return 0;
+	else if (data->opt & LUADATA_OPT_SKB)
+		return skb_copy_bits(LUADATA_TOSKB(data), luadata_skboffset(data, offset), buffer, (int)*n);
+
+	memcpy(buffer, LUADATA_TOPTR(data) + offset, *n);
+	return 0;
+}
+
+/* must be called with the memory locked; only fragments of non-linear packets are copied into buffer */
+static int luadata_scanrange(luadata_t *data, lua_Integer offset, lua_Integer length, void *buffer, size_t size,
+	luadata_scan_t scan, void *ctx, size_t *n)
+{
+	const void *chunk;
+	size_t rest, len, done;
+	int ret;
+
+	*n = 0;
+	if ((ret = luadata_fitrange(data, offset, &length)) != 0)
+		return ret;
+
+	rest = (size_t)length;
+	if (!(data->opt & LUADATA_OPT_SKB) || luadata_skblinear(data, offset, rest)) {
+		*n = scan(ctx, (const char *)LUADATA_TOPTR(data) + offset, rest, 0);
+		return 0;
+	}
+
+	do {
+		len = min(rest, size);
+		rest -= len;
+		chunk = skb_header_pointer(LUADATA_TOSKB(data), luadata_skboffset(data, offset + *n), len, buffer);
+		if (chunk == NULL)
+			return -EFAULT;
+		done = scan(ctx, (const char *)chunk, len, rest);
+		*n += done;
+	} while (done == len && len > 0 && rest > 0);
+	return 0;
+}
+
+static inline void luadata_checkcopied(lua_State *L, int ix, int ret)
+{
+	luaL_argcheck(L, ret != -ESTALE, ix, "invalidated slice");
+	luaL_argcheck(L, ret != -ERANGE, ix, "out of bounds");
+	if (ret != 0)
+		luaL_error(L, "couldn't read skb");
+}
+
+/*
+* Data objects handed to other modules (e.g., sent by a socket) are copied under their lock, so their
+* memory isn't accessed while another runtime resizes or resets them. The copy replaces the object on
+* the stack, which anchors it. It is allocated before locking; thus, it is taken again if the object has
+* been resized meanwhile. A negative length stands for the rest of the object.
+*/
+static const char *luadata_copyout(lua_State *L, int ix, lunatik_object_t *object, lua_Integer offset, lua_Integer length, size_t *len)
+{
+	luadata_t *data = (luadata_t *)object->private;
+	size_t n = length >= 0 ? (size_t)length : 0;
+	void *buffer;
+	int ret;
+
+	ix = lua_absindex(L, ix);
+	for (;;) {
+		buffer = lua_newuserdatauv(L, n, 0);
+		luadata_lockmemory(object);
+		ret = luadata_copyrange(data, offset, length, buffer, &n);
+		luadata_unlockmemory(object);
+		if (ret != -EAGAIN)
+			break;
+		lua_pop(L, 1);
+	}
+
+	luadata_checkcopied(L, ix, ret);
+	lua_replace(L, ix);
+	*len = n;
+	return (const char *)buffer;
+}
+
+static inline lunatik_object_t *luadata_checkcontents(lua_State *L, int ix)
+{
+	lunatik_object_t *object = lunatik_testobject(L, ix);
+
+	if (object == NULL || object->class != &luadata_class || object->private == NULL)
+		luaL_typeerror(L, ix, "string or data");
+	return object;
+}
+
+/* returns length bytes at offset (or the rest, if length is negative) of a string or a copy of this
+ * region of a data object, which replaces it on the stack (see luadata_copyout()) */
+const char *luadata_checkregion(lua_State *L, int ix, lua_Integer offset, lua_Integer length, size_t *len)
+{
+	const char *s;
+
+	if (lua_isuserdata(L, ix))
+		return luadata_copyout(L, ix, luadata_checkcontents(L, ix), offset, length, len);
+	else if ((s = lua_tolstring(L, ix, len)) == NULL)
+		luaL_typeerror(L, ix, "string or data");
+
+	luaL_argcheck(L, offset >= 0 && (size_t)offset <= *len && (length < 0 || (size_t)length <= *len - offset),
+		ix, "out of bounds");
+	*len = length < 0 ? *len - (size_t)offset : (size_t)length;
+	return s + offset;
+}
+EXPORT_SYMBOL(luadata_checkregion);
+
+const char *luadata_checklstring(lua_State *L, int ix, size_t *len)
+{
+	return luadata_checkregion(L, ix, 0, -1, len);
+}
+EXPORT_SYMBOL(luadata_checklstring);
+
+/* returns the length of a string or data object */
+size_t luadata_checklength(lua_State *L, int ix)
+{
+	lunatik_object_t *object;
+	luadata_t *data;
+	size_t len;
+	bool stale;
+
+	if (!lua_isuserdata(L, ix)) {
+		luaL_checklstring(L, ix, &len);
+		return len;
+	}
+
+	object = luadata_checkcontents(L, ix);
+	data = (luadata_t *)object->private;
+	luadata_lockmemory(object);
+	stale = luadata_isstale(data);
+	len = data->size;
+	luadata_unlockmemory(object);
+
+	luaL_argcheck(L, !stale, ix, "invalidated slice");
+	return len;
+}
+EXPORT_SYMBOL(luadata_checklength);
+
+/*
+* Consumers that might sleep (e.g., sockets) can't hold the lock of a data object; thus, they borrow its
+* memory, which can't be moved (see luadata_checkmovable()) until it is given back by luadata_unborrow().
+* Its contents might still be written meanwhile. Lua errors must not be raised in between. Only memory
+* owned by data objects can be borrowed; other memory (e.g., packets, which are reset once their hook
+* returns) and per-CPU data are copied instead (see luadata_copyout()).
+*/
+const char *luadata_borrow(lua_State *L, int ix, size_t *len)
+{
+	lunatik_object_t *object, *guard;
+	luadata_t *data, *owner;
+	const char *ptr = NULL;
+	bool stale;
+
+	if (!lua_isuserdata(L, ix))
+		return luadata_checklstring(L, ix, len);
+
+	object = luadata_checkcontents(L, ix);
+	guard = luadata_toguard(object);
+	data = (luadata_t *)object->private;
+	owner = (luadata_t *)guard->private;
+	if (luadata_ispercpu(data) || !(owner->opt & LUADATA_OPT_FREE))
+		return luadata_copyout(L, ix, object, 0, -1, len);
+
+	lunatik_lock(guard);
+	if (!(stale = luadata_isstale(data))) {
+		owner->borrowers++;
+		ptr = (const char *)LUADATA_TOPTR(data);
+		*len = data->size;
+	}
+	lunatik_unlock(guard);
+
+	luaL_argcheck(L, !stale, ix, "invalidated slice");
+	return ptr;
+}
+EXPORT_SYMBOL(luadata_borrow);
+
+/* strings and copies, which have replaced the data object on the stack, aren't borrowed */
+void luadata_unborrow(lua_State *L, int ix)
+{
+	lunatik_object_t *object = lunatik_testobject(L, ix);
+	lunatik_object_t *guard;
+
+	if (object == NULL || object->class != &luadata_class)
+		return;
+
+	guard = luadata_toguard(object);
+	lunatik_lock(guard);
+	((luadata_t *)guard->private)->borrowers--;
+	lunatik_unlock(guard);
+}
+EXPORT_SYMBOL(luadata_unborrow);
+
+/* copies length bytes at offset of a string or data object into buffer; only this region of
+ * non-linear packets is read */
+void luadata_checkcopy(lua_State *L, int ix, lua_Integer offset, void *buffer, size_t length)
+{
+	lunatik_object_t *object;
+	size_t n = length;
+	int ret;
+
+	if (!lua_isuserdata(L, ix)) {
+		const char *s = luaL_checklstring(L, ix, &n);
+
+		luaL_argcheck(L, offset >= 0 && (size_t)offset <= n && length <= n - offset, ix, "out of bounds");
+		memcpy(buffer, s + offset, length);
+		return;
+	}
+
+	object = luadata_checkcontents(L, ix);
+	luadata_lockmemory(object);
+	ret = luadata_copyrange((luadata_t *)object->private, offset, (lua_Integer)length, buffer, &n);
+	luadata_unlockmemory(object);
+	luadata_checkcopied(L, ix, ret);
+}
+EXPORT_SYMBOL(luadata_checkcopy);
+
+/*
+* Scans length bytes at offset (or the rest, if length is negative) of a string or data object in place,
+* under the lock of the object; thus, scan must neither sleep nor raise errors. Regions that lie in fragments
+* of non-linear packets are copied into buffer, in chunks of up to size bytes, instead. Scanning stops once
+* scan consumes less than the chunk it is handed, along with the length of the region that follows it.
+* The region is scanned at least once, even if empty. Returns the number of bytes consumed.
+*/
+size_t luadata_checkscan(lua_State *L, int ix, lua_Integer offset, lua_Integer length, void *buffer, size_t size,
+	luadata_scan_t scan, void *ctx)
+{
+	lunatik_object_t *object;
+	size_t n;
+	int ret;
+
+	if (!lua_isuserdata(L, ix)) {
+		const char *s = luadata_checkregion(L, ix, offset, length, &n);
+		return scan(ctx, s, n, 0);
+	}
+
+	object = luadata_checkcontents(L, ix);
+	luadata_lockmemory(object);
+	ret = luadata_scanrange((luadata_t *)object->private, offset, length, buffer, size, scan, ctx, &n);
+	luadata_unlockmemory(object);
+	luadata_checkcopied(L, ix, ret);
+	return n;
+}
+EXPORT_SYMBOL(luadata_checkscan);
+
+static int luadata_pchecklstring(lua_State *L)
+{
+	size_t len;
+
+	luadata_checklstring(L, 1, &len);
+	lua_pushinteger(L, (lua_Integer)len);
+	return 2; /* copy, length */
+}
+
+/* as luadata_checklstring(), but it returns NULL on errors instead of raising them */
+const char *luadata_tolstring(lua_State *L, int ix, size_t *len)
+{
+	if (!lua_isuserdata(L, ix))
+		return lua_tolstring(L, ix, len);
+
+	ix = lua_absindex(L, ix);
+	if (!lua_checkstack(L, 3))
+		return NULL;
+
+	lua_pushcfunction(L, luadata_pchecklstring);
+	lua_pushvalue(L, ix);
+	if (lua_pcall(L, 1, 2, 0) != LUA_OK) {
+		lua_pop(L, 1); /* error */
+		return NULL;
+	}
+
+	*len = (size_t)lua_tointeger(L, -1);
+	lua_pop(L, 1);
+	lua_replace(L, ix);
+	return (const char *)lua_touserdata(L, ix);
+}
+EXPORT_SYMBOL(luadata_tolstring);
+
 static inline lunatik_object_t *luadata_create(void *ptr, size_t size, bool sleep, uint8_t opt)
 {
 	lunatik_object_t *object = lunatik_createobject(&luadata_class, sizeof(luadata_t), sleep);
@@ -439,7 +3071,13 @@ static inline lunatik_object_t *luadata_create(void *ptr, size_t size, bool slee
 		luadata_t *data = (luadata_t *)object->private;
 		data->ptr = ptr;
 		data->size = size;
+		data->capacity = 0;
 		data->opt = opt;
+		data->offset = 0;
+		data->parent = NULL;
+		data->generation = 0;
+		data->pinned = false;
+		data->borrowers = 0;
 	}
 	return object;
 }
@@ -452,7 +3090,7 @@ lunatik_object_t *luadata_new(lua_State *L)
 }
 EXPORT_SYMBOL(luadata_new);
 
-int luadata_reset(lunatik_object_t *object, void *ptr, size_t size, uint8_t opt)
+static int luadata_doreset(lunatik_object_t *object, void *ptr, size_t size, ssize_t offset, uint8_t opt)
 {
 	luadata_t *data;
 
@@ -466,13 +3104,27 @@ int luadata_reset(lunatik_object_t *object, void *ptr, size_t size, uint8_t opt)
 
 	data->ptr = ptr;
 	data->size = size;
+	data->offset = offset;
 	data->opt = opt & LUADATA_OPT_KEEP ? data->opt : opt;
+	data->generation++; /* invalidates slices */
 
 	lunatik_unlock(object);
 	return 0;
 }
+
+int luadata_reset(lunatik_object_t *object, void *ptr, size_t size, uint8_t opt)
+{
+	return luadata_doreset(object, ptr, size, 0, opt);
+}
 EXPORT_SYMBOL(luadata_reset);
 
+/* offset is the start of the data, relative to skb->data (e.g., skb_mac_offset() to include the MAC header) */
+int luadata_resetskb(lunatik_object_t *object, struct sk_buff *skb, int offset, uint8_t opt)
+{
+	return luadata_doreset(object, skb, skb->len - offset, offset, opt | LUADATA_OPT_SKB);
+}
+EXPORT_SYMBOL(luadata_resetskb);
+
 static int __init luadata_init(void)
 {
 	return 0;
@@ -14,12 +14,25 @@ LUNATIK_LIB(data);
 #define	LUADATA_OPT_READONLY	0x01
 #define	LUADATA_OPT_FREE	0x02
 #define LUADATA_OPT_SKB  	0x04
+#define LUADATA_OPT_PERCPU	0x08
 #define	LUADATA_OPT_KEEP  	0x80
 
 #define luadata_clear(o)	(luadata_reset((o), NULL, 0, LUADATA_OPT_KEEP))
 
 lunatik_object_t *luadata_new(lua_State *L);
 int luadata_reset(lunatik_object_t *object, void *ptr, size_t size, uint8_t opt);
+struct sk_buff;
+int luadata_resetskb(lunatik_object_t *object, struct sk_buff *skb, int offset, uint8_t opt);
+const char *luadata_tolstring(lua_State *L, int ix, size_t *len);
+const char *luadata_checklstring(lua_State *L, int ix, size_t *len);
+const char *luadata_checkregion(lua_State *L, int ix, lua_Integer offset, lua_Integer length, size_t *len);
+void luadata_checkcopy(lua_State *L, int ix, lua_Integer offset, void *buffer, size_t length);
+typedef size_t (*luadata_scan_t)(void *ctx, const char *chunk, size_t len, size_t rest);
+size_t luadata_checkscan(lua_State *L, int ix, lua_Integer offset, lua_Integer length, void *buffer, size_t size,
+	luadata_scan_t scan, void *ctx);
+size_t luadata_checklength(lua_State *L, int ix);
+const char *luadata_borrow(lua_State *L, int ix, size_t *len);
+void luadata_unborrow(lua_State *L, int ix);
 
 static inline void luadata_close(lunatik_object_t *object)
 {
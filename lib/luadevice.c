@@ -33,6 +33,8 @@
 
 #include <lunatik.h>
 
+#include "luadata.h"
+
 static struct class *luadevice_devclass;
 
 /***
@@ -42,11 +44,36 @@ static struct class *luadevice_devclass;
 * character device, linking file operations to Lua callback functions.
 * @type device
 */
+typedef enum luadevice_fop_e {
+	LUADEVICE_OPEN,
+	LUADEVICE_READ,
+	LUADEVICE_WRITE,
+	LUADEVICE_RELEASE,
+	LUADEVICE_NFOPS,
+} luadevice_fop_t;
+
+static const char *luadevice_fopnames[LUADEVICE_NFOPS] = {
+	[LUADEVICE_OPEN] = "open",
+	[LUADEVICE_READ] = "read",
+	[LUADEVICE_WRITE] = "write",
+	[LUADEVICE_RELEASE] = "release",
+};
+
+static const lunatik_reg_t luadevice_fopstats[] = {
+	{"open", LUADEVICE_OPEN},
+	{"read", LUADEVICE_READ},
+	{"write", LUADEVICE_WRITE},
+	{"release", LUADEVICE_RELEASE},
+	{NULL, 0}
+};
+
 typedef struct luadevice_s {
 	struct list_head entry;
 	lunatik_object_t *runtime;
 	struct cdev *cdev;
 	dev_t devt;
+	int fops[LUADEVICE_NFOPS];
+	lunatik_stats_t stats;
 } luadevice_t;
 
 
@@ -86,35 +113,57 @@ static inline luadevice_t *luadevice_find(dev_t devt)
 
 static int luadevice_new(lua_State *L);
 
-static int luadevice_fop(lua_State *L, luadevice_t *luadev, const char *fop, int nargs, int nresults)
+static int luadevice_fop(lua_State *L, luadevice_t *luadev, luadevice_fop_t fop, int nargs, int nresults)
 {
 	int base = lua_gettop(L) - nargs;
 	int ret = -ENXIO;
+	u64 begin;
+
+	if (!lunatik_pushcallback(L, luadev->fops[fop])) {
+		lua_settop(L, base); /* pop args */
+		lua_settop(L, base + nresults); /* fop isn't defined; thus, results are nil */
+		return 0;
+	}
+
+	begin = lunatik_statbegin(&luadev->stats);
+	lunatik_statverdict(&luadev->stats, fop);
 
 	if (lunatik_getregistry(L, luadev) != LUA_TTABLE) {
-		pr_err("%s: couldn't find driver\n", fop);
+		pr_err("%s: couldn't find driver\n", luadevice_fopnames[fop]);
 		goto err;
 	}
 
-	lunatik_optcfunction(L, -1, fop, lunatik_nop);
-
+	lua_insert(L, base + 1); /* driver */
 	lua_insert(L, base + 1); /* fop */
-	lua_insert(L, base + 2); /* driver */
 
 	if (lua_pcall(L, nargs + 1, nresults, 0) != LUA_OK) { /* fop(driver, arg1, ...) */
-		pr_err("%s: %s\n", lua_tostring(L, -1), fop);
+		pr_err("%s: %s\n", lua_tostring(L, -1), luadevice_fopnames[fop]);
 		ret = -ECANCELED;
 		goto err;
 	}
+	lunatik_statend(&luadev->stats, begin);
 	return 0;
 err:
 	lua_settop(L, base); /* pop everything, including args */
+	lunatik_statinc(&luadev->stats, errors);
+	lunatik_statend(&luadev->stats, begin);
 	return ret;
 }
 
 static int luadevice_doopen(lua_State *L, luadevice_t *luadev)
 {
-	return luadevice_fop(L, luadev, "open", 0, 0);
+	return luadevice_fop(L, luadev, LUADEVICE_OPEN, 0, 0);
+}
+
+/* data objects are borrowed in protected mode, as they might be copied instead (see luadata_borrow()) */
+static int luadevice_borrow(lua_State *L)
+{
+	size_t len;
+	const char *buf = luadata_borrow(L, 1, &len);
+
+	lua_pushlightuserdata(L, (void *)buf);
+	lua_pushinteger(L, (lua_Integer)len);
+	return 3; /* string, data or copy; buffer; length */
 }
 
 static ssize_t luadevice_doread(lua_State *L, luadevice_t *luadev, char *buf, size_t len, loff_t *off)
@@ -125,15 +174,22 @@ static ssize_t luadevice_doread(lua_State *L, luadevice_t *luadev, char *buf, si
 
 	lua_pushinteger(L, len);
 	lua_pushinteger(L, *off);
-	if ((ret = luadevice_fop(L, luadev, "read", 2, 2)) != 0)
+	if ((ret = luadevice_fop(L, luadev, LUADEVICE_READ, 2, 2)) != 0)
 		return ret;
 
-	lbuf = lua_tolstring(L, -2, &llen);
-	llen = min(len, llen);
-	if (copy_to_user(buf, lbuf, llen) != 0)
-		return -EFAULT;
+	lua_pushcfunction(L, luadevice_borrow);
+	lua_pushvalue(L, -3);
+	if (lua_pcall(L, 1, 3, 0) != LUA_OK) /* stack: result, offset, borrowed, buffer, length */
+		return -EINVAL;
 
-	*off = (loff_t)luaL_optinteger(L, -1, *off + llen);
+	lbuf = (const char *)lua_touserdata(L, -2);
+	llen = min(len, (size_t)lua_tointeger(L, -1));
+	ret = copy_to_user(buf, lbuf, llen) != 0 ? -EFAULT : 0;
+	luadata_unborrow(L, -3);
+	if (ret != 0)
+		return ret;
+
+	*off = (loff_t)luaL_optinteger(L, -4, *off + llen);
 	return (ssize_t)llen;
 }
 
@@ -153,7 +209,7 @@ static ssize_t luadevice_dowrite(lua_State *L, luadevice_t *luadev, const char *
 
 	luaL_pushresultsize(&B, len);
 	lua_pushinteger(L, *off);
-	if ((ret = luadevice_fop(L, luadev, "write", 2, 2)) != 0)
+	if ((ret = luadevice_fop(L, luadev, LUADEVICE_WRITE, 2, 2)) != 0)
 		return ret;
 
 	llen = (size_t)luaL_optinteger(L, -2, len);
@@ -164,7 +220,7 @@ static ssize_t luadevice_dowrite(lua_State *L, luadevice_t *luadev, const char *
 
 static int luadevice_dorelease(lua_State *L, luadevice_t *luadev)
 {
-	return luadevice_fop(L, luadev, "release", 0, 0);
+	return luadevice_fop(L, luadev, LUADEVICE_RELEASE, 0, 0);
 }
 
 #define luadevice_fromfile(f)	((luadevice_t *)(f)->private_data)
@@ -238,9 +294,17 @@ static void luadevice_release(void *private)
 
 	/* device might have never been stopped */
 	luadevice_delete(luadev);
+	lunatik_freestats(&luadev->stats);
 	lunatik_putobject(luadev->runtime);
 }
 
+static void luadevice_unrefcallbacks(lua_State *L, luadevice_t *luadev)
+{
+	luadevice_fop_t fop;
+	for (fop = 0; fop < LUADEVICE_NFOPS; fop++)
+		lunatik_unrefcallback(L, &luadev->fops[fop]);
+}
+
 /***
 * Stops and releases a character device driver from the system.
 * This method is called on a device object returned by `device.new()`.
@@ -270,8 +334,10 @@ static int luadevice_stop(lua_State *L)
 	luadevice_delete(luadev);
 	lunatik_unlock(object);
 
-	if (lunatik_toruntime(L) == luadev->runtime)
+	if (lunatik_toruntime(L) == luadev->runtime) {
+		luadevice_unrefcallbacks(L, luadev);
 		lunatik_unregisterobject(L, object);
+	}
 	return 0;
 }
 
@@ -295,10 +361,11 @@ static int luadevice_stop(lua_State *L)
 *   - `read` (function): Callback for the `read(2)` system call.
 *     Signature: `function(driver_table, length, offset) -> string [, updated_offset]`.
 *     Receives the driver table, the requested read length (integer), and the current
-*     file offset (integer). Should return the data as a string and optionally the
-*     updated file offset (integer). If `updated_offset` is not returned, the offset
-*     is advanced by the length of the returned string (or the requested length if
-*     the string is longer).
+*     file offset (integer). Should return the data as a string (or a `data` object,
+*     such as a `data.buffer`, which is lent to the read rather than copied into a
+*     string; packets are copied) and optionally the updated file offset (integer).
+*     If `updated_offset` is not returned, the offset is advanced by the length of the
+*     returned string (or the requested length if the string is longer).
 *   - `write` (function): Callback for the `write(2)` system call.
 *     Signature: `function(driver_table, buffer_string, offset) -> [written_length] [, updated_offset]`.
 *     Receives the driver table, the data to write as a string, and the current file
@@ -311,6 +378,8 @@ static int luadevice_stop(lua_State *L)
 *     Expected to return nothing.
 *   - `mode` (integer): Optional file mode flags (e.g., permissions) for the device file.
 *     Use constants from the `linux.stat` table (e.g., `linux.stat.IRUGO`).
+*
+*   Callbacks are resolved once, when the device is created.
 * @treturn userdata A Lunatik object representing the newly created device.
 *   This object can be used to explicitly stop the device using the `:stop()` method.
 * @raise Error if the device cannot be allocated or registered in the kernel,
@@ -331,6 +400,25 @@ static int luadevice_stop(lua_State *L)
 *   -- To clean up: dev_obj:stop() or let it be garbage collected.
 * @see linux.stat
 */
+/***
+* Returns the statistics of this device.
+* Counters are kept per CPU and summed on each call; they are also exported
+* on `<debugfs>/lunatik/device/`.
+* @function stats
+* @treturn table A table with the fields `calls`, `errors`, `nsecs` (cumulative time
+*   spent on the callbacks) and `verdicts`, which counts calls by operation
+*   (`open`, `read`, `write` and `release`).
+* @usage print(dev:stats().verdicts.read)
+*/
+static int luadevice_stats(lua_State *L)
+{
+	lunatik_object_t *object = lunatik_checkobject(L, 1);
+	luadevice_t *luadev = (luadevice_t *)object->private;
+
+	lunatik_pushstats(L, &luadev->stats);
+	return 1;
+}
+
 static const luaL_Reg luadevice_lib[] = {
 	{"new", luadevice_new},
 	{NULL, NULL}
@@ -339,6 +427,7 @@ static const luaL_Reg luadevice_lib[] = {
 static const luaL_Reg luadevice_mt[] = {
 	{"__gc", lunatik_deleteobject},
 	{"stop", luadevice_stop},
+	{"stats", luadevice_stats},
 	{NULL, NULL}
 };
 
@@ -353,6 +442,7 @@ static int luadevice_new(lua_State *L)
 {
 	lunatik_object_t *object;
 	luadevice_t *luadev;
+	luadevice_fop_t fop;
 	struct device *device;
 	const char *name;
 	int ret;
@@ -370,20 +460,31 @@ static int luadevice_new(lua_State *L)
 	lunatik_setruntime(L, device, luadev);
 	lunatik_getobject(luadev->runtime);
 
+	if (lunatik_newstats(&luadev->stats, "device", name, luadevice_fopstats, lunatik_gfp(luadev->runtime)) != 0)
+		luaL_error(L, "failed to allocate statistics");
+
 	if ((ret = alloc_chrdev_region(&luadev->devt, 0, 1, name) != 0))
 		luaL_error(L, "failed to allocate char device region (%d)", ret);
 
 	if ((luadev->cdev = cdev_alloc()) == NULL)
 		luaL_error(L, "failed to allocate cdev");
 	luadev->cdev->ops = &luadevice_fops;
-	if ((ret = cdev_add(luadev->cdev, luadev->devt, 1)) != 0)
+
+	/* callbacks are referenced only once nothing but the registration itself can fail */
+	for (fop = 0; fop < LUADEVICE_NFOPS; fop++)
+		luadev->fops[fop] = lunatik_refcallback(L, 1, luadevice_fopnames[fop]);
+
+	if ((ret = cdev_add(luadev->cdev, luadev->devt, 1)) != 0) {
+		luadevice_unrefcallbacks(L, luadev);
 		luaL_error(L, "failed to add cdev (%d)", ret);
+	}
 
 	luadevice_listadd(luadev);
 	lunatik_registerobject(L, 1, object); /* driver */
 
 	device = device_create(luadevice_devclass, NULL, luadev->devt, luadev, name); /* calls devnode */
 	if (IS_ERR(device)) {
+		luadevice_unrefcallbacks(L, luadev);
 		lunatik_unregisterobject(L, object);
 		luaL_error(L, "failed to create a new device (%d)", PTR_ERR(device));
 	}
@@ -22,13 +22,15 @@
 
 #include <lunatik.h>
 
+#include "luadata.h"
+
 LUNATIK_PRIVATECHECKER(luafifo_check, struct kfifo *);
 
 /***
 * Pushes data into the FIFO.
 * Copies a string of bytes into the FIFO.
 * @function push
-* @tparam string data The string containing the bytes to be pushed into the FIFO.
+* @tparam string|data data The string (or `data` object) containing the bytes to be pushed into the FIFO.
 * @treturn nil
 * @raise Error if the provided data string is larger than the available space in the FIFO.
 * @usage
@@ -40,10 +42,14 @@ static int luafifo_push(lua_State *L)
 {
 	struct kfifo *fifo = luafifo_check(L, 1);
 	size_t size;
-	const char *buf = luaL_checklstring(L, 2, &size);
+	const char *buf = luadata_borrow(L, 2, &size); /* see luadata_borrow() */
+	bool fits = size <= kfifo_avail(fifo);
+
+	if (fits)
+		kfifo_in(fifo, buf, size);
+	luadata_unborrow(L, 2);
 
-	luaL_argcheck(L, size <= kfifo_avail(fifo), 2, "not enough space");
-	kfifo_in(fifo, buf, size);
+	luaL_argcheck(L, fits, 2, "not enough space");
 	return 0;
 }
 
@@ -0,0 +1,403 @@
+/*
+* SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+* SPDX-License-Identifier: MIT OR GPL-2.0-only
+*/
+
+/***
+* Multi-pattern string matching.
+* This library compiles a list of literal patterns into an Aho-Corasick
+* automaton, which finds occurrences of any of them in a single pass over
+* the subject, regardless of the number of patterns (e.g., to match SNI, DNS
+* or HTTP host names against a blocklist).
+*
+* The automaton is a DFA over the bytes that occur in the patterns; thus,
+* each subject byte costs a single table lookup. Matchers are read-only once
+* compiled and can be shared among runtimes (e.g., through `lunatik._ENV`)
+* and used concurrently without locking.
+*
+* @module matcher
+*/
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/mm.h>
+#include <linux/bitmap.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include <lunatik.h>
+
+#include "luadata.h"
+
+#define LUAMATCHER_NBYTES	(UCHAR_MAX + 1)
+#define LUAMATCHER_MAXCELLS	(1UL << 24)
+#define LUAMATCHER_CHUNK	(256) /* bytes of non-linear packets copied onto the stack at once */
+#define LUAMATCHER_MAXHITS	(64) /* states with outputs reached by findall between table updates */
+
+typedef struct luamatcher_s {
+	unsigned int nstates;
+	unsigned int nclasses;
+	unsigned int npatterns;
+	u16 classes[LUAMATCHER_NBYTES]; /* bytes that don't occur in any pattern fall into class 0 */
+	u32 *delta;	/* transitions, indexed by state * nclasses + class */
+	u32 *output;	/* ID of the pattern ending at each state (0 if none) */
+	u32 *dict;	/* next state with an output on the failure chain (0 if none) */
+	u32 *lengths;	/* pattern lengths, indexed by ID */
+	u32 cells[];
+} luamatcher_t;
+
+LUNATIK_PRIVATECHECKER(luamatcher_check, luamatcher_t *);
+
+#define luamatcher_next(m, s, b)	((m)->delta[(s) * (m)->nclasses + (m)->classes[(u8)(b)]])
+#define luamatcher_emit(m, s)		((m)->output[s] != 0 ? (m)->output[s] : (m)->output[(m)->dict[s]])
+
+static inline void luamatcher_checkrange(lua_State *L, int ix, lua_Integer *offset, lua_Integer *length)
+{
+	*offset = luaL_optinteger(L, ix + 1, 0);
+	*length = luaL_optinteger(L, ix + 2, -1);
+
+	luaL_argcheck(L, *offset >= 0, ix + 1, "out of bounds");
+	luaL_argcheck(L, *length >= 0 || lua_isnoneornil(L, ix + 2), ix + 2, "out of bounds");
+}
+
+typedef struct luamatcher_scan_s {
+	luamatcher_t *m;
+	u32 state;
+	u32 id;			/* found by find */
+	size_t rest;		/* of the range, after the scanned bytes */
+	unsigned int nhits;
+	u32 hits[LUAMATCHER_MAXHITS];
+} luamatcher_scan_t;
+
+/* subjects are scanned in place, under the lock of data objects (see luadata_checkscan()) */
+static size_t luamatcher_scanfirst(void *ctx, const char *chunk, size_t len, size_t rest)
+{
+	luamatcher_scan_t *scan = (luamatcher_scan_t *)ctx;
+	luamatcher_t *m = scan->m;
+	size_t i;
+
+	for (i = 0; i < len && scan->id == 0; i++) {
+		scan->state = luamatcher_next(m, scan->state, chunk[i]);
+		scan->id = luamatcher_emit(m, scan->state);
+	}
+	return i;
+}
+
+static size_t luamatcher_scanall(void *ctx, const char *chunk, size_t len, size_t rest)
+{
+	luamatcher_scan_t *scan = (luamatcher_scan_t *)ctx;
+	luamatcher_t *m = scan->m;
+	size_t i;
+
+	for (i = 0; i < len && scan->nhits < LUAMATCHER_MAXHITS; i++) {
+		u32 state = scan->state = luamatcher_next(m, scan->state, chunk[i]);
+
+		if (m->output[state] != 0 || m->dict[state] != 0)
+			scan->hits[scan->nhits++] = state;
+	}
+	scan->rest = len - i + rest;
+	return i;
+}
+
+/***
+* Represents a compiled multi-pattern matcher.
+* This is a userdata object returned by `matcher.new()`.
+* @type matcher
+*/
+
+/***
+* Finds the first pattern occurrence.
+* The first occurrence is the one that ends first; among those, the longest.
+* Data objects (e.g., packets) are scanned in place, while their lock is held.
+* @function find
+* @tparam string|data subject The subject (e.g., a packet).
+* @tparam[opt=0] integer offset The offset where the search starts.
+* @tparam[opt] integer length The length of the searched range (defaults to the rest of `subject`).
+* @treturn integer The ID of the pattern (i.e., its index in the list given to `new`), or `nil`.
+* @treturn integer The offset where the occurrence starts.
+* @raise Error if the range is out of bounds.
+* @usage
+*   local id, pos = hosts:find(skb, off, len)
+*/
+static int luamatcher_find(lua_State *L)
+{
+	luamatcher_scan_t scan = {.m = luamatcher_check(L, 1), .state = 0, .id = 0};
+	char buffer[LUAMATCHER_CHUNK];
+	lua_Integer offset, length;
+	size_t n;
+
+	luamatcher_checkrange(L, 2, &offset, &length);
+	n = luadata_checkscan(L, 2, offset, length, buffer, sizeof(buffer), luamatcher_scanfirst, &scan);
+	if (scan.id == 0) {
+		lua_pushnil(L);
+		return 1;
+	}
+
+	lua_pushinteger(L, (lua_Integer)scan.id);
+	lua_pushinteger(L, offset + (lua_Integer)(n - scan.m->lengths[scan.id]));
+	return 2;
+}
+
+/***
+* Finds all matching patterns.
+* @function findall
+* @tparam string|data subject The subject.
+* @tparam[opt=0] integer offset The offset where the search starts.
+* @tparam[opt] integer length The length of the searched range (defaults to the rest of `subject`).
+* @treturn table An array with the IDs of the patterns that occur in the subject,
+*   each listed once, in the order they are first found.
+* @raise Error if the range is out of bounds.
+*/
+static int luamatcher_findall(lua_State *L)
+{
+	luamatcher_t *m = luamatcher_check(L, 1);
+	luamatcher_scan_t scan = {.m = m, .state = 0};
+	char buffer[LUAMATCHER_CHUNK];
+	lua_Integer offset, length, n = 0;
+
+	luamatcher_checkrange(L, 2, &offset, &length);
+	lua_newtable(L); /* seen */
+	lua_newtable(L); /* IDs */
+
+	/* tables can't be filled while data objects are locked; thus, the range is scanned in rounds */
+	do {
+		unsigned int i;
+
+		scan.nhits = 0;
+		offset += (lua_Integer)luadata_checkscan(L, 2, offset, length, buffer, sizeof(buffer), luamatcher_scanall, &scan);
+		length = (lua_Integer)scan.rest;
+
+		for (i = 0; i < scan.nhits; i++) {
+			u32 s = scan.hits[i];
+
+			for (s = m->output[s] != 0 ? s : m->dict[s]; s != 0; s = m->dict[s]) {
+				lua_Integer id = (lua_Integer)m->output[s];
+
+				if (lua_rawgeti(L, -2, id) == LUA_TNIL) {
+					lua_pushboolean(L, true);
+					lua_rawseti(L, -4, id);
+					lua_pushinteger(L, id);
+					lua_rawseti(L, -3, ++n);
+				}
+				lua_pop(L, 1);
+			}
+		}
+	} while (scan.nhits == LUAMATCHER_MAXHITS);
+	return 1;
+}
+
+/***
+* Returns the number of patterns.
+* @function __len
+* @treturn integer
+*/
+static int luamatcher_length(lua_State *L)
+{
+	luamatcher_t *m = luamatcher_check(L, 1);
+	lua_pushinteger(L, (lua_Integer)m->npatterns);
+	return 1;
+}
+
+static void luamatcher_release(void *private)
+{
+	kvfree(private);
+}
+
+static int luamatcher_new(lua_State *L);
+
+/***
+* Compiles a list of patterns into a matcher.
+* @function new
+* @tparam table patterns An array of non-empty strings (or `data` objects).
+* @tparam[opt=false] boolean nocase Whether ASCII letters match regardless of case.
+* @treturn matcher A new matcher.
+* @raise Error if a pattern is invalid, if the automaton is too large or if
+*   memory allocation fails.
+* @usage
+*   local matcher = require("matcher")
+*   local hosts = matcher.new({"github.com", "gitlab.com"}, true)
+*   local id = hosts:find("www.GitHub.com") -- 1
+* @within matcher
+*/
+static const luaL_Reg luamatcher_lib[] = {
+	{"new", luamatcher_new},
+	{NULL, NULL}
+};
+
+static const luaL_Reg luamatcher_mt[] = {
+	{"__gc", lunatik_deleteobject},
+	{"__len", luamatcher_length},
+	{"find", luamatcher_find},
+	{"findall", luamatcher_findall},
+	{NULL, NULL}
+};
+
+/* matchers are read-only once compiled; thus, they aren't monitored */
+static const lunatik_class_t luamatcher_class = {
+	.name = "matcher",
+	.methods = luamatcher_mt,
+	.release = luamatcher_release,
+	.sleep = false,
+	.pointer = true,
+};
+
+/* only ASCII letters are folded */
+#define luamatcher_fold(nocase, b)	((nocase) && (b) >= 'A' && (b) <= 'Z' ? (b) + ('a' - 'A') : (b))
+
+static void luamatcher_insert(luamatcher_t *m, const char *pattern, size_t len, u32 id)
+{
+	u32 state = 0;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		u32 *next = &luamatcher_next(m, state, pattern[i]);
+
+		if (*next == 0)
+			*next = m->nstates++;
+		state = *next;
+	}
+
+	if (m->output[state] == 0) /* duplicates keep the first ID */
+		m->output[state] = id;
+	m->lengths[id] = (u32)len;
+}
+
+/* turns the trie into a DFA, filling missing transitions in breadth-first order */
+static void luamatcher_compile(luamatcher_t *m, u32 *queue, u32 *fail)
+{
+	unsigned int head = 0, tail = 0;
+	u32 c;
+
+	for (c = 0; c < m->nclasses; c++) {
+		u32 t = m->delta[c];
+		if (t != 0) {
+			fail[t] = 0;
+			queue[tail++] = t;
+		}
+	}
+
+	while (head < tail) {
+		u32 s = queue[head++];
+
+		for (c = 0; c < m->nclasses; c++) {
+			u32 *t = &m->delta[s * m->nclasses + c];
+			u32 f = m->delta[fail[s] * m->nclasses + c];
+
+			if (*t == 0) {
+				*t = f;
+				continue;
+			}
+			fail[*t] = f;
+			m->dict[*t] = m->output[f] != 0 ? f : m->dict[f];
+			queue[tail++] = *t;
+		}
+	}
+}
+
+static int luamatcher_new(lua_State *L)
+{
+	DECLARE_BITMAP(used, LUAMATCHER_NBYTES);
+	size_t npatterns, total = 0, maxstates, ncells, i;
+	lunatik_object_t *object;
+	unsigned int nclasses = 1;
+	gfp_t gfp = lunatik_gfp(lunatik_toruntime(L));
+	luamatcher_t *m;
+	u32 *queue;
+	bool nocase;
+	int b;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	nocase = lua_toboolean(L, 2);
+	npatterns = lua_rawlen(L, 1);
+	luaL_argcheck(L, npatterns > 0 && npatterns < LUAMATCHER_MAXCELLS, 1, "invalid number of patterns");
+
+	/* patterns are read once, into a table of strings and copies of data objects (see luadata_tolstring());
+	 * thus, they can't change between sizing the automaton and filling it */
+	lua_settop(L, 2);
+	lua_createtable(L, (int)npatterns, 0);
+	bitmap_zero(used, LUAMATCHER_NBYTES);
+	for (i = 1; i <= npatterns; i++) {
+		const char *pattern;
+		size_t len, j;
+
+		lua_rawgeti(L, 1, (lua_Integer)i);
+		pattern = luadata_tolstring(L, -1, &len);
+		if (pattern == NULL || len == 0)
+			luaL_argerror(L, 1, "invalid pattern");
+		lua_rawseti(L, 3, (lua_Integer)i);
+
+		for (j = 0; j < len; j++)
+			__set_bit(luamatcher_fold(nocase, (u8)pattern[j]), used);
+		total += len;
+		luaL_argcheck(L, total < LUAMATCHER_MAXCELLS, 1, "too many patterns");
+	}
+
+	nclasses += bitmap_weight(used, LUAMATCHER_NBYTES);
+	maxstates = total + 1;
+	luaL_argcheck(L, maxstates <= LUAMATCHER_MAXCELLS / (nclasses + 2), 1, "too many patterns");
+	ncells = maxstates * (nclasses + 2) + npatterns + 1;
+
+	object = lunatik_newobject(L, &luamatcher_class, 0);
+	if ((m = kvzalloc(struct_size(m, cells, ncells), gfp)) == NULL)
+		luaL_error(L, "not enough memory");
+
+	if ((queue = kvmalloc_array(maxstates * 2, sizeof(u32), gfp)) == NULL) {
+		kvfree(m);
+		luaL_error(L, "not enough memory");
+	}
+
+	m->nclasses = nclasses;
+	m->npatterns = (unsigned int)npatterns;
+	m->nstates = 1; /* root */
+	m->delta = m->cells;
+	m->output = m->delta + maxstates * nclasses;
+	m->dict = m->output + maxstates;
+	m->lengths = m->dict + maxstates;
+
+	nclasses = 1;
+	for_each_set_bit(b, used, LUAMATCHER_NBYTES)
+		m->classes[b] = nclasses++;
+	if (nocase)
+		for (b = 'A'; b <= 'Z'; b++)
+			m->classes[b] = m->classes[luamatcher_fold(nocase, b)];
+
+	for (i = 1; i <= npatterns; i++) {
+		const char *pattern;
+		size_t len;
+
+		if (lua_rawgeti(L, 3, (lua_Integer)i) == LUA_TSTRING)
+			pattern = lua_tolstring(L, -1, &len);
+		else {
+			pattern = (const char *)lua_touserdata(L, -1);
+			len = lua_rawlen(L, -1);
+		}
+		luamatcher_insert(m, pattern, len, (u32)i);
+		lua_pop(L, 1);
+	}
+
+	luamatcher_compile(m, queue, queue + maxstates);
+	kvfree(queue);
+
+	object->private = m;
+	return 1; /* object */
+}
+
+LUNATIK_NEWLIB(matcher, luamatcher_lib, &luamatcher_class, NULL);
+
+static int __init luamatcher_init(void)
+{
+	return 0;
+}
+
+static void __exit luamatcher_exit(void)
+{
+}
+
+module_init(luamatcher_init);
+module_exit(luamatcher_exit);
+MODULE_LICENSE("Dual MIT/GPL");
+MODULE_AUTHOR("Lourival Vieira Neto <lourival.neto@ring-0.io>");
+
@@ -34,7 +34,9 @@ typedef struct luanetfilter_s {
 	lunatik_object_t *runtime;
 	lunatik_object_t *skb;
 	u32 mark;
+	int hook;
 	struct nf_hook_ops nfops;
+	lunatik_stats_t stats;
 } luanetfilter_t;
 
 
@@ -42,13 +44,8 @@ static void luanetfilter_release(void *private);
 
 static inline bool luanetfilter_pushcb(lua_State *L, luanetfilter_t *luanf)
 {
-	if (lunatik_getregistry(L, luanf) != LUA_TTABLE) {
-		pr_err("could not find ops table\n");
-		return false;
-	}
-
-	if (lua_getfield(L, -1, "hook") != LUA_TFUNCTION) {
-		pr_err("operation not defined");
+	if (!lunatik_pushcallback(L, luanf->hook)) {
+		pr_err("operation not defined\n");
 		return false;
 	}
 	return true;
@@ -62,7 +59,7 @@ static inline lunatik_object_t *luanetfilter_pushskb(lua_State *L, luanetfilter_
 	}
 
 	lunatik_object_t *data = (lunatik_object_t *)lunatik_toobject(L, -1);
-	if (unlikely(data == NULL || skb_linearize(skb) != 0)) {
+	if (unlikely(data == NULL)) {
 		pr_err("could not get skb\n");
 		return NULL;
 	}
@@ -76,10 +73,8 @@ static int luanetfilter_hook_cb(lua_State *L, luanetfilter_t *luanf, struct sk_b
 	if (!luanetfilter_pushcb(L, luanf) || (data = luanetfilter_pushskb(L, luanf, skb)) == NULL)
 		return -1;
 
-	if (skb_mac_header_was_set(skb))
-		luadata_reset(data, skb, skb_headlen(skb) + skb_mac_header_len(skb), LUADATA_OPT_SKB);
-	else
-		luadata_reset(data, skb, skb_headlen(skb), LUADATA_OPT_SKB);
+	/* non-linear skbs are accessed in place; data starts at skb->data, as it always did */
+	luadata_resetskb(data, skb, 0, LUADATA_OPT_NONE);
 
 	if (lua_pcall(L, 1, 2, 0) != LUA_OK) {
 		pr_err("%s\n", lua_tostring(L, -1));
@@ -95,6 +90,7 @@ static inline unsigned int luanetfilter_docall(luanetfilter_t *luanf, struct sk_
 {
 	int ret;
 	int policy = NF_ACCEPT;
+	u64 begin;
 
 	if (unlikely(!luanf || !luanf->runtime)) {
 		pr_err("runtime not found\n");
@@ -104,8 +100,18 @@ static inline unsigned int luanetfilter_docall(luanetfilter_t *luanf, struct sk_
 	if (likely(luanf->mark != skb->mark))
 		goto out;
 
+	begin = lunatik_statbegin(&luanf->stats);
 	lunatik_runbh(luanf->runtime, luanetfilter_hook_cb, ret, luanf, skb);
-	return (ret < 0 || ret > NF_MAX_VERDICT) ? policy : ret;
+	lunatik_statend(&luanf->stats, begin);
+
+	if (unlikely(ret < 0))
+		lunatik_statinc(&luanf->stats, errors);
+	if (unlikely(ret < 0 || ret > NF_MAX_VERDICT)) {
+		lunatik_statinc(&luanf->stats, fallbacks);
+		ret = policy;
+	}
+	lunatik_statverdict(&luanf->stats, ret);
+	return ret;
 out:
 	return policy;
 }
@@ -130,8 +136,27 @@ static unsigned int luanetfilter_hook(const struct nf_hook_ops *ops, struct sk_b
 }
 #endif
 
+LUNATIK_PRIVATECHECKER(luanetfilter_check, luanetfilter_t *);
+
+/***
+* Returns the statistics of this hook.
+* Counters are kept per CPU and summed on each call; they are also exported
+* on `<debugfs>/lunatik/netfilter/`.
+* @function stats
+* @treturn table A table with the fields `calls`, `errors`, `fallbacks` (calls that
+*   resulted on the default verdict), `nsecs` (cumulative time spent on the handler)
+*   and `verdicts` (a table indexed by the names of `netfilter.action`).
+*/
+static int luanetfilter_stats(lua_State *L)
+{
+	luanetfilter_t *nf = luanetfilter_check(L, 1);
+	lunatik_pushstats(L, &nf->stats);
+	return 1;
+}
+
 static const luaL_Reg luanetfilter_mt[] = {
 	{"__gc", lunatik_deleteobject},
+	{"stats", luanetfilter_stats},
 	{NULL, NULL}
 };
 
@@ -152,6 +177,7 @@ static const lunatik_class_t luanetfilter_class = {
 *   - `hook` (function): The Lua function to be called for each packet.
 *     It receives a `luadata` object representing the packet buffer (`skb`)
 *     and should return an integer verdict (e.g., `netfilter.action.ACCEPT`).
+*     It is resolved once, on registration; reassigning `opts.hook` afterwards has no effect.
 *   - `pf` (integer): The protocol family (e.g., `netfilter.family.INET`).
 *   - `hooknum` (integer): The hook number within the protocol family (e.g., `netfilter.inet_hooks.LOCAL_OUT`).
 *   - `priority` (integer): The hook priority (e.g., `netfilter.ip_priority.FILTER`).
@@ -163,8 +189,10 @@ static int luanetfilter_register(lua_State *L)
 	luaL_checktype(L, 1, LUA_TTABLE);
 	lunatik_object_t *object = lunatik_newobject(L, &luanetfilter_class , sizeof(luanetfilter_t));
 	luanetfilter_t *nf = (luanetfilter_t *)object->private;
+	char name[32];
+
+	memset(nf, 0, sizeof(luanetfilter_t));
 	luadata_attach(L, nf, skb);
-	nf->runtime = NULL;
 
 	struct nf_hook_ops *nfops = &nf->nfops;
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(5, 14, 0))
@@ -178,12 +206,20 @@ static int luanetfilter_register(lua_State *L)
 	lunatik_setinteger(L, 1, nfops, priority);
 	lunatik_optinteger(L, 1, nf, mark, 0);
 
+	snprintf(name, sizeof(name), "pf%u.hook%u", nfops->pf, nfops->hooknum);
+	if (lunatik_newstats(&nf->stats, "netfilter", name, luanetfilter_action, lunatik_gfp(lunatik_toruntime(L))) != 0)
+		luaL_error(L, "failed to allocate netfilter statistics");
+
+	/* the reference lives in the registry of this runtime, which outlives the hook */
+	nf->hook = lunatik_checkcallback(L, 1, "hook");
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0))
-	if (nf_register_net_hook(&init_net, nfops) != 0)
+	if (nf_register_net_hook(&init_net, nfops) != 0) {
 #else
-	if (nf_register_hook(nfops) != 0)
+	if (nf_register_hook(nfops) != 0) {
 #endif
-	luaL_error(L, "failed to register netfilter hook");
+		lunatik_unrefcallback(L, &nf->hook);
+		luaL_error(L, "failed to register netfilter hook");
+	}
 	lunatik_setruntime(L, netfilter, nf);
 	lunatik_getobject(nf->runtime);
 	lunatik_registerobject(L, 1, object);
@@ -195,15 +231,17 @@ static const luaL_Reg luanetfilter_lib[] = {
 	{NULL, NULL},
 };
 
+/* hook objects are kept in the registry of their runtime until it is closed; thus, the
+ * callback reference is dropped along with that registry and there is no state to unref it here */
 static void luanetfilter_release(void *private)
 {
 	luanetfilter_t *nf = (luanetfilter_t *)private;
-	if (!nf->runtime)
-		return;
-
-	nf_unregister_net_hook(&init_net, &nf->nfops);
-	lunatik_putobject(nf->runtime);
-	nf->runtime = NULL;
+	if (nf->runtime != NULL) {
+		nf_unregister_net_hook(&init_net, &nf->nfops);
+		lunatik_putobject(nf->runtime);
+		nf->runtime = NULL;
+	}
+	lunatik_freestats(&nf->stats);
 }
 
 LUNATIK_NEWLIB(netfilter, luanetfilter_lib, &luanetfilter_class, luanetfilter_flags);
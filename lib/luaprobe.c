@@ -34,8 +34,22 @@
 typedef struct luaprobe_s {
 	struct kprobe kp;
 	lunatik_object_t *runtime;
+	int pre;
+	int post;
+	lunatik_stats_t stats;
 } luaprobe_t;
 
+typedef enum luaprobe_handler_e {
+	LUAPROBE_PRE,
+	LUAPROBE_POST,
+} luaprobe_handler_t;
+
+static const lunatik_reg_t luaprobe_handlers[] = {
+	{"pre", LUAPROBE_PRE},
+	{"post", LUAPROBE_POST},
+	{NULL, 0}
+};
+
 static void (*luaprobe_showregs)(struct pt_regs *);
 
 static int luaprobe_dump(lua_State *L)
@@ -48,17 +62,18 @@ static int luaprobe_dump(lua_State *L)
 	return 0;
 }
 
-static int luaprobe_handler(lua_State *L, luaprobe_t *probe, const char *handler, struct pt_regs *regs)
+static int luaprobe_handler(lua_State *L, luaprobe_t *probe, luaprobe_handler_t which, struct pt_regs *regs)
 {
 	struct kprobe *kp = &probe->kp;
 	const char *symbol = kp->symbol_name;
+	int handler = which == LUAPROBE_PRE ? probe->pre : probe->post;
+	u64 begin;
 
-	if (lunatik_getregistry(L, probe) != LUA_TTABLE) {
-		pr_err("couldn't find probe table\n");
-		goto out;
-	}
+	if (!lunatik_pushcallback(L, handler))
+		goto out; /* handler not defined */
 
-	lunatik_optcfunction(L, -1, handler, lunatik_nop);
+	begin = lunatik_statbegin(&probe->stats);
+	lunatik_statverdict(&probe->stats, which);
 
 	if (symbol != NULL)
 		lua_pushstring(L, symbol);
@@ -70,11 +85,14 @@ static int luaprobe_handler(lua_State *L, luaprobe_t *probe, const char *handler
 	lua_pushvalue(L, -1); /* save dump() on the stack */
 	lua_insert(L, -4); /* stack: dump, handler, symbol | addr, dump */
 
-	if (lua_pcall(L, 2, 0, 0) != LUA_OK) /* handler(symbol | addr, dump) */
+	if (lua_pcall(L, 2, 0, 0) != LUA_OK) { /* handler(symbol | addr, dump) */
 		pr_err("%s\n", lua_tostring(L, -1));
+		lunatik_statinc(&probe->stats, errors);
+	}
 
 	lua_pushnil(L);
 	lua_setupvalue(L, -2, 1); /* clean up regs */
+	lunatik_statend(&probe->stats, begin);
 out:
 	return 0;
 }
@@ -84,7 +102,7 @@ static int __kprobes luaprobe_pre_handler(struct kprobe *kp, struct pt_regs *reg
 	luaprobe_t *probe = container_of(kp, luaprobe_t, kp);
 	int ret;
 
-	lunatik_run(probe->runtime, luaprobe_handler, ret, probe, "pre", regs);
+	lunatik_run(probe->runtime, luaprobe_handler, ret, probe, LUAPROBE_PRE, regs);
 	return ret;
 }
 
@@ -94,7 +112,7 @@ static void __kprobes luaprobe_post_handler(struct kprobe *kp, struct pt_regs *r
 	int ret;
 
 	/* flags always seems to be zero; see:https://docs.kernel.org/trace/kprobes.html#api-reference */
-	lunatik_run(probe->runtime, luaprobe_handler, ret, probe, "post", regs);
+	lunatik_run(probe->runtime, luaprobe_handler, ret, probe, LUAPROBE_POST, regs);
 	(void)ret;
 }
 
@@ -122,6 +140,7 @@ static void luaprobe_release(void *private)
 
 	/* device might have never been stopped */
 	luaprobe_delete(probe);
+	lunatik_freestats(&probe->stats);
 	lunatik_putobject(probe->runtime);
 }
 
@@ -143,8 +162,11 @@ static int luaprobe_stop(lua_State *L)
 	luaprobe_delete(probe);
 	lunatik_unlock(object);
 
-	if (lunatik_toruntime(L) == probe->runtime)
+	if (lunatik_toruntime(L) == probe->runtime) {
+		lunatik_unrefcallback(L, &probe->pre);
+		lunatik_unrefcallback(L, &probe->post);
 		lunatik_unregisterobject(L, object);
+	}
 	return 0;
 }
 
@@ -182,6 +204,24 @@ err:
 	return luaL_argerror(L, 1, LUNATIK_ERR_NULLPTR);
 }
 
+/***
+* Returns the statistics of this probe.
+* Counters are kept per CPU and summed on each call; they are also exported
+* on `<debugfs>/lunatik/probe/`.
+* @function stats
+* @treturn table A table with the fields `calls`, `errors`, `nsecs` (cumulative time
+*   spent on the handlers) and `verdicts`, which counts calls by handler (`pre` and `post`).
+* @usage print(my_probe_object:stats().calls)
+*/
+static int luaprobe_stats(lua_State *L)
+{
+	lunatik_object_t *object = lunatik_checkobject(L, 1);
+	luaprobe_t *probe = (luaprobe_t *)object->private;
+
+	lunatik_pushstats(L, &probe->stats);
+	return 1;
+}
+
 static int luaprobe_new(lua_State *L);
 
 /***
@@ -209,6 +249,8 @@ static int luaprobe_new(lua_State *L);
 *   - `post` (function, optional): A Lua function to be called just *after* the
 *     probed instruction has executed.
 *
+*   Handlers are resolved once, when the probe is registered.
+*
 *   Both `pre` and `post` handlers receive two arguments:
 *
 *   1. `target` (string|lightuserdata): The symbol name or address that was probed.
@@ -229,6 +271,7 @@ static const luaL_Reg luaprobe_mt[] = {
 	{"__gc", lunatik_deleteobject},
 	{"stop", luaprobe_stop},
 	{"enable", luaprobe_enable},
+	{"stats", luaprobe_stats},
 	{NULL, NULL}
 };
 
@@ -263,11 +306,21 @@ static int luaprobe_new(lua_State *L)
 
 	luaL_checktype(L, 2, LUA_TTABLE); /* handlers */
 
+	if (lunatik_newstats(&probe->stats, "probe", kp->symbol_name ? kp->symbol_name : "address",
+		luaprobe_handlers, lunatik_gfp(probe->runtime)) != 0)
+		luaL_error(L, "out of memory");
+
+	/* callbacks are referenced only once nothing but the registration itself can fail */
+	probe->pre = lunatik_refcallback(L, 2, "pre");
+	probe->post = lunatik_refcallback(L, 2, "post");
+
 	kp->pre_handler = luaprobe_pre_handler;
 	kp->post_handler = luaprobe_post_handler;
 
 	if ((ret = register_kprobe(kp)) != 0) {
 		kp->pre_handler = NULL; /* shouldn't unregister on release() */
+		lunatik_unrefcallback(L, &probe->pre);
+		lunatik_unrefcallback(L, &probe->post);
 		luaL_error(L, "failed to register probe (%d)", ret);
 	}
 
@@ -12,13 +12,32 @@
 * read operations significantly outnumber write operations and high concurrency
 * is required.
 *
+* Tables grow and shrink automatically: whenever the load factor goes over
+* 100% (or under 25%), a worker rehashes the entries into a new bucket array,
+* a bucket at a time, and publishes it with `rcu_assign_pointer`.
+* Entries are linked through two nodes, one per bucket array generation, so
+* lookups stay lockless during a resize. Writers lock one out of a set of striped spinlocks
+* (picked by bucket); thus, writers to different buckets run in parallel, even while
+* the table is resized, and they share no cache line but that of their lock.
+* Bulk reloads can be built privately with `rcu.build()` and then published
+* at once, so readers never see a partially updated table.
+*
+* Entries store the hash and the length of their keys, so mismatches are
+* mostly rejected without comparing strings. Hot paths might also look keys
+* up through handles returned by `rcu.key()`, which carry a precomputed hash.
+*
 * Keys in the RCU table must be strings. Values must be Lunatik objects
 * (i.e., userdata created by other Lunatik C modules like `data.new()`,
-* `lunatik.runtime()`, etc.) or `nil` to delete an entry.
+* `lunatik.runtime()`, etc.), integers, booleans, short strings or `nil`
+* to delete an entry. Scalar values are stored inline in the table entry;
+* thus, looking them up neither clones objects nor touches reference counters.
 *
 * A practical example of its usage can be found in `examples/shared.lua`,
 * which implements an in-memory key-value store.
 *
+* This library also provides longest-prefix-match tables (`rcu.lpm()`),
+* which map IPv4 or IPv6 prefixes to the same kinds of values.
+*
 * @module rcu
 */
 
@@ -26,8 +45,15 @@
 #include <linux/kernel.h>
 #include <linux/module.h>
 #include <linux/spinlock.h>
-#include <linux/hashtable.h>
+#include <linux/seqlock.h>
+#include <linux/percpu_counter.h>
+#include <linux/rculist.h>
 #include <linux/random.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/workqueue.h>
+#include <linux/in.h>
+#include <linux/in6.h>
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -35,16 +61,56 @@
 #include <lunatik.h>
 
 #include "luarcu.h"
+#include "luadata.h"
 
 #define LUARCU_MAXKEY	(LUAL_BUFFERSIZE)
+#define LUARCU_MAXSIZE	(1UL << 24)
+#define LUARCU_MAXSTRING	(64)
+#define LUARCU_MAXLOCKS	(1024)
+#define LUARCU_REHASHCHUNK	(64)
+#define LUARCU_COUNTBATCH	(32)		/* entries added or removed by a CPU before the shared count is updated */
+#define LUARCU_BATCH	(64)
+#define LUARCU_MAXBATCH	(256)
+#define LUARCU_SLOTHINT	(64)		/* usual length of keys plus strings, to size cursors */
+#define LUARCU_MAXCURSOR	(16384)		/* bytes copied at a time by a cursor */
+#define LUARCU_CURSOR	"rcu.cursor"
+
+/* `type` is either LUA_TUSERDATA (a Lunatik object), LUA_TNUMBER, LUA_TBOOLEAN or LUA_TSTRING */
+typedef struct luarcu_value_s {
+	int type;
+	union {
+		lunatik_object_t *object;
+		lua_Integer integer;
+		bool boolean;
+		size_t length;
+	};
+} luarcu_value_t;
 
+/* entries are linked through two nodes: the current bucket array uses `hlist[version]`,
+ * while a resize links them into the new array through `hlist[!version]` */
 typedef struct luarcu_entry_s {
-	lunatik_object_t *object;
-	struct hlist_node hlist;
+	struct hlist_node hlist[2];
 	struct rcu_head rcu;
-	char key[];
+	luarcu_value_t value;
+	unsigned int hash;
+	size_t keylen;
+	char key[]; /* string values are stored right after the key terminator */
 } luarcu_entry_t;
 
+#define luarcu_string(entry)	((entry)->key + (entry)->keylen + 1)
+
+typedef struct luarcu_buckets_s {
+	size_t size;
+	unsigned int version;
+	union {
+		struct rcu_head rcu; /* replaced by a resize */
+		struct rcu_work free; /* replaced by a build, along with its entries */
+	};
+	struct hlist_head hlist[];
+} luarcu_buckets_t;
+
+static struct workqueue_struct *luarcu_wq;
+
 /***
 * Represents an RCU-synchronized hash table.
 * This is a userdata object returned by `rcu.table()`. It behaves like a
@@ -52,8 +118,10 @@ typedef struct luarcu_entry_s {
 * but uses RCU internally for synchronization.
 *
 * Keys must be strings. Values stored must be Lunatik objects (e.g., created
-* via `data.new()`, `lunatik.runtime()`) or `nil` (to remove an entry).
-* When a Lunatik object is retrieved, it's a new reference to that object.
+* via `data.new()`, `lunatik.runtime()`), integers, booleans, strings of
+* up to 64 bytes or `nil` (to remove an entry).
+* When a Lunatik object is retrieved, it's a new reference to that object;
+* scalar values are returned as plain Lua values.
 *
 * @type rcu_table
 * @usage
@@ -82,62 +150,87 @@ typedef struct luarcu_entry_s {
 */
 
 typedef struct luarcu_table_s {
-	size_t size;
-	unsigned int seed;
-	struct hlist_head hlist[];
+	luarcu_buckets_t __rcu *buckets;
+	struct percpu_counter count;
+	size_t minsize;
+	unsigned int resizes;
+	seqlock_t resizing; /* written by resizes and builds whenever they replace `buckets` or `future` */
+	spinlock_t *locks; /* striped by bucket of the smallest array; thus, a bucket always maps to the same lock */
+	unsigned int lockmask;
+	struct work_struct resize;
+	luarcu_buckets_t *future; /* being filled by a resize, which has already rehashed `migrated` buckets */
+	size_t migrated;
 } luarcu_table_t;
 
-#define luarcu_sizeoftable(size)	(sizeof(luarcu_table_t) + sizeof(struct hlist_head) * (size))
-
 /* size is always a power of 2; thus `size - 1` turns on every valid bit */
-#define luarcu_mask(table)			((table)->size - 1)
-#define luarcu_hash(table, key, keylen)		(lunatik_hash((key), (keylen), (table)->seed) & luarcu_mask(table))
-#define luarcu_seed()				get_random_u32()
+#define luarcu_mask(buckets)			((buckets)->size - 1)
+#define luarcu_bucket(buckets, hash)		(&(buckets)->hlist[(hash) & luarcu_mask(buckets)])
 
-#define luarcu_entry(ptr, pos)		hlist_entry_safe(rcu_dereference_raw(ptr), typeof(*(pos)), hlist)
-#define luarcu_foreach(table, bucket, n, pos)							\
-	for (bucket = 0, pos = NULL; pos == NULL && bucket < (table)->size; bucket++)		\
-		for (pos = luarcu_entry(hlist_first_rcu(&(table)->hlist[bucket]), pos);		\
-			pos && ({ n = luarcu_entry(hlist_next_rcu(&(pos)->hlist), pos); 1; });	\
-			pos = n)
+/* the seed is shared by every table; thus, key handles work on any table */
+static unsigned int luarcu_seed __read_mostly;
+#define luarcu_hash(key, keylen)		lunatik_hash((key), (keylen), luarcu_seed)
 
-#define luarcu_checkoptnil(L, i, checkopt, ...) \
-	(lua_type((L), (i)) == LUA_TNIL ? NULL : checkopt((L), (i), ## __VA_ARGS__))
+#define luarcu_buckets(table)	rcu_dereference_protected((table)->buckets, lockdep_is_held(&(table)->resizing.lock))
+#define luarcu_lock(table, hash)	(&(table)->locks[(hash) & (table)->lockmask])
 
 static int luarcu_table(lua_State *L);
+static int luarcu_build(lua_State *L);
+static int luarcu_key(lua_State *L);
+static int luarcu_lpm(lua_State *L);
+static const lunatik_class_t luarcu_key_class;
 
-static inline luarcu_entry_t *luarcu_lookup(luarcu_table_t *table, unsigned int index,
-	const char *key, size_t keylen)
+static inline luarcu_entry_t *luarcu_lookup(luarcu_buckets_t *buckets, const luarcu_key_t *key)
 {
+	unsigned int version = buckets->version;
 	luarcu_entry_t *entry;
 
-	hlist_for_each_entry_rcu(entry, table->hlist + index, hlist)
-		if (strncmp(entry->key, key, keylen) == 0)
+	hlist_for_each_entry_rcu(entry, luarcu_bucket(buckets, key->hash), hlist[version])
+		if (entry->hash == key->hash && entry->keylen == key->len &&
+			memcmp(entry->key, key->str, key->len) == 0)
 			return entry;
 	return NULL;
 }
 
-static luarcu_entry_t *luarcu_newentry(const char *key, size_t keylen, lunatik_object_t *object)
+static luarcu_entry_t *luarcu_newentry(const luarcu_key_t *key, const luarcu_value_t *value,
+	const char *string)
 {
+	size_t length = value->type == LUA_TSTRING ? value->length + 1 : 0;
 	luarcu_entry_t *entry;
 
-	if (keylen >= LUARCU_MAXKEY || (entry = kmalloc(struct_size(entry, key, keylen + 1), GFP_ATOMIC)) == NULL)
+	if (key->len >= LUARCU_MAXKEY || (entry = kmalloc(struct_size(entry, key, key->len + 1 + length), GFP_ATOMIC)) == NULL)
 		return NULL;
 
-	strncpy(entry->key, key, keylen);
-	entry->key[keylen] = '\0';
-	entry->object = object;
-	lunatik_getobject(object);
+	memcpy(entry->key, key->str, key->len);
+	entry->key[key->len] = '\0';
+	entry->keylen = key->len;
+	entry->hash = key->hash;
+	entry->value = *value;
+	if (value->type == LUA_TUSERDATA)
+		lunatik_getobject(value->object);
+	else if (value->type == LUA_TSTRING) {
+		memcpy(luarcu_string(entry), string, value->length);
+		luarcu_string(entry)[value->length] = '\0';
+	}
 	return entry;
 }
 
 static inline void luarcu_free(luarcu_entry_t *entry)
 {
-	lunatik_putobject(entry->object);
+	if (entry->value.type == LUA_TUSERDATA)
+		lunatik_putobject(entry->value.object);
 	kfree_rcu(entry, rcu);
 }
 
-LUNATIK_OBJECTCHECKER(luarcu_checktable, luarcu_table_t *);
+/* copies the value out of the read-side critical section; objects get a new reference */
+static inline void luarcu_copyvalue(const luarcu_value_t *from, const char *fromstring,
+	luarcu_value_t *value, char *string)
+{
+	*value = *from;
+	if (value->type == LUA_TUSERDATA)
+		lunatik_getobject(value->object);
+	else if (value->type == LUA_TSTRING)
+		memcpy(string, fromstring, value->length);
+}
 
 static int luarcu_cloneobject(lua_State *L)
 {
@@ -146,69 +239,274 @@ static int luarcu_cloneobject(lua_State *L)
 	return 1;
 }
 
-lunatik_object_t *luarcu_gettable(lunatik_object_t *table, const char *key, size_t keylen)
+/* the reference held by a copied object is handed over to its clone */
+static void luarcu_pushvalue(lua_State *L, luarcu_value_t *value, const char *string)
+{
+	switch (value->type) {
+	case LUA_TUSERDATA:
+		lua_pushcfunction(L, luarcu_cloneobject);
+		lua_pushlightuserdata(L, value->object);
+		if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
+			lunatik_putobject(value->object);
+			lua_error(L);
+		}
+		break;
+	case LUA_TNUMBER:
+		lua_pushinteger(L, value->integer);
+		break;
+	case LUA_TBOOLEAN:
+		lua_pushboolean(L, value->boolean);
+		break;
+	case LUA_TSTRING:
+		lua_pushlstring(L, string, value->length);
+		break;
+	default:
+		lua_pushnil(L);
+		break;
+	}
+}
+
+static inline luarcu_buckets_t *luarcu_newbuckets(size_t size, gfp_t gfp)
+{
+	luarcu_buckets_t *buckets = kvzalloc(struct_size(buckets, hlist, size), gfp);
+
+	if (buckets != NULL)
+		buckets->size = size; /* zeroed heads are empty lists */
+	return buckets;
+}
+
+/* grows while the load factor is over 100% and shrinks while it is under 25%;
+ * thus, a resized table always ends up between 25% and 100% */
+static size_t luarcu_fitsize(luarcu_table_t *table, size_t size)
 {
-	luarcu_table_t *_table = (luarcu_table_t *)table->private;
-	unsigned int index = luarcu_hash(_table, key, keylen);
+	size_t count = (size_t)percpu_counter_sum_positive(&table->count);
+
+	while (count > size && size < LUARCU_MAXSIZE)
+		size <<= 1;
+	while (count < size / 4 && size > table->minsize)
+		size >>= 1;
+	return size;
+}
+
+/* a table handed over by a build might still be rehashed by the resize of its builder; thus,
+ * its buckets are walked as by readers (see luarcu_build()) */
+static void luarcu_rehash(luarcu_buckets_t *old, luarcu_buckets_t *new, size_t bucket)
+{
+	unsigned int version = old->version;
+	luarcu_entry_t *entry;
+
+	hlist_for_each_entry_rcu(entry, &old->hlist[bucket], hlist[version])
+		hlist_add_head_rcu(&entry->hlist[!version], luarcu_bucket(new, entry->hash));
+}
+
+/* a bucket is rehashed under its own lock, unless a build has replaced the bucket array meanwhile;
+ * then, the resize is dropped */
+static bool luarcu_migrate(luarcu_table_t *table, luarcu_buckets_t *old, luarcu_buckets_t *new, size_t bucket)
+{
+	spinlock_t *lock = luarcu_lock(table, bucket);
+	bool migrated;
+
+	spin_lock_bh(lock);
+	rcu_read_lock();
+	if ((migrated = READ_ONCE(table->future) == new)) {
+		luarcu_rehash(old, new, bucket);
+		WRITE_ONCE(table->migrated, bucket + 1);
+	}
+	rcu_read_unlock();
+	spin_unlock_bh(lock);
+	return migrated;
+}
+
+/* writers only wait for the bucket being rehashed, while they also update the buckets that were
+ * already rehashed (see luarcu_set()); thus, a dropped array is only freed after a grace period */
+static void luarcu_resize(struct work_struct *work)
+{
+	luarcu_table_t *table = container_of(work, luarcu_table_t, resize);
+	luarcu_buckets_t *old, *new;
+	size_t size, bucket;
+
+	/* readers and writers of the former bucket array might still walk through the links we are about to reuse */
+	synchronize_rcu();
+
+	rcu_read_lock();
+	old = rcu_dereference(table->buckets);
+	size = luarcu_fitsize(table, old->size);
+	rcu_read_unlock();
+
+	if (size == old->size || (new = luarcu_newbuckets(size, GFP_KERNEL)) == NULL)
+		return;
+
+	write_seqlock_bh(&table->resizing);
+	if (luarcu_buckets(table) != old) {
+		write_sequnlock_bh(&table->resizing);
+		kvfree(new);
+		return;
+	}
+	new->version = !old->version;
+	table->migrated = 0;
+	table->future = new;
+	write_sequnlock_bh(&table->resizing);
+
+	for (bucket = 0; bucket < old->size; bucket++) {
+		if (!luarcu_migrate(table, old, new, bucket))
+			goto drop;
+		if ((bucket + 1) % LUARCU_REHASHCHUNK == 0)
+			cond_resched();
+	}
+
+	write_seqlock_bh(&table->resizing);
+	if (table->future != new) {
+		write_sequnlock_bh(&table->resizing);
+		goto drop;
+	}
+	rcu_assign_pointer(table->buckets, new);
+	table->future = NULL;
+	table->resizes++;
+	write_sequnlock_bh(&table->resizing);
+
+	kvfree_rcu(old, rcu);
+	return;
+drop:
+	kvfree_rcu(new, rcu); /* never published */
+}
+
+/* writers check the approximate count, which is only summed up next to the thresholds */
+static inline void luarcu_checksize(luarcu_table_t *table, size_t size)
+{
+	struct percpu_counter *count = &table->count;
+
+	if ((size < LUARCU_MAXSIZE && __percpu_counter_compare(count, (s64)size, LUARCU_COUNTBATCH) > 0) ||
+	    (size > table->minsize && __percpu_counter_compare(count, (s64)(size / 4), LUARCU_COUNTBATCH) < 0))
+		schedule_work(&table->resize);
+}
+
+LUNATIK_OBJECTCHECKER(luarcu_checktable, luarcu_table_t *);
+
+void luarcu_initkey(luarcu_key_t *key, const char *str, size_t len)
+{
+	key->str = str;
+	key->len = len;
+	key->hash = luarcu_hash(str, len);
+}
+EXPORT_SYMBOL(luarcu_initkey);
+
+lunatik_object_t *luarcu_getkey(lunatik_object_t *table, const luarcu_key_t *key)
+{
+	luarcu_table_t *tab = (luarcu_table_t *)table->private;
 	lunatik_object_t *value = NULL;
 	luarcu_entry_t *entry;
 
 	rcu_read_lock();
-	entry = luarcu_lookup(_table, index, key, keylen);
-	if (entry != NULL) {
+	entry = luarcu_lookup(rcu_dereference(tab->buckets), key);
+	if (entry != NULL && entry->value.type == LUA_TUSERDATA) {
 		/* entry might be released after rcu_read_unlock */
-		value = entry->object; /* thus we need to store object pointer */
+		value = entry->value.object; /* thus we need to store object pointer */
 		lunatik_getobject(value);
 	}
 	rcu_read_unlock();
 	return value;
 }
+EXPORT_SYMBOL(luarcu_getkey);
+
+lunatik_object_t *luarcu_gettable(lunatik_object_t *table, const char *key, size_t keylen)
+{
+	luarcu_key_t k;
+
+	luarcu_initkey(&k, key, keylen);
+	return luarcu_getkey(table, &k);
+}
 EXPORT_SYMBOL(luarcu_gettable);
 
-int luarcu_settable(lunatik_object_t *table, const char *key, size_t keylen, lunatik_object_t *object)
+/* replaces the entry matching `key` by `new`, or removes it when `new` is NULL */
+static void luarcu_set(luarcu_table_t *tab, const luarcu_key_t *key, luarcu_entry_t *new)
 {
-	int ret = 0;
-	luarcu_table_t *tab = (luarcu_table_t *)table->private;
+	spinlock_t *lock = luarcu_lock(tab, key->hash);
+	luarcu_buckets_t *buckets, *future;
 	luarcu_entry_t *old;
-	unsigned int index = luarcu_hash(tab, key, keylen);
+	unsigned int version, seq;
+	size_t size;
 
-	lunatik_lock(table);
+	spin_lock_bh(lock);
 	rcu_read_lock();
-	old = luarcu_lookup(tab, index, key, keylen);
-	rcu_read_unlock();
-	if (object) {
-		luarcu_entry_t *new = luarcu_newentry(key, keylen, object);
-		if (new == NULL) {
-			ret = -ENOMEM;
-			goto unlock;
-		}
 
-		if (!old)
-			hlist_add_head_rcu(&new->hlist, tab->hlist + index);
+	/* both arrays are replaced at once; buckets already rehashed by an ongoing resize are also updated
+	 * on the future array, while the others are left to be rehashed, under this lock, afterwards */
+	do {
+		seq = read_seqbegin(&tab->resizing);
+		buckets = rcu_dereference(tab->buckets);
+		future = READ_ONCE(tab->future);
+	} while (read_seqretry(&tab->resizing, seq));
+	if (future != NULL && (key->hash & luarcu_mask(buckets)) >= READ_ONCE(tab->migrated))
+		future = NULL;
+	version = buckets->version;
+	size = buckets->size;
+
+	old = luarcu_lookup(buckets, key);
+	if (new != NULL) {
+		if (!old) {
+			hlist_add_head_rcu(&new->hlist[version], luarcu_bucket(buckets, key->hash));
+			if (future != NULL)
+				hlist_add_head_rcu(&new->hlist[!version], luarcu_bucket(future, key->hash));
+			percpu_counter_add_batch(&tab->count, 1, LUARCU_COUNTBATCH);
+		}
 		else {
-			hlist_replace_rcu(&old->hlist, &new->hlist);
-			luarcu_free(old);
+			hlist_replace_rcu(&old->hlist[version], &new->hlist[version]);
+			if (future != NULL)
+				hlist_replace_rcu(&old->hlist[!version], &new->hlist[!version]);
 		}
 	}
 	else if (old) {
-		hlist_del_rcu(&old->hlist);
+		hlist_del_rcu(&old->hlist[version]);
+		if (future != NULL)
+			hlist_del_rcu(&old->hlist[!version]);
+		percpu_counter_add_batch(&tab->count, -1, LUARCU_COUNTBATCH);
+	}
+	rcu_read_unlock();
+	spin_unlock_bh(lock);
+
+	if (old != NULL)
 		luarcu_free(old);
+	luarcu_checksize(tab, size);
+}
+
+int luarcu_settable(lunatik_object_t *table, const char *key, size_t keylen, lunatik_object_t *object)
+{
+	luarcu_entry_t *new = NULL;
+	luarcu_key_t k;
+
+	luarcu_initkey(&k, key, keylen);
+	if (object != NULL) {
+		luarcu_value_t value = {.type = LUA_TUSERDATA, .object = object};
+		if ((new = luarcu_newentry(&k, &value, NULL)) == NULL)
+			return -ENOMEM;
 	}
-unlock:
-	lunatik_unlock(table);
-	return ret;
+	luarcu_set((luarcu_table_t *)table->private, &k, new);
+	return 0;
 }
 EXPORT_SYMBOL(luarcu_settable);
 
+/* accepts either strings or key handles */
+static void luarcu_checkkey(lua_State *L, int ix, luarcu_key_t *key)
+{
+	lunatik_object_t *object = lunatik_testobject(L, ix);
+
+	if (object != NULL && object->class == &luarcu_key_class)
+		*key = *(luarcu_key_t *)object->private;
+	else {
+		const char *str = luaL_checklstring(L, ix, &key->len);
+		luarcu_initkey(key, str, key->len);
+	}
+}
+
 /***
-* Retrieves a value (a Lunatik object) from the RCU table.
+* Retrieves a value from the RCU table.
 * This is the Lua `__index` metamethod, allowing table-like access `rcu_table[key]`.
 * Read operations are RCU-protected and lockless.
 * @function __index
 * @tparam rcu_table self The RCU table instance.
-* @tparam string key The key to look up in the table.
-* @treturn lunatik_object The Lunatik object associated with the key, or `nil` if the key is not found.
-*   A new reference to the object is returned.
+* @tparam string|rcu_key key The key to look up in the table.
+* @treturn lunatik_object|integer|boolean|string The value associated with the key, or `nil` if the key is not found.
+*   A new reference is returned for Lunatik objects.
 * @usage
 *  local my_object = my_rcu_table["some_key"]
 *  if my_object then
@@ -217,100 +515,207 @@ EXPORT_SYMBOL(luarcu_settable);
 */
 static int luarcu_index(lua_State *L)
 {
-	lunatik_object_t *table = lunatik_checkobject(L, 1);
-	size_t keylen;
-	const char *key = luaL_checklstring(L, 2, &keylen);
-	lunatik_object_t *value = luarcu_gettable(table, key, keylen);
+	luarcu_table_t *table = luarcu_checktable(L, 1);
+	luarcu_value_t value = {.type = LUA_TNIL};
+	char string[LUARCU_MAXSTRING];
+	luarcu_entry_t *entry;
+	luarcu_key_t key;
 
-	if (value == NULL)
-		lua_pushnil(L);
-	else {
-		lua_pushcfunction(L, luarcu_cloneobject);
-		lua_pushlightuserdata(L, value);
-		if (lua_pcall(L, 1, 1, 0) != LUA_OK) {
-			lunatik_putobject(value);
-			lua_error(L);
-		}
-	}
+	luarcu_checkkey(L, 2, &key);
+	rcu_read_lock();
+	if ((entry = luarcu_lookup(rcu_dereference(table->buckets), &key)) != NULL)
+		luarcu_copyvalue(&entry->value, luarcu_string(entry), &value, string);
+	rcu_read_unlock();
+
+	luarcu_pushvalue(L, &value, string);
 	return 1; /* value */
 }
 
+/* returns the string of string values; otherwise, NULL */
+static const char *luarcu_checkvalue(lua_State *L, int ix, luarcu_value_t *value)
+{
+	const char *string = NULL;
+
+	switch (value->type = lua_type(L, ix)) {
+	case LUA_TNUMBER:
+		value->integer = luaL_checkinteger(L, ix);
+		break;
+	case LUA_TBOOLEAN:
+		value->boolean = lua_toboolean(L, ix);
+		break;
+	case LUA_TSTRING:
+		string = lua_tolstring(L, ix, &value->length);
+		luaL_argcheck(L, value->length <= LUARCU_MAXSTRING, ix, "string too long");
+		break;
+	default:
+		value->type = LUA_TUSERDATA;
+		value->object = lunatik_checkobject(L, ix);
+		break;
+	}
+	return string;
+}
+
+static luarcu_entry_t *luarcu_checkentry(lua_State *L, int ix, const luarcu_key_t *key)
+{
+	luarcu_value_t value;
+	const char *string = luarcu_checkvalue(L, ix, &value);
+	luarcu_entry_t *entry;
+
+	if ((entry = luarcu_newentry(key, &value, string)) == NULL)
+		luaL_error(L, "not enough memory");
+	return entry;
+}
+
 /***
 * Sets or removes a value in the RCU table.
 * This is the Lua `__newindex` metamethod, allowing table-like assignment `rcu_table[key] = value`.
 * Write operations are synchronized.
 * @function __newindex
 * @tparam rcu_table self The RCU table instance.
-* @tparam string key The key to set or update.
-* @tparam lunatik_object|nil value The Lunatik object to associate with the key.
-*   If `nil`, the key-value pair is removed from the table.
+* @tparam string|rcu_key key The key to set or update.
+* @tparam lunatik_object|integer|boolean|string|nil value The value to associate with the key.
+*   Strings are limited to 64 bytes. If `nil`, the key-value pair is removed from the table.
 * @raise Error if memory allocation fails during new entry creation.
 * @usage
 *   local data_obj = data.new(5) -- Assuming 'data' module
 *   my_rcu_table["new_key"] = some_lunatik_object
+*   my_rcu_table["blocked.example"] = true
 *   my_rcu_table["another_key"] = nil -- Removes 'another_key'
 */
 static int luarcu_newindex(lua_State *L)
 {
-	lunatik_object_t *table = lunatik_checkobject(L, 1);
-	size_t keylen;
-	const char *key = luaL_checklstring(L, 2, &keylen);
-	lunatik_object_t *object = luarcu_checkoptnil(L, 3, lunatik_checkobject);
+	luarcu_table_t *table = luarcu_checktable(L, 1);
+	luarcu_entry_t *entry;
+	luarcu_key_t key;
 
-	if (luarcu_settable(table, key, keylen, object) < 0)
-		luaL_error(L, "not enough memory");
+	luarcu_checkkey(L, 2, &key);
+	luaL_argcheck(L, key.len < LUARCU_MAXKEY, 2, "key too long");
+	entry = lua_isnil(L, 3) ? NULL : luarcu_checkentry(L, 3, &key);
+	luarcu_set(table, &key, entry);
 	return 0;
 }
 
+static void luarcu_clear(luarcu_buckets_t *buckets)
+{
+	unsigned int version = buckets->version;
+	size_t bucket;
+
+	for (bucket = 0; bucket < buckets->size; bucket++) {
+		luarcu_entry_t *entry;
+		struct hlist_node *n;
+
+		hlist_for_each_entry_safe(entry, n, &buckets->hlist[bucket], hlist[version]) {
+			hlist_del_rcu(&entry->hlist[version]);
+			luarcu_free(entry);
+		}
+	}
+	kvfree(buckets);
+}
+
+static void luarcu_freework(struct work_struct *work)
+{
+	luarcu_buckets_t *buckets = container_of(to_rcu_work(work), luarcu_buckets_t, free);
+	luarcu_clear(buckets);
+}
+
 static void luarcu_release(void *private)
 {
 	luarcu_table_t *table = (luarcu_table_t *)private;
-	unsigned int bucket;
-	luarcu_entry_t *n, *entry;
+	luarcu_buckets_t *buckets;
 
-	luarcu_foreach(table, bucket, n, entry) {
-		hlist_del_rcu(&entry->hlist);
-		luarcu_free(entry);
-	}
+	cancel_work_sync(&table->resize);
+	percpu_counter_destroy(&table->count);
+	kvfree(table->locks);
+	if ((buckets = rcu_dereference_protected(table->buckets, true)) != NULL)
+		luarcu_clear(buckets);
 }
 
-static inline void luarcu_inittable(luarcu_table_t *table, size_t size)
+/* initializes every field before allocating; thus, it is safe to release a table on failure;
+ * as tables never shrink below their initial size, there are no more locks than buckets */
+static int luarcu_inittable(luarcu_table_t *table, size_t size, gfp_t gfp)
 {
-	__hash_init(table->hlist, size);
-	table->size = size;
-	table->seed = luarcu_seed();
+	unsigned int nlocks = min_t(unsigned int, roundup_pow_of_two(num_possible_cpus() * 4), LUARCU_MAXLOCKS);
+	luarcu_buckets_t *buckets;
+	unsigned int i;
+
+	nlocks = min_t(size_t, nlocks, size);
+	table->minsize = size;
+	table->resizes = 0;
+	seqlock_init(&table->resizing);
+	INIT_WORK(&table->resize, luarcu_resize);
+	RCU_INIT_POINTER(table->buckets, NULL);
+	table->future = NULL;
+	table->migrated = 0;
+	table->locks = NULL;
+
+	if (percpu_counter_init(&table->count, 0, gfp) != 0 ||
+	    (table->locks = kvmalloc_array(nlocks, sizeof(spinlock_t), gfp)) == NULL)
+		return -ENOMEM;
+	for (i = 0; i < nlocks; i++)
+		spin_lock_init(&table->locks[i]);
+	table->lockmask = nlocks - 1;
+
+	buckets = luarcu_newbuckets(size, gfp);
+	RCU_INIT_POINTER(table->buckets, buckets);
+	return buckets == NULL ? -ENOMEM : 0;
+}
+
+/* returns the entry at `pos` on `bucket` (or the first one after it) and advances the cursor;
+ * it must be called inside a read-side critical section */
+static luarcu_entry_t *luarcu_seek(luarcu_table_t *table, size_t *bucket, size_t *pos)
+{
+	luarcu_buckets_t *buckets = rcu_dereference(table->buckets);
+	unsigned int version = buckets->version;
+
+	for (; *bucket < buckets->size; (*bucket)++, *pos = 0) {
+		luarcu_entry_t *entry;
+		size_t i = 0;
+
+		hlist_for_each_entry_rcu(entry, &buckets->hlist[*bucket], hlist[version])
+			if (i++ == *pos) {
+				(*pos)++;
+				return entry;
+			}
+	}
+	return NULL;
 }
 
 static int luarcu_map_handle(lua_State *L)
 {
 	const char *key = (const char *)lua_touserdata(L, 2);
-	lunatik_object_t *value = (lunatik_object_t *)lua_touserdata(L, 3);
+	luarcu_value_t *value = (luarcu_value_t *)lua_touserdata(L, 3);
+	const char *string = (const char *)lua_touserdata(L, 4);
 
 	BUG_ON(!key || !value);
 
-	lua_pop(L, 2); /* key, value */
+	lua_pop(L, 3); /* key, value, string */
 
 	lua_pushstring(L, key);
-	lunatik_pushobject(L, value);
+	if (value->type == LUA_TUSERDATA)
+		lunatik_getobject(value->object); /* the clone holds its own reference */
+	luarcu_pushvalue(L, value, string);
 	lua_call(L, 2, 0);
 
 	return 0;
 }
 
-static inline int luarcu_map_call(lua_State *L, int cb, const char *key, lunatik_object_t *value)
+static inline int luarcu_map_call(lua_State *L, int cb, const char *key, luarcu_value_t *value, const char *string)
 {
 	lua_pushcfunction(L, luarcu_map_handle);
 	lua_pushvalue(L, cb);
 	lua_pushlightuserdata(L, (void *)key);
 	lua_pushlightuserdata(L, value);
+	lua_pushlightuserdata(L, (void *)string);
 
-	return lua_pcall(L, 3, 0, 0); /* handle(cb, key, value) */
+	return lua_pcall(L, 4, 0, 0); /* handle(cb, key, value, string) */
 }
 
 /***
 * Iterates over the RCU table and calls a callback for each key-value pair.
-* The iteration is RCU-protected. The order of iteration is not guaranteed.
-* For each entry, a new reference to the value (Lunatik object) is obtained
+* The iteration is RCU-protected. The order of iteration is not guaranteed;
+* moreover, if the table is resized during the iteration, entries might be
+* visited more than once or skipped.
+* For each entry holding a Lunatik object, a new reference to the object is obtained
 * before calling the callback and released after the callback returns.
 *
 * @function map
@@ -319,7 +724,7 @@ static inline int luarcu_map_call(lua_State *L, int cb, const char *key, lunatik
 *   The callback receives two arguments:
 *
 *   1. `key` (string): The key of the current entry.
-*   2. `value` (lunatik_object): The Lunatik object associated with the key.
+*   2. `value` (lunatik_object|integer|boolean|string): The value associated with the key.
 *
 * @treturn nil
 * @raise Error if the callback function raises an error during its execution.
@@ -334,41 +739,272 @@ static inline int luarcu_map_call(lua_State *L, int cb, const char *key, lunatik
 static int luarcu_map(lua_State *L)
 {
 	luarcu_table_t *table = luarcu_checktable(L, 1);
-	unsigned int bucket;
-	luarcu_entry_t *n, *entry;
+	size_t bucket = 0, pos = 0;
 
 	luaL_checktype(L, 2, LUA_TFUNCTION); /* cb */
 	lua_remove(L, 1); /* table */
 
-	rcu_read_lock();
-	luarcu_foreach(table, bucket, n, entry) {
+	for (;;) {
 		char key[LUARCU_MAXKEY];
+		char string[LUARCU_MAXSTRING];
+		luarcu_value_t value;
+		luarcu_entry_t *entry;
+		int ret;
 
-		strncpy(key, entry->key, LUARCU_MAXKEY);
-		key[LUARCU_MAXKEY - 1] = '\0';
-		lunatik_object_t *value = entry->object;
-		lunatik_getobject(value);
-
+		rcu_read_lock();
+		if ((entry = luarcu_seek(table, &bucket, &pos)) == NULL) {
+			rcu_read_unlock();
+			break;
+		}
+		memcpy(key, entry->key, entry->keylen + 1);
+		luarcu_copyvalue(&entry->value, luarcu_string(entry), &value, string);
 		rcu_read_unlock();
-		int ret = luarcu_map_call(L, 1, key, value);
-		lunatik_putobject(value);
+
+		if (lunatik_toruntime(L)->sleep)
+			cond_resched(); /* safe point: we are out of the read-side critical section */
+		ret = luarcu_map_call(L, 1, key, &value, string);
+		if (value.type == LUA_TUSERDATA)
+			lunatik_putobject(value.object);
 		if (ret != LUA_OK)
 			lua_error(L);
-		rcu_read_lock();
 	}
+	return 0;
+}
+
+/* slots are packed into the cursor buffer, each one sized to fit its own key (and string value) */
+typedef struct luarcu_slot_s {
+	luarcu_value_t value;
+	size_t keylen;
+	char key[]; /* string values are stored right after the key */
+} luarcu_slot_t;
+
+#define luarcu_slotsize(keylen, length)	\
+	ALIGN(offsetof(luarcu_slot_t, key) + (keylen) + (length), __alignof__(luarcu_slot_t))
+#define luarcu_slotlength(cursor, slot)	\
+	(!(cursor)->keyonly && (slot)->value.type == LUA_TSTRING ? (slot)->value.length : 0)
+#define luarcu_nextslot(cursor, slot)	\
+	((luarcu_slot_t *)((char *)(slot) + luarcu_slotsize((slot)->keylen, luarcu_slotlength((cursor), (slot)))))
+
+/* object references held by slots from `slot` on (i.e., [next, count)) are owned by the cursor */
+typedef struct luarcu_cursor_s {
+	luarcu_table_t *table;
+	size_t bucket;
+	size_t pos;
+	unsigned int batch;
+	unsigned int count;
+	unsigned int next;
+	bool keyonly;
+	luarcu_slot_t *slot;
+	size_t size;
+	u8 buffer[] __aligned(__alignof__(luarcu_slot_t));
+} luarcu_cursor_t;
+
+#define luarcu_firstslot(cursor)	((luarcu_slot_t *)(cursor)->buffer)
+
+/* copies the next batch of entries (as many as fit in the cursor) within a single read-side critical section */
+static unsigned int luarcu_fetch(luarcu_cursor_t *cursor)
+{
+	luarcu_slot_t *slot = luarcu_firstslot(cursor);
+	luarcu_buckets_t *buckets;
+	unsigned int version, n = 0;
+	size_t used = 0;
+
+	rcu_read_lock();
+	buckets = rcu_dereference(cursor->table->buckets);
+	version = buckets->version;
+	for (; cursor->bucket < buckets->size; cursor->bucket++, cursor->pos = 0) {
+		luarcu_entry_t *entry;
+		size_t i = 0;
+
+		hlist_for_each_entry_rcu(entry, &buckets->hlist[cursor->bucket], hlist[version]) {
+			size_t length, size;
+
+			if (i++ < cursor->pos)
+				continue;
+
+			length = !cursor->keyonly && entry->value.type == LUA_TSTRING ? entry->value.length : 0;
+			size = luarcu_slotsize(entry->keylen, length);
+			if (n == cursor->batch || used + size > cursor->size)
+				goto out;
+
+			slot->keylen = entry->keylen;
+			memcpy(slot->key, entry->key, entry->keylen);
+			slot->value.type = LUA_TNIL;
+			if (!cursor->keyonly)
+				luarcu_copyvalue(&entry->value, luarcu_string(entry), &slot->value, slot->key + slot->keylen);
+			slot = luarcu_nextslot(cursor, slot);
+			used += size;
+			cursor->pos++;
+			n++;
+		}
+	}
+out:
 	rcu_read_unlock();
+	cursor->count = n;
+	cursor->next = 0;
+	cursor->slot = luarcu_firstslot(cursor);
+	return n;
+}
+
+static int luarcu_next(lua_State *L)
+{
+	luarcu_cursor_t *cursor = (luarcu_cursor_t *)luaL_checkudata(L, 1, LUARCU_CURSOR);
+	luarcu_slot_t *slot;
+
+	if (cursor->next == cursor->count) {
+		if (lunatik_toruntime(L)->sleep)
+			cond_resched(); /* safe point: we are out of the read-side critical section */
+		if (luarcu_fetch(cursor) == 0)
+			return 0;
+	}
+
+	slot = cursor->slot;
+	cursor->slot = luarcu_nextslot(cursor, slot);
+	cursor->next++;
+	if (cursor->keyonly) {
+		lua_pushlstring(L, slot->key, slot->keylen);
+		return 1;
+	}
+
+	luarcu_pushvalue(L, &slot->value, slot->key + slot->keylen); /* consumes the object reference */
+	lua_pushlstring(L, slot->key, slot->keylen);
+	lua_insert(L, -2);
+	return 2;
+}
+
+static int luarcu_closecursor(lua_State *L)
+{
+	luarcu_cursor_t *cursor = (luarcu_cursor_t *)luaL_checkudata(L, 1, LUARCU_CURSOR);
+
+	for (; cursor->next < cursor->count; cursor->next++) {
+		luarcu_slot_t *slot = cursor->slot;
+
+		cursor->slot = luarcu_nextslot(cursor, slot);
+		if (slot->value.type == LUA_TUSERDATA)
+			lunatik_putobject(slot->value.object);
+	}
+	cursor->bucket = SIZE_MAX; /* done */
 	return 0;
 }
 
+static const luaL_Reg luarcu_cursor_mt[] = {
+	{"__gc", luarcu_closecursor},
+	{"__close", luarcu_closecursor},
+	{NULL, NULL}
+};
+
+/***
+* Iterates over the RCU table in batches.
+* Entries are copied a batch at a time, within a single RCU read-side critical
+* section, and handed over one by one; thus, unlike `map`, there is no call
+* per entry. The iteration resumes from a bucket cursor; as in `map`, the
+* order is not guaranteed and, if the table is resized or changed during the
+* iteration, entries might be visited more than once or skipped.
+* This function is also the `__pairs` metamethod of RCU tables.
+*
+* @function pairs
+* @tparam rcu_table table The RCU table instance.
+* @tparam[opt=64] integer batch The maximum number of entries copied at a time;
+*   batches are also capped by the size of their keys and values (16 KiB).
+* @tparam[opt=false] boolean keyonly Whether only keys are returned; thus,
+*   values (and their object references) aren't copied at all.
+* @treturn function An iterator that returns the key and the value of each entry
+*   (or only the key).
+* @usage
+*   for key, value in rcu.pairs(my_rcu_table) do print(key, value) end
+*   for key in rcu.pairs(my_rcu_table, 256, true) do print(key) end
+* @within rcu
+*/
+static int luarcu_pairs(lua_State *L)
+{
+	luarcu_table_t *table = luarcu_checktable(L, 1);
+	lua_Integer batch = luaL_optinteger(L, 2, LUARCU_BATCH);
+	bool keyonly = lua_toboolean(L, 3);
+	luarcu_cursor_t *cursor;
+	size_t size;
+
+	luaL_argcheck(L, batch > 0 && batch <= LUARCU_MAXBATCH, 2, "invalid batch size");
+
+	/* buffers are capped by bytes, but they always fit the largest entry */
+	size = min_t(size_t, batch * luarcu_slotsize(LUARCU_SLOTHINT, 0), LUARCU_MAXCURSOR);
+	size = max_t(size_t, size, luarcu_slotsize(LUARCU_MAXKEY, keyonly ? 0 : LUARCU_MAXSTRING));
+
+	lua_pushcfunction(L, luarcu_next);
+	cursor = (luarcu_cursor_t *)lua_newuserdatauv(L, sizeof(luarcu_cursor_t) + size, 1);
+	cursor->table = table;
+	cursor->size = size;
+	cursor->slot = luarcu_firstslot(cursor);
+	cursor->bucket = 0;
+	cursor->pos = 0;
+	cursor->batch = (unsigned int)batch;
+	cursor->count = 0;
+	cursor->next = 0;
+	cursor->keyonly = keyonly;
+
+	lua_pushvalue(L, 1);
+	lua_setiuservalue(L, -2, 1); /* keeps the table alive */
+	if (luaL_newmetatable(L, LUARCU_CURSOR))
+		luaL_setfuncs(L, luarcu_cursor_mt, 0);
+	lua_setmetatable(L, -2);
+
+	lua_pushnil(L); /* initial value */
+	lua_pushvalue(L, -2); /* closing value */
+	return 4;
+}
+
+/***
+* Returns the occupancy statistics of the RCU table.
+* @function stats
+* @tparam rcu_table table The RCU table instance.
+* @treturn table A table with the fields:
+*
+*   - `entries`: number of stored entries.
+*   - `buckets`: current number of buckets.
+*   - `load`: load factor, as a percentage (`entries * 100 / buckets`).
+*   - `resizes`: number of times the table was resized.
+*
+* @usage
+*   local s = rcu.stats(my_rcu_table)
+*   print(s.entries, s.buckets, s.load .. "%")
+* @within rcu
+*/
+static int luarcu_stats(lua_State *L)
+{
+	luarcu_table_t *table = luarcu_checktable(L, 1);
+	size_t entries = (size_t)percpu_counter_sum_positive(&table->count);
+	size_t buckets;
+
+	rcu_read_lock();
+	buckets = rcu_dereference(table->buckets)->size;
+	rcu_read_unlock();
+
+	lua_createtable(L, 0, 4);
+	lua_pushinteger(L, (lua_Integer)entries);
+	lua_setfield(L, -2, "entries");
+	lua_pushinteger(L, (lua_Integer)buckets);
+	lua_setfield(L, -2, "buckets");
+	lua_pushinteger(L, (lua_Integer)(entries * 100 / buckets));
+	lua_setfield(L, -2, "load");
+	lua_pushinteger(L, (lua_Integer)READ_ONCE(table->resizes));
+	lua_setfield(L, -2, "resizes");
+	return 1;
+}
+
 static const struct luaL_Reg luarcu_lib[] = {
 	{"table", luarcu_table},
 	{"map", luarcu_map},
+	{"pairs", luarcu_pairs},
+	{"stats", luarcu_stats},
+	{"build", luarcu_build},
+	{"key", luarcu_key},
+	{"lpm", luarcu_lpm},
 	{NULL, NULL}
 };
 
 static const struct luaL_Reg luarcu_mt[] = {
 	{"__newindex", luarcu_newindex},
 	{"__index", luarcu_index},
+	{"__pairs", luarcu_pairs},
 	{"__gc", lunatik_deleteobject},
 	{NULL, NULL}
 };
@@ -383,9 +1019,14 @@ lunatik_object_t *luarcu_newtable(size_t size, bool sleep)
 {
 	lunatik_object_t *object;
 
-	size = roundup_pow_of_two(size);
-	if ((object = lunatik_createobject(&luarcu_class, luarcu_sizeoftable(size), sleep))!= NULL)
-		luarcu_inittable((luarcu_table_t *)object->private, size);
+	size = roundup_pow_of_two(clamp_val(size, 1, LUARCU_MAXSIZE));
+	if ((object = lunatik_createobject(&luarcu_class, sizeof(luarcu_table_t), sleep)) == NULL)
+		return NULL;
+
+	if (luarcu_inittable((luarcu_table_t *)object->private, size, lunatik_gfp(object)) != 0) {
+		lunatik_putobject(object);
+		return NULL;
+	}
 	return object;
 }
 EXPORT_SYMBOL(luarcu_newtable);
@@ -393,40 +1034,568 @@ EXPORT_SYMBOL(luarcu_newtable);
 /***
 * Creates a new RCU-synchronized hash table.
 * @function table
-* @tparam[opt=1024] integer size Specifies the initial number of hash buckets (internal slots) for the table.
+* @tparam[opt=256] integer size Specifies the initial number of hash buckets (internal slots) for the table.
 *   This is **not** a hard limit on the number of entries the table can store.
 *   The provided `size` will be rounded up to the nearest power of two.
-*   Choosing an appropriate `size` involves a trade-off between memory usage and performance:
 *
-*   - more buckets (larger `size`): Consumes more memory for the table structure itself,
-*     even if many buckets remain empty. However, it reduces the probability of hash collisions,
-*     which can significantly speed up operations (lookups, insertions, deletions),
-*     especially when storing a large number of entries.
-*   - fewer buckets (smaller `size`): Uses less memory for the table's internal array.
-*     However, if the number of entries is high relative to the number of buckets,
-*     it increases the chance of hash collisions. This means more entries might end up
-*     in the same bucket, forming longer linked lists that need to be traversed,
-*     thereby slowing down operations.
-*
-*   **Guidance**: For optimal performance, aim for a `size` that is roughly in the order of,
-*   or somewhat larger than, the maximum number of entries you anticipate storing. This helps
-*   maintain a low average number of entries per bucket (a low "load factor," ideally close to 1).
-*   The table can hold more entries than its `size` (number of buckets), but performance
-*   will degrade as the load factor increases. The default is a general-purpose starting point
-*   suitable for many common use cases.
+*   The table doubles its buckets whenever it holds more entries than buckets
+*   and halves them whenever it holds less than a quarter, but it never shrinks
+*   below the initial `size`. Resizes run on a worker; meanwhile, lookups keep
+*   using the former buckets. Thus, a `size` close to the expected number of
+*   entries avoids resizes altogether, while a small `size` saves memory for
+*   tables that are usually small.
 * @treturn rcu_table A new RCU table object, or raises an error if memory allocation fails.
 * @usage
-*   local my_rcu_table = rcu.table() -- Default: 1024 buckets, good for moderate entries.
-*   local small_table = rcu.table(128) -- 128 buckets, for fewer expected entries.
+*   local my_rcu_table = rcu.table() -- Default: 256 buckets, grows as needed.
 *   local large_table = rcu.table(8192) -- 8192 buckets, for many expected entries.
+* @see stats
 * @within rcu
 */
 static int luarcu_table(lua_State *L)
 {
-	size_t size = roundup_pow_of_two(luaL_optinteger(L, 1, LUARCU_DEFAULT_SIZE));
-	lunatik_object_t *object = lunatik_newobject(L, &luarcu_class, luarcu_sizeoftable(size));
+	lua_Integer size = luaL_optinteger(L, 1, LUARCU_DEFAULT_SIZE);
+	lunatik_object_t *object;
+
+	luaL_argcheck(L, size > 0 && size <= LUARCU_MAXSIZE, 1, "out of bounds");
+	object = lunatik_newobject(L, &luarcu_class, sizeof(luarcu_table_t));
+	if (luarcu_inittable((luarcu_table_t *)object->private, roundup_pow_of_two(size),
+		lunatik_gfp(lunatik_toruntime(L))) != 0)
+		luaL_error(L, "not enough memory");
+	return 1; /* object */
+}
+
+/***
+* Builds a new generation of an RCU table and publishes it at once.
+* The builder function receives a new, private RCU table to populate. When it
+* returns, the entries of the builder replace every entry of `table` through a
+* single `rcu_assign_pointer`; thus, readers see either the former or the new
+* generation, but never a partially updated table. The former generation is
+* released after a grace period. The builder is left empty and must not be
+* shared while building; writes to `table` issued during the build are lost.
+* @function build
+* @tparam rcu_table table The RCU table to be replaced.
+* @tparam function builder A function receiving the new table to be populated.
+* @raise Error if the builder raises an error (then, `table` is kept untouched)
+*   or if memory allocation fails.
+* @usage
+*   rcu.build(blocklist, function(t)
+*     for _, domain in ipairs(domains) do
+*       t[domain] = true
+*     end
+*   end)
+* @within rcu
+*/
+static int luarcu_build(lua_State *L)
+{
+	luarcu_table_t *table = luarcu_checktable(L, 1);
+	gfp_t gfp = lunatik_gfp(lunatik_toruntime(L));
+	luarcu_buckets_t *empty, *old, *new;
+	lunatik_object_t *object;
+	luarcu_table_t *builder;
+	s64 count;
+
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+	lua_settop(L, 2);
+	object = lunatik_newobject(L, &luarcu_class, sizeof(luarcu_table_t));
+	builder = (luarcu_table_t *)object->private;
+	if (luarcu_inittable(builder, table->minsize, gfp) != 0)
+		luaL_error(L, "not enough memory");
+
+	lua_pushvalue(L, 2); /* builder function */
+	lua_pushvalue(L, 3); /* builder table */
+	lua_call(L, 1, 0);
+
+	if ((empty = luarcu_newbuckets(1, gfp)) == NULL)
+		luaL_error(L, "not enough memory");
+
+	write_seqlock_bh(&builder->resizing);
+	new = luarcu_buckets(builder);
+	rcu_assign_pointer(builder->buckets, empty);
+	builder->future = NULL;
+	write_sequnlock_bh(&builder->resizing);
+	count = percpu_counter_sum(&builder->count);
+	percpu_counter_set(&builder->count, 0);
+
+	write_seqlock_bh(&table->resizing);
+	old = luarcu_buckets(table);
+	rcu_assign_pointer(table->buckets, new);
+	table->future = NULL; /* drops an ongoing resize */
+	write_sequnlock_bh(&table->resizing);
+	percpu_counter_set(&table->count, count);
+	luarcu_checksize(table, new->size);
+
+	INIT_RCU_WORK(&old->free, luarcu_freework);
+	queue_rcu_work(luarcu_wq, &old->free);
+	return 0;
+}
+
+/***
+* Represents a key handle.
+* This is a userdata object returned by `rcu.key()`. It can be used instead of
+* a string to index any RCU table, skipping the hashing of the key.
+* @type rcu_key
+*/
+typedef struct luarcu_handle_s {
+	luarcu_key_t key;
+	char str[];
+} luarcu_handle_t;
+
+static int luarcu_key_tostring(lua_State *L)
+{
+	luarcu_key_t *key = (luarcu_key_t *)lunatik_toobject(L, 1)->private;
+	lua_pushlstring(L, key->str, key->len);
+	return 1;
+}
+
+static const luaL_Reg luarcu_key_mt[] = {
+	{"__gc", lunatik_deleteobject},
+	{"__tostring", luarcu_key_tostring},
+	{NULL, NULL}
+};
+
+/* key handles are immutable; thus, they aren't monitored */
+static const lunatik_class_t luarcu_key_class = {
+	.name = "rcu.key",
+	.methods = luarcu_key_mt,
+	.sleep = false,
+};
+
+/***
+* Creates a key handle, which caches the hash of a key.
+* @function key
+* @tparam string key The key.
+* @treturn rcu_key A new key handle.
+* @usage
+*   local RUNTIMES = rcu.key("runtimes")
+*   local runtimes = lunatik._ENV[RUNTIMES]
+* @within rcu
+*/
+static int luarcu_key(lua_State *L)
+{
+	size_t len;
+	const char *str = luaL_checklstring(L, 1, &len);
+	lunatik_object_t *object;
+	luarcu_handle_t *handle;
+
+	luaL_argcheck(L, len < LUARCU_MAXKEY, 1, "key too long");
+	lunatik_checkclass(L, &luarcu_key_class);
+	if (luaL_getmetatable(L, luarcu_key_class.name) == LUA_TNIL)
+		lunatik_newclass(L, &luarcu_key_class);
+	lua_pop(L, 1);
+
+	object = lunatik_newobject(L, &luarcu_key_class, struct_size(handle, str, len + 1));
+	handle = (luarcu_handle_t *)object->private;
+	memcpy(handle->str, str, len);
+	handle->str[len] = '\0';
+	luarcu_initkey(&handle->key, handle->str, len);
+	return 1; /* object */
+}
+
+/***
+* Represents a longest-prefix-match (LPM) table.
+* This is a userdata object returned by `rcu.lpm()`. It maps IPv4 or IPv6 prefixes
+* to values (the same kinds of values stored by RCU tables) on a path-compressed
+* binary trie; thus, a lookup visits at most one node per address bit, regardless
+* of the number of prefixes. Lookups are lockless and might be issued from
+* atomic hooks; inserts and deletes are serialized by a spinlock.
+*
+* Addresses are given either as binary strings in network byte order (4 or 16
+* bytes), as `data` objects followed by the offset of the address, or, for IPv4,
+* as integers (e.g., as returned by `net.aton()`).
+* @type rcu_lpm
+*/
+#define LUARCU_LPM_MAXLEN	(16)
+#define LUARCU_LPM_INTERMEDIATE	(0x1)
+
+typedef struct luarcu_lpmnode_s {
+	struct luarcu_lpmnode_s __rcu *child[2];
+	struct rcu_head rcu;
+	luarcu_value_t value;
+	unsigned int prefixlen;
+	unsigned int flags;
+	u8 addr[LUARCU_LPM_MAXLEN];
+	char string[];
+} luarcu_lpmnode_t;
+
+typedef struct luarcu_lpmtable_s {
+	luarcu_lpmnode_t __rcu *root;
+	size_t count;
+	size_t len; /* address length in bytes */
+	unsigned int maxprefixlen;
+	spinlock_t lock;
+} luarcu_lpmtable_t;
+
+static const lunatik_class_t luarcu_lpm_class;
+
+#define luarcu_lpm_bit(addr, i)		(!!((addr)[(i) / 8] & (1 << (7 - ((i) % 8)))))
+#define luarcu_lpm_deref(lpm, p)	rcu_dereference_protected((p), lockdep_is_held(&(lpm)->lock))
+
+static inline luarcu_lpmtable_t *luarcu_lpm_check(lua_State *L, int ix)
+{
+	lunatik_object_t *object = lunatik_checkobject(L, ix);
+	luaL_argcheck(L, object->class == &luarcu_lpm_class, ix, "lpm expected");
+	return (luarcu_lpmtable_t *)object->private;
+}
+
+/* number of leading bits shared by `node` and `addr`, up to `prefixlen` */
+static unsigned int luarcu_lpm_match(const luarcu_lpmnode_t *node, const u8 *addr, unsigned int prefixlen)
+{
+	unsigned int limit = min(node->prefixlen, prefixlen);
+	unsigned int i, bits = 0;
+
+	for (i = 0; bits < limit; i++, bits += 8) {
+		u8 diff = node->addr[i] ^ addr[i];
+		if (diff != 0)
+			return min(limit, bits + 7 - __fls(diff));
+	}
+	return limit;
+}
+
+static luarcu_lpmnode_t *luarcu_lpm_newnode(const u8 *addr, size_t len, unsigned int prefixlen,
+	const luarcu_value_t *value, const char *string, gfp_t gfp)
+{
+	size_t length = value != NULL && value->type == LUA_TSTRING ? value->length : 0;
+	luarcu_lpmnode_t *node = kzalloc(struct_size(node, string, length), gfp | __GFP_NOWARN);
+
+	if (node == NULL)
+		return NULL;
+
+	memcpy(node->addr, addr, len);
+	node->prefixlen = prefixlen;
+	if (value == NULL) {
+		node->flags = LUARCU_LPM_INTERMEDIATE;
+		node->value.type = LUA_TNIL;
+		return node;
+	}
+
+	node->value = *value;
+	if (value->type == LUA_TUSERDATA)
+		lunatik_getobject(value->object);
+	else if (length > 0)
+		memcpy(node->string, string, length);
+	return node;
+}
+
+static void luarcu_lpm_freenode(luarcu_lpmnode_t *node)
+{
+	if (node->value.type == LUA_TUSERDATA)
+		lunatik_putobject(node->value.object);
+	kfree(node);
+}
+
+/* readers might be copying the value of a node; thus, it is only released after a grace period */
+static void luarcu_lpm_freercu(struct rcu_head *rcu)
+{
+	luarcu_lpm_freenode(container_of(rcu, luarcu_lpmnode_t, rcu));
+}
+
+#define luarcu_lpm_free(node)	call_rcu(&(node)->rcu, luarcu_lpm_freercu)
+
+static void luarcu_lpm_checkaddr(lua_State *L, int ix, luarcu_lpmtable_t *lpm, u8 *addr)
+{
+	const char *ptr;
+	size_t len;
+
+	if (lpm->len == sizeof(__be32) && lua_isinteger(L, ix)) {
+		__be32 ip = htonl((u32)lua_tointeger(L, ix));
+		memcpy(addr, &ip, sizeof(ip));
+		return;
+	}
+	else if (lua_isuserdata(L, ix)) { /* only the address is read from packets */
+		lua_Integer offset = luaL_checkinteger(L, ix + 1);
+		luaL_argcheck(L, offset >= 0, ix + 1, "out of bounds");
+		luadata_checkcopy(L, ix, offset, addr, lpm->len);
+		return;
+	}
+
+	luaL_argcheck(L, (ptr = lua_tolstring(L, ix, &len)) != NULL, ix, "address expected");
+	luaL_argcheck(L, len == lpm->len, ix, "invalid address length");
+	memcpy(addr, ptr, lpm->len);
+}
+
+static unsigned int luarcu_lpm_checkprefix(lua_State *L, luarcu_lpmtable_t *lpm, u8 *addr)
+{
+	lua_Integer prefixlen;
+	unsigned int i;
+
+	luaL_argcheck(L, !lua_isuserdata(L, 2), 2, "address expected");
+	luarcu_lpm_checkaddr(L, 2, lpm, addr);
+	prefixlen = luaL_checkinteger(L, 3);
+	luaL_argcheck(L, prefixlen >= 0 && prefixlen <= lpm->maxprefixlen, 3, "invalid prefix length");
+
+	for (i = prefixlen; i < lpm->maxprefixlen; i++) /* host bits */
+		addr[i / 8] &= ~(1 << (7 - (i % 8)));
+	return (unsigned int)prefixlen;
+}
+
+/***
+* Inserts or replaces the value of a prefix.
+* @function insert
+* @tparam string|integer prefix The prefix address.
+* @tparam integer length The prefix length in bits.
+* @tparam lunatik_object|integer|boolean|string value The value associated with the prefix.
+* @raise Error if the prefix is invalid or if memory allocation fails.
+* @usage
+*   deny:insert(net.aton("10.0.0.0"), 8, true)
+*/
+static int luarcu_lpm_insert(lua_State *L)
+{
+	luarcu_lpmtable_t *lpm = luarcu_lpm_check(L, 1);
+	luarcu_lpmnode_t *new, *im, *node;
+	luarcu_lpmnode_t __rcu **slot;
+	u8 addr[LUARCU_LPM_MAXLEN];
+	unsigned int prefixlen = luarcu_lpm_checkprefix(L, lpm, addr);
+	unsigned int matchlen = 0;
+	gfp_t gfp = lunatik_gfp(lunatik_toruntime(L));
+	luarcu_value_t value;
+	const char *string;
+
+	luaL_checkany(L, 4);
+	string = luarcu_checkvalue(L, 4, &value);
+
+	new = luarcu_lpm_newnode(addr, lpm->len, prefixlen, &value, string, gfp);
+	im = luarcu_lpm_newnode(addr, lpm->len, 0, NULL, NULL, gfp);
+	if (new == NULL || im == NULL) {
+		if (new != NULL)
+			luarcu_lpm_freenode(new);
+		kfree(im);
+		luaL_error(L, "not enough memory");
+	}
+
+	spin_lock_bh(&lpm->lock);
+	for (slot = &lpm->root; (node = luarcu_lpm_deref(lpm, *slot)) != NULL;
+		slot = &node->child[luarcu_lpm_bit(addr, node->prefixlen)]) {
+		matchlen = luarcu_lpm_match(node, addr, prefixlen);
+		if (node->prefixlen != matchlen || node->prefixlen == prefixlen ||
+			node->prefixlen == lpm->maxprefixlen)
+			break;
+	}
+
+	if (node == NULL) /* empty slot */
+		rcu_assign_pointer(*slot, new);
+	else if (node->prefixlen == matchlen && node->prefixlen == prefixlen) { /* same prefix */
+		RCU_INIT_POINTER(new->child[0], luarcu_lpm_deref(lpm, node->child[0]));
+		RCU_INIT_POINTER(new->child[1], luarcu_lpm_deref(lpm, node->child[1]));
+		rcu_assign_pointer(*slot, new);
+		if (!(node->flags & LUARCU_LPM_INTERMEDIATE))
+			lpm->count--;
+		luarcu_lpm_free(node);
+	}
+	else if (matchlen == prefixlen) { /* new prefix contains the node */
+		RCU_INIT_POINTER(new->child[luarcu_lpm_bit(node->addr, matchlen)], node);
+		rcu_assign_pointer(*slot, new);
+	}
+	else { /* they diverge at `matchlen`; thus, we need an intermediate node */
+		im->prefixlen = matchlen;
+		memcpy(im->addr, node->addr, lpm->len);
+		RCU_INIT_POINTER(im->child[luarcu_lpm_bit(addr, matchlen)], new);
+		RCU_INIT_POINTER(im->child[!luarcu_lpm_bit(addr, matchlen)], node);
+		rcu_assign_pointer(*slot, im);
+		im = NULL;
+	}
+	lpm->count++;
+	spin_unlock_bh(&lpm->lock);
+
+	kfree(im); /* unused */
+	return 0;
+}
+
+/***
+* Deletes a prefix.
+* @function delete
+* @tparam string|integer prefix The prefix address.
+* @tparam integer length The prefix length in bits.
+* @treturn boolean `true` if the prefix was found; otherwise, `false`.
+* @raise Error if memory allocation fails.
+*/
+static int luarcu_lpm_delete(lua_State *L)
+{
+	luarcu_lpmtable_t *lpm = luarcu_lpm_check(L, 1);
+	luarcu_lpmnode_t __rcu **trim, **trim2;
+	luarcu_lpmnode_t *node, *parent = NULL;
+	u8 addr[LUARCU_LPM_MAXLEN];
+	unsigned int prefixlen = luarcu_lpm_checkprefix(L, lpm, addr);
+	unsigned int matchlen = 0;
+	luarcu_lpmnode_t *im;
+	bool found = false;
+
+	/* a node with two children turns into an intermediate one */
+	if ((im = luarcu_lpm_newnode(addr, lpm->len, 0, NULL, NULL, lunatik_gfp(lunatik_toruntime(L)))) == NULL)
+		luaL_error(L, "not enough memory");
+
+	spin_lock_bh(&lpm->lock);
+	for (trim = trim2 = &lpm->root; (node = luarcu_lpm_deref(lpm, *trim)) != NULL;
+		trim2 = trim, trim = &node->child[luarcu_lpm_bit(addr, node->prefixlen)]) {
+		matchlen = luarcu_lpm_match(node, addr, prefixlen);
+		if (node->prefixlen != matchlen || node->prefixlen == prefixlen)
+			break;
+		parent = node;
+	}
+
+	if (node == NULL || node->prefixlen != prefixlen || node->prefixlen != matchlen ||
+		(node->flags & LUARCU_LPM_INTERMEDIATE))
+		goto unlock;
 
-	luarcu_inittable((luarcu_table_t *)object->private, size);
+	found = true;
+	lpm->count--;
+	if (rcu_access_pointer(node->child[0]) != NULL && rcu_access_pointer(node->child[1]) != NULL) {
+		im->prefixlen = node->prefixlen;
+		memcpy(im->addr, node->addr, lpm->len);
+		RCU_INIT_POINTER(im->child[0], luarcu_lpm_deref(lpm, node->child[0]));
+		RCU_INIT_POINTER(im->child[1], luarcu_lpm_deref(lpm, node->child[1]));
+		rcu_assign_pointer(*trim, im);
+		im = NULL;
+	}
+	else if (parent != NULL && (parent->flags & LUARCU_LPM_INTERMEDIATE) &&
+		rcu_access_pointer(node->child[0]) == NULL && rcu_access_pointer(node->child[1]) == NULL) {
+		/* the intermediate parent is no longer needed; thus, the sibling takes its place */
+		rcu_assign_pointer(*trim2, luarcu_lpm_deref(lpm, parent->child[trim == &parent->child[0]]));
+		luarcu_lpm_free(parent);
+	}
+	else
+		rcu_assign_pointer(*trim, luarcu_lpm_deref(lpm, node->child[rcu_access_pointer(node->child[0]) == NULL]));
+	luarcu_lpm_free(node);
+unlock:
+	spin_unlock_bh(&lpm->lock);
+
+	kfree(im);
+	lua_pushboolean(L, found);
+	return 1;
+}
+
+/***
+* Looks the longest prefix matching an address up.
+* The lookup is lockless.
+* @function lookup
+* @tparam string|integer|data addr The address; if it is a `data` object,
+*   the address is read at the offset given by the next argument.
+* @tparam[opt] integer offset The offset of the address inside `addr`.
+* @treturn lunatik_object|integer|boolean|string The value associated with the
+*   longest matching prefix, or `nil` if no prefix matches.
+* @treturn integer The length of the matching prefix.
+* @usage
+*   local verdict = deny:lookup(skb, 16) -- destination address of an IPv4 header
+*/
+static int luarcu_lpm_lookup(lua_State *L)
+{
+	luarcu_lpmtable_t *lpm = luarcu_lpm_check(L, 1);
+	luarcu_value_t value = {.type = LUA_TNIL};
+	char string[LUARCU_MAXSTRING];
+	u8 addr[LUARCU_LPM_MAXLEN];
+	luarcu_lpmnode_t *node, *found = NULL;
+	unsigned int prefixlen = 0;
+
+	luarcu_lpm_checkaddr(L, 2, lpm, addr);
+
+	rcu_read_lock();
+	for (node = rcu_dereference(lpm->root); node != NULL;
+		node = rcu_dereference(node->child[luarcu_lpm_bit(addr, node->prefixlen)])) {
+		unsigned int matchlen = luarcu_lpm_match(node, addr, lpm->maxprefixlen);
+
+		if (matchlen < node->prefixlen)
+			break;
+		if (!(node->flags & LUARCU_LPM_INTERMEDIATE))
+			found = node;
+		if (matchlen == lpm->maxprefixlen)
+			break;
+	}
+	if (found != NULL) {
+		luarcu_copyvalue(&found->value, found->string, &value, string);
+		prefixlen = found->prefixlen;
+	}
+	rcu_read_unlock();
+
+	luarcu_pushvalue(L, &value, string);
+	if (found == NULL)
+		return 1;
+	lua_pushinteger(L, (lua_Integer)prefixlen);
+	return 2;
+}
+
+/***
+* Returns the number of prefixes.
+* @function __len
+* @treturn integer
+*/
+static int luarcu_lpm_length(lua_State *L)
+{
+	luarcu_lpmtable_t *lpm = luarcu_lpm_check(L, 1);
+	lua_pushinteger(L, (lua_Integer)READ_ONCE(lpm->count));
+	return 1;
+}
+
+/* there are no readers left; thus, nodes are released right away, from the leaves up */
+static void luarcu_lpm_release(void *private)
+{
+	luarcu_lpmtable_t *lpm = (luarcu_lpmtable_t *)private;
+
+	for (;;) {
+		luarcu_lpmnode_t __rcu **slot = &lpm->root;
+		luarcu_lpmnode_t *node;
+
+		for (;;) {
+			if ((node = rcu_dereference_protected(*slot, true)) == NULL)
+				return;
+			if (rcu_access_pointer(node->child[0]) != NULL)
+				slot = &node->child[0];
+			else if (rcu_access_pointer(node->child[1]) != NULL)
+				slot = &node->child[1];
+			else
+				break;
+		}
+		RCU_INIT_POINTER(*slot, NULL);
+		luarcu_lpm_freenode(node);
+	}
+}
+
+static const luaL_Reg luarcu_lpm_mt[] = {
+	{"__gc", lunatik_deleteobject},
+	{"__len", luarcu_lpm_length},
+	{"insert", luarcu_lpm_insert},
+	{"delete", luarcu_lpm_delete},
+	{"lookup", luarcu_lpm_lookup},
+	{NULL, NULL}
+};
+
+/* LPM tables have their own lock; thus, they aren't monitored */
+static const lunatik_class_t luarcu_lpm_class = {
+	.name = "rcu.lpm",
+	.methods = luarcu_lpm_mt,
+	.release = luarcu_lpm_release,
+	.sleep = false,
+};
+
+/***
+* Creates a new longest-prefix-match table.
+* @function lpm
+* @tparam integer family The address family: `socket.af.INET` or `socket.af.INET6`.
+* @treturn rcu_lpm A new LPM table.
+* @usage
+*   local af = require("socket").af
+*   local deny = rcu.lpm(af.INET)
+*   deny:insert(net.aton("192.168.0.0"), 16, true)
+*   if deny:lookup(net.aton("192.168.1.1")) then ... end
+* @within rcu
+*/
+static int luarcu_lpm(lua_State *L)
+{
+	lua_Integer family = luaL_checkinteger(L, 1);
+	lunatik_object_t *object;
+	luarcu_lpmtable_t *lpm;
+
+	luaL_argcheck(L, family == AF_INET || family == AF_INET6, 1, "unsupported family");
+	lunatik_checkclass(L, &luarcu_lpm_class);
+	if (luaL_getmetatable(L, luarcu_lpm_class.name) == LUA_TNIL)
+		lunatik_newclass(L, &luarcu_lpm_class);
+	lua_pop(L, 1);
+
+	object = lunatik_newobject(L, &luarcu_lpm_class, sizeof(luarcu_lpmtable_t));
+	lpm = (luarcu_lpmtable_t *)object->private;
+	RCU_INIT_POINTER(lpm->root, NULL);
+	lpm->count = 0;
+	lpm->len = family == AF_INET ? sizeof(struct in_addr) : sizeof(struct in6_addr);
+	lpm->maxprefixlen = lpm->len * 8;
+	spin_lock_init(&lpm->lock);
 	return 1; /* object */
 }
 
@@ -434,11 +1603,14 @@ LUNATIK_NEWLIB(rcu, luarcu_lib, &luarcu_class, NULL);
 
 static int __init luarcu_init(void)
 {
-	return 0;
+	luarcu_seed = get_random_u32();
+	return (luarcu_wq = alloc_workqueue("luarcu", WQ_UNBOUND, 0)) == NULL ? -ENOMEM : 0;
 }
 
 static void __exit luarcu_exit(void)
 {
+	rcu_barrier(); /* former generations are queued after a grace period */
+	destroy_workqueue(luarcu_wq);
 }
 
 module_init(luarcu_init);
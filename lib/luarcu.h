@@ -8,8 +8,18 @@
 
 #define LUARCU_DEFAULT_SIZE	(256)
 
+/* keys carry their hash; thus, hot paths might initialize them once and look them up many times */
+typedef struct luarcu_key_s {
+	const char *str;
+	size_t len;
+	unsigned int hash;
+} luarcu_key_t;
+
 lunatik_object_t *luarcu_newtable(size_t size, bool sleep);
+/* returns a new reference to the object stored at `key`; entries holding scalar values yield NULL */
 lunatik_object_t *luarcu_gettable(lunatik_object_t *table, const char *key, size_t keylen);
+void luarcu_initkey(luarcu_key_t *key, const char *str, size_t len);
+lunatik_object_t *luarcu_getkey(lunatik_object_t *table, const luarcu_key_t *key);
 int luarcu_settable(lunatik_object_t *table, const char *key, size_t keylen, lunatik_object_t *object);
 
 #endif
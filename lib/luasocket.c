@@ -38,6 +38,8 @@
 
 #include <lunatik.h>
 
+#include "luadata.h"
+
 #define luasocket_msgaddr(msg, addr, size)	\
 do {						\
 	msg.msg_namelen = size;			\
@@ -121,7 +123,8 @@ LUNATIK_PRIVATECHECKER(luasocket_check, struct socket *);
 * address family) specify the destination.
 *
 * @function send
-* @tparam string message The string message to send.
+* @tparam string|data message The message to send (e.g., a `data.buffer`, which is lent to the socket,
+*   rather than copied into a string; packets are copied).
 * @tparam[opt] integer|string addr The destination address.
 *
 * - For `AF_INET` (IPv4) sockets: An integer representing the IPv4 address (e.g., from `net.aton()`).
@@ -150,15 +153,19 @@ static int luasocket_send(lua_State *L)
 
 	luasocket_setmsg(msg);
 
-	vec.iov_base = (void *)luaL_checklstring(L, 2, &len);
-	vec.iov_len = len;
-
 	if (unlikely(nargs >= 3)) {
 		size_t size = luasocket_checkaddr(L, socket, &addr, 3);
 		luasocket_msgaddr(msg, addr, size);
 	}
 
-	lunatik_tryret(L, ret, kernel_sendmsg, socket, &msg, &vec, 1, len);
+	/* data objects are borrowed while the message is sent (see luadata_borrow()) */
+	vec.iov_base = (void *)luadata_borrow(L, 2, &len);
+	vec.iov_len = len;
+	ret = kernel_sendmsg(socket, &msg, &vec, 1, len);
+	luadata_unborrow(L, 2);
+
+	if (ret < 0)
+		lunatik_throw(L, ret);
 	lua_pushinteger(L, ret);
 	return 1;
 }
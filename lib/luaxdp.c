@@ -30,6 +30,56 @@
 #include "luarcu.h"
 #include "luadata.h"
 
+static const lunatik_reg_t luaxdp_action[] = {
+	{"ABORTED", XDP_ABORTED},
+	{"DROP", XDP_DROP},
+	{"PASS", XDP_PASS},
+	{"TX", XDP_TX},
+	{"REDIRECT", XDP_REDIRECT},
+	{NULL, 0}
+};
+
+/***
+* Represents the statistics of an attached callback.
+* This is a userdata object returned by `xdp.attach()`.
+* @type xdp
+*/
+LUNATIK_PRIVATECHECKER(luaxdp_check, lunatik_stats_t *);
+
+/***
+* Returns the statistics of the attached callback.
+* Counters are kept per CPU and summed on each call; they are also exported
+* on `<debugfs>/lunatik/xdp/`.
+* @function stats
+* @treturn table A table with the fields `calls`, `errors`, `fallbacks` (calls that
+*   returned -1 to the eBPF program), `nsecs` (cumulative time spent on the callback)
+*   and `verdicts` (a table indexed by the names of `xdp.action`).
+*/
+static int luaxdp_stats(lua_State *L)
+{
+	lunatik_stats_t *stats = luaxdp_check(L, 1);
+	lunatik_pushstats(L, stats);
+	return 1;
+}
+
+static void luaxdp_release(void *private)
+{
+	lunatik_freestats((lunatik_stats_t *)private);
+}
+
+static const luaL_Reg luaxdp_mt[] = {
+	{"__gc", lunatik_deleteobject},
+	{"stats", luaxdp_stats},
+	{NULL, NULL}
+};
+
+static const lunatik_class_t luaxdp_class = {
+	.name = "xdp",
+	.methods = luaxdp_mt,
+	.release = luaxdp_release,
+	.sleep = false,
+};
+
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0))
 #include <linux/btf.h>
 #include <linux/btf_ids.h>
@@ -44,67 +94,68 @@ __diag_ignore_all("-Wmissing-prototypes",
 #endif
 
 static lunatik_object_t *luaxdp_runtimes = NULL;
+static luarcu_key_t luaxdp_runtimeskey;
+
+/* registry[luaxdp_handler] = {callback, buffer, argument, stats} */
+#define LUAXDP_CALLBACK	1
+#define LUAXDP_BUFFER	2
+#define LUAXDP_ARGUMENT	3
+#define LUAXDP_STATS	4
 
-static inline lunatik_object_t *luaxdp_pushdata(lua_State *L, int upvalue, void *ptr, size_t size)
+static inline lunatik_object_t *luaxdp_pushdata(lua_State *L, int ix, int field, void *ptr, size_t size)
 {
 	lunatik_object_t *data;
 
-	lua_pushvalue(L, lua_upvalueindex(upvalue));
+	lua_rawgeti(L, ix, field);
 	data = (lunatik_object_t *)lunatik_toobject(L, -1);
 	luadata_reset(data, ptr, size, LUADATA_OPT_KEEP);
 	return data;
 }
 
-static int luaxdp_callback(lua_State *L)
-{
-	lunatik_object_t *buffer, *argument;
-	struct xdp_buff *ctx = (struct xdp_buff *)lua_touserdata(L, 1);
-	void *arg = lua_touserdata(L, 2);
-	size_t arg__sz = (size_t)lua_tointeger(L, 3);
-
-	lua_pushvalue(L, lua_upvalueindex(1)); /* callback */
-	buffer = luaxdp_pushdata(L, 2, ctx->data, ctx->data_end - ctx->data);
-	argument = luaxdp_pushdata(L, 3, arg, arg__sz);
-
-	if (lua_pcall(L, 2, 1, 0) != LUA_OK) {
-		luadata_clear(buffer);
-		luadata_clear(argument);
-		return lua_error(L);
-	}
-
-	luadata_clear(buffer);
-	luadata_clear(argument);
-	return 1;
-}
-
 static int luaxdp_handler(lua_State *L, struct xdp_buff *ctx, void *arg, size_t arg__sz)
 {
+	lunatik_object_t *buffer, *argument;
+	lunatik_stats_t *stats;
 	int action = -1;
-	int status;
+	int ix;
+	u64 begin;
 
-	if (lunatik_getregistry(L, luaxdp_callback) != LUA_TFUNCTION) {
+	if (lunatik_getregistry(L, luaxdp_handler) != LUA_TTABLE) {
 		pr_err("couldn't find callback");
 		goto out;
 	}
+	ix = lua_gettop(L);
+
+	lua_rawgeti(L, ix, LUAXDP_STATS);
+	stats = (lunatik_stats_t *)lunatik_toobject(L, -1)->private;
+	lua_pop(L, 1);
+	begin = lunatik_statbegin(stats);
+
+	lua_rawgeti(L, ix, LUAXDP_CALLBACK);
+	buffer = luaxdp_pushdata(L, ix, LUAXDP_BUFFER, ctx->data, ctx->data_end - ctx->data);
+	argument = luaxdp_pushdata(L, ix, LUAXDP_ARGUMENT, arg, arg__sz);
 
-	lua_pushlightuserdata(L, ctx);
-	lua_pushlightuserdata(L, arg);
-	lua_pushinteger(L, (lua_Integer)arg__sz);
-	if ((status = lua_pcall(L, 3, 1, 0)) != LUA_OK) {
+	if (lua_pcall(L, 2, 1, 0) != LUA_OK) { /* callback(buffer, argument) */
 		pr_err("%s\n", lua_tostring(L, -1));
-		goto out;
+		lunatik_statinc(stats, errors);
+		lunatik_statinc(stats, fallbacks);
+	}
+	else {
+		action = lua_tointeger(L, -1);
+		lunatik_statverdict(stats, action);
 	}
 
-	action = lua_tointeger(L, -1);
+	luadata_clear(buffer);
+	luadata_clear(argument);
+	lunatik_statend(stats, begin);
 out:
 	return action;
 }
 
 static inline int luaxdp_checkruntimes(void)
 {
-	const char *key = "runtimes";
 	if (luaxdp_runtimes == NULL &&
-	   (luaxdp_runtimes = luarcu_gettable(lunatik_env, key, sizeof(key))) == NULL)
+	   (luaxdp_runtimes = luarcu_getkey(lunatik_env, &luaxdp_runtimeskey)) == NULL)
 		return -1;
 	return 0;
 }
@@ -115,6 +166,7 @@ __bpf_kfunc int bpf_luaxdp_run(char *key, size_t key__sz, struct xdp_md *xdp_ctx
 	struct xdp_buff *ctx = (struct xdp_buff *)xdp_ctx;
 	int action = -1;
 	size_t keylen = key__sz - 1;
+	luarcu_key_t k;
 
 	if (unlikely(luaxdp_checkruntimes() != 0)) {
 		pr_err("couldn't find _ENV.runtimes\n");
@@ -122,7 +174,8 @@ __bpf_kfunc int bpf_luaxdp_run(char *key, size_t key__sz, struct xdp_md *xdp_ctx
 	}
 
 	key[keylen] = '\0';
-	if ((runtime = luarcu_gettable(luaxdp_runtimes, key, keylen)) == NULL) {
+	luarcu_initkey(&k, key, keylen);
+	if ((runtime = luarcu_getkey(luaxdp_runtimes, &k)) == NULL) {
 		pr_err("couldn't find runtime '%s'\n", key);
 		goto out;
 	}
@@ -168,7 +221,7 @@ static const struct btf_kfunc_id_set bpf_luaxdp_kfunc_set = {
 *   @tfield integer REDIRECT Redirect the packet to another interface or BPF map. (XDP_REDIRECT)
 * @within xdp
 */
-#define luaxdp_setcallback(L, i)	(lunatik_setregistry((L), (i), luaxdp_callback))
+#define luaxdp_setcallback(L, i)	(lunatik_setregistry((L), (i), luaxdp_handler))
 
 /***
 * Unregisters the Lua callback function associated with the current Lunatik runtime.
@@ -213,7 +266,7 @@ static int luaxdp_detach(lua_State *L)
 *
 *   The callback function should return an integer verdict, typically one of the values
 *   from the `xdp.action` table (e.g., `xdp.action.PASS`, `xdp.action.DROP`).
-* @treturn nil
+* @treturn xdp An object holding the statistics of this callback (see `xdp:stats`).
 * @raise Error if the current runtime is sleepable or if internal setup fails.
 * @usage
 *   -- Lua script (e.g., "my_xdp_handler.lua" which is run via `lunatik run my_xdp_handler.lua`)
@@ -223,7 +276,8 @@ static int luaxdp_detach(lua_State *L)
 *     print("Packet received, size:", #packet_buffer)
 *     return xdp.action.PASS
 *   end
-*   xdp.attach(my_packet_processor)
+*   local handler = xdp.attach(my_packet_processor)
+*   -- later on: print(handler:stats().verdicts.PASS)
 *
 *   -- In eBPF C code, to call the above Lua function:
 *   -- char rt_key[] = "my_xdp_handler.lua"; // Key matches the script name
@@ -234,15 +288,31 @@ static int luaxdp_detach(lua_State *L)
 */
 static int luaxdp_attach(lua_State *L)
 {
-	lunatik_checkruntime(L, false);
+	lunatik_object_t *runtime = lunatik_checkruntime(L, false);
+	lunatik_object_t *object;
+	lunatik_stats_t *stats;
+
 	luaL_checktype(L, 1, LUA_TFUNCTION); /* callback */
 
-	luadata_new(L); /* buffer */
-	luadata_new(L); /* argument */
+	object = lunatik_newobject(L, &luaxdp_class, sizeof(lunatik_stats_t));
+	stats = (lunatik_stats_t *)object->private;
+	memset(stats, 0, sizeof(lunatik_stats_t));
+	if (lunatik_newstats(stats, "xdp", "callback", luaxdp_action, lunatik_gfp(runtime)) != 0)
+		luaL_error(L, "failed to allocate statistics");
+
+	lua_createtable(L, 4, 0);
+	lua_pushvalue(L, 1);
+	lua_rawseti(L, -2, LUAXDP_CALLBACK);
+	luadata_new(L);
+	lua_rawseti(L, -2, LUAXDP_BUFFER);
+	luadata_new(L);
+	lua_rawseti(L, -2, LUAXDP_ARGUMENT);
+	lua_pushvalue(L, -2); /* object */
+	lua_rawseti(L, -2, LUAXDP_STATS);
 
-	lua_pushcclosure(L, luaxdp_callback, 3);
 	luaxdp_setcallback(L, -1);
-	return 0;
+	lua_pop(L, 1); /* table */
+	return 1; /* object */
 }
 #endif
 
@@ -254,25 +324,17 @@ static const luaL_Reg luaxdp_lib[] = {
 	{NULL, NULL}
 };
 
-static const lunatik_reg_t luaxdp_action[] = {
-	{"ABORTED", XDP_ABORTED},
-	{"DROP", XDP_DROP},
-	{"PASS", XDP_PASS},
-	{"TX", XDP_TX},
-	{"REDIRECT", XDP_REDIRECT},
-	{NULL, 0}
-};
-
 static const lunatik_namespace_t luaxdp_flags[] = {
 	{"action", luaxdp_action},
 	{NULL, NULL}
 };
 
-LUNATIK_NEWLIB(xdp, luaxdp_lib, NULL, luaxdp_flags);
+LUNATIK_NEWLIB(xdp, luaxdp_lib, &luaxdp_class, luaxdp_flags);
 
 static int __init luaxdp_init(void)
 {
 #if (LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0))
+	luarcu_initkey(&luaxdp_runtimeskey, "runtimes", sizeof("runtimes") - 1);
 	return register_btf_kfunc_id_set(BPF_PROG_TYPE_XDP, &bpf_luaxdp_kfunc_set);
 #else
 	return 0;
@@ -11,7 +11,7 @@
 *
 * When an `iptables` rule using a Lua-defined extension is encountered, the
 * corresponding Lua callback function (`match` or `target`) is executed in the
-* kernel.
+* kernel. Callbacks are resolved once, when the extension is registered.
 *
 * @module xtable
 */
@@ -53,6 +53,10 @@ typedef struct luaxtable_s {
 		struct xt_target target;
 	};
 	luaxtable_type_t type;
+	int hook;
+	int checkentry;
+	int destroy;
+	lunatik_stats_t stats;
 } luaxtable_t;
 
 static struct {
@@ -62,22 +66,31 @@ static struct {
 	unsigned int target_fallback;
 } luaxtable_hooks = {NULL, NULL, false, XT_CONTINUE};
 
-static int luaxtable_docall(lua_State *L, luaxtable_t *xtable, luaxtable_info_t *info, const char *op, int nargs, int nret)
+static const lunatik_reg_t luaxtable_match_verdicts[] = {
+	{"NOMATCH", false},
+	{"MATCH", true},
+	{NULL, 0}
+};
+
+#define luaxtable_target_verdicts	luanetfilter_action
+
+static inline void luaxtable_fallback(luaxtable_t *xtable, bool error)
 {
-	int base = lua_gettop(L) - nargs;
+	if (error)
+		lunatik_statinc(&xtable->stats, errors);
+	lunatik_statinc(&xtable->stats, fallbacks);
+}
 
-	if (lunatik_getregistry(L, xtable) != LUA_TTABLE) {
-		pr_err("%s: could not find ops table\n", op);
-		goto err;
-	}
+static int luaxtable_docall(lua_State *L, luaxtable_t *xtable, luaxtable_info_t *info, const char *op, int ref, int nargs, int nret)
+{
+	int base = lua_gettop(L) - nargs;
 
-	if (lua_getfield(L, -1, op) != LUA_TFUNCTION) {
+	if (!lunatik_pushcallback(L, ref)) {
 		pr_err("%s isn't defined\n", op);
 		goto err;
 	}
 
 	lua_insert(L, base + 1); /* op */
-	lua_pop(L, 1); /* table */
 	lua_pushlstring(L, info->userargs, LUAXTABLE_USERDATA_SIZE); /* userargs */
 
 	if (lua_pcall(L, nargs + 1, nret, 0) != LUA_OK) {
@@ -100,11 +113,11 @@ static inline lunatik_object_t *luaxtable_getskb(lua_State *L, luaxtable_t *xtab
 static int luaxtable_pushparams(lua_State *L, const struct xt_action_param *par, luaxtable_t *xtable, struct sk_buff *skb, uint8_t opt)
 {
 	lunatik_object_t *data = luaxtable_getskb(L, xtable);
-	if (unlikely(data == NULL || skb_linearize(skb) != 0)) {
+	if (unlikely(data == NULL)) {
 		pr_err("could not get skb\n");
 		return -1;
 	}
-        luadata_reset(data, skb->data, skb->len, opt);
+	luadata_resetskb(data, skb, 0, opt); /* non-linear skbs are accessed in place */
 
 	lua_newtable(L);
 	lua_pushboolean(L, par->hotdrop);
@@ -125,12 +138,14 @@ static int luaxtable_pushparams(lua_State *L, const struct xt_action_param *par,
 }
 
 #define luaxtable_call(L, op, xtable, skb, par, info, opt)	\
-	((luaxtable_pushparams(L, par, xtable, skb, opt) == -1) || (luaxtable_docall(L, xtable, info, op, 2, 1) == -1))
+	((luaxtable_pushparams(L, par, xtable, skb, opt) == -1) || (luaxtable_docall(L, xtable, info, op, xtable->hook, 2, 1) == -1))
 
 static int luaxtable_domatch(lua_State *L, luaxtable_t *xtable, const struct sk_buff *skb, struct xt_action_param *par, int fallback)
 {
-	if (luaxtable_call(L, "match", xtable, (struct sk_buff *)skb, par, (luaxtable_info_t *)par->matchinfo, LUADATA_OPT_READONLY | LUADATA_OPT_SKB) != 0)
+	if (luaxtable_call(L, "match", xtable, (struct sk_buff *)skb, par, (luaxtable_info_t *)par->matchinfo, LUADATA_OPT_READONLY) != 0) {
+		luaxtable_fallback(xtable, true);
 		return fallback;
+	}
 
 	int ret = lua_toboolean(L, -1);
 	lua_getfield(L, -2, "hotdrop");
@@ -140,11 +155,17 @@ static int luaxtable_domatch(lua_State *L, luaxtable_t *xtable, const struct sk_
 
 static int luaxtable_dotarget(lua_State *L, luaxtable_t *xtable, struct sk_buff *skb, const struct xt_action_param *par, int fallback)
 {
-	if (luaxtable_call(L, "target", xtable, skb, par, (luaxtable_info_t *)par->targinfo, LUADATA_OPT_SKB) != 0)
+	if (luaxtable_call(L, "target", xtable, skb, par, (luaxtable_info_t *)par->targinfo, LUADATA_OPT_NONE) != 0) {
+		luaxtable_fallback(xtable, true);
 		return fallback;
+	}
 
 	int ret = lua_tointeger(L, -1);
-	return ret >= 0 && ret <= NF_MAX_VERDICT ? ret : fallback;
+	if (ret < 0 || ret > NF_MAX_VERDICT) {
+		luaxtable_fallback(xtable, false);
+		return fallback;
+	}
+	return ret;
 }
 
 #define LUAXTABLE_HOOK_CB(hook, huk, U, V, T) 				\
@@ -153,8 +174,11 @@ static T luaxtable_##hook(U skb, V par)					\
 	int ret;							\
 	const luaxtable_info_t *info = (const luaxtable_info_t *)par->huk##info;	\
 	luaxtable_t *xtable = info->data;				\
+	u64 begin = lunatik_statbegin(&xtable->stats);			\
 									\
 	lunatik_runbh(xtable->runtime, luaxtable_do##hook, ret, xtable, skb, par, luaxtable_hooks.hook##_fallback);	\
+	lunatik_statend(&xtable->stats, begin);				\
+	lunatik_statverdict(&xtable->stats, ret);			\
 	return ret;							\
 }
 
@@ -172,7 +196,7 @@ static int luaxtable_##hook##_check(const struct xt_##hk##chk_param *par)	\
 	luaxtable_info_t *info = (luaxtable_info_t *)par->huk##info; 		\
 	info->data = xtable;							\
 										\
-	lunatik_runbh(xtable->runtime, luaxtable_docall, ret, xtable, info, "checkentry", 0, 1);	\
+	lunatik_runbh(xtable->runtime, luaxtable_docall, ret, xtable, info, "checkentry", xtable->checkentry, 0, 1);	\
 	return ret != 0 ? -EINVAL : 0;						\
 }
 
@@ -183,7 +207,7 @@ static void luaxtable_##hook##_destroy(const struct xt_##hk##dtor_param *par)	\
 	luaxtable_info_t *info = (luaxtable_info_t *)par->huk##info; 		\
 	luaxtable_t *xtable = (luaxtable_t *)info->data;			\
 										\
-	lunatik_runbh(xtable->runtime, luaxtable_docall, ret, xtable, info, "destroy", 0, 0);	\
+	lunatik_runbh(xtable->runtime, luaxtable_docall, ret, xtable, info, "destroy", xtable->destroy, 0, 0);	\
 }
 
 LUAXTABLE_HOOK_CB(match, match, const struct  sk_buff *, struct xt_action_param *, bool);
@@ -306,8 +330,28 @@ static void luaxtable_release(void *private);
 *   local target_ext = xtable.target(my_target_opts)
 *   -- To use in iptables: iptables -A FORWARD -j MYLUATARGET --someoption "value"
 */
+
+LUNATIK_PRIVATECHECKER(luaxtable_check, luaxtable_t *);
+
+/***
+* Returns the statistics of this extension.
+* Counters are kept per CPU and summed on each call; they are also exported
+* on `<debugfs>/lunatik/xtable/`.
+* @function stats
+* @treturn table A table with the fields `calls`, `errors`, `fallbacks`, `nsecs` and `verdicts`;
+*   the latter is indexed by `MATCH` and `NOMATCH` for matches and by the names of
+*   `netfilter.action` for targets.
+*/
+static int luaxtable_stats(lua_State *L)
+{
+	luaxtable_t *xtable = luaxtable_check(L, 1);
+	lunatik_pushstats(L, &xtable->stats);
+	return 1;
+}
+
 static const luaL_Reg luaxtable_mt[] = {
 	{"__gc", lunatik_deleteobject},
+	{"stats", luaxtable_stats},
 	{NULL, NULL}
 };
 
@@ -324,8 +368,8 @@ static inline lunatik_object_t *luaxtable_new(lua_State *L, int idx, int hook)
 	lunatik_object_t *object = lunatik_newobject(L, &luaxtable_class , sizeof(luaxtable_t));
 	luaxtable_t *xtable = (luaxtable_t *)object->private;
 
+	memset(xtable, 0, sizeof(luaxtable_t));
 	xtable->type = hook;
-	xtable->runtime = NULL;
 	luadata_attach(L, xtable, skb);
 	return object;
 }
@@ -337,6 +381,26 @@ static inline void luaxtable_register(lua_State *L, int idx, luaxtable_t *xtable
 	lunatik_registerobject(L, idx, object);
 }
 
+/* references live in the registry of this runtime, which outlives the extension */
+static inline void luaxtable_refcallbacks(lua_State *L, int idx, luaxtable_t *xtable, const char *hook)
+{
+	lunatik_checkfield(L, idx, "checkentry", LUA_TFUNCTION);
+	lunatik_checkfield(L, idx, "destroy", LUA_TFUNCTION);
+	lunatik_checkfield(L, idx, hook, LUA_TFUNCTION);
+
+	/* all callbacks are checked beforehand, so that none is left referenced on errors */
+	xtable->hook = luaL_ref(L, LUA_REGISTRYINDEX);
+	xtable->destroy = luaL_ref(L, LUA_REGISTRYINDEX);
+	xtable->checkentry = luaL_ref(L, LUA_REGISTRYINDEX);
+}
+
+static inline void luaxtable_unrefcallbacks(lua_State *L, luaxtable_t *xtable)
+{
+	lunatik_unrefcallback(L, &xtable->checkentry);
+	lunatik_unrefcallback(L, &xtable->destroy);
+	lunatik_unrefcallback(L, &xtable->hook);
+}
+
 #define LUAXTABLE_NEWHOOK(hook, HOOK)					\
 static int luaxtable_new##hook(lua_State *L) 				\
 {									\
@@ -351,21 +415,24 @@ static int luaxtable_new##hook(lua_State *L) 				\
 	lunatik_setinteger(L, 1, hook, family);			\
 	lunatik_setinteger(L, 1, hook, proto);			\
 	lunatik_setinteger(L, 1, hook, hooks);			\
-	lunatik_checkfield(L, 1, "checkentry", LUA_TFUNCTION);		\
-	lunatik_checkfield(L, 1, "destroy", LUA_TFUNCTION);		\
-	lunatik_checkfield(L, 1, #hook, LUA_TFUNCTION);			\
-									\
 	hook->usersize = 0;						\
 	hook->hook##size = sizeof(luaxtable_info_t);			\
 	hook->hook = luaxtable_##hook;					\
 	hook->checkentry = luaxtable_##hook##_check;			\
 	hook->destroy = luaxtable_##hook##_destroy;			\
 									\
+	if (lunatik_newstats(&xtable->stats, "xtable", hook->name, luaxtable_##hook##_verdicts,	\
+		lunatik_gfp(lunatik_toruntime(L))) != 0)		\
+		luaL_error(L, "unable to allocate statistics");		\
+									\
 	if (luarcu_settable(luaxtable_hooks.hook, hook->name, XT_EXTENSION_MAXNAMELEN, object) != 0)	\
 		luaL_error(L, "unable to hook: %s\n", hook->name);	\
 									\
-	if (xt_register_##hook(hook) != 0)				\
+	luaxtable_refcallbacks(L, 1, xtable, #hook);			\
+	if (xt_register_##hook(hook) != 0) {				\
+		luaxtable_unrefcallbacks(L, xtable);			\
 		luaL_error(L, "unable to register " #hook);		\
+	}								\
 									\
 	luaxtable_register(L, 1, xtable, object);			\
 	return 1;							\
@@ -381,23 +448,25 @@ static const luaL_Reg luaxtable_lib[] = {
 	{NULL, NULL}
 };
 
+/* extensions are kept in the registry of their runtime until it is closed; thus, the
+ * callback references are dropped along with that registry and there is no state to unref them here */
 static void luaxtable_release(void *private)
 {
 	luaxtable_t *xtable = (luaxtable_t *)private;
-	if (!xtable->runtime) 
-		return;
-
-	switch (xtable->type) {
-	case LUAXTABLE_TMATCH:
-		xt_unregister_match(&xtable->match);
-		break;
-	case LUAXTABLE_TTARGET:
-		xt_unregister_target(&xtable->target);
-		break;
+	if (xtable->runtime != NULL) {
+		switch (xtable->type) {
+		case LUAXTABLE_TMATCH:
+			xt_unregister_match(&xtable->match);
+			break;
+		case LUAXTABLE_TTARGET:
+			xt_unregister_target(&xtable->target);
+			break;
+		}
+
+		lunatik_putobject(xtable->runtime);
+		xtable->runtime = NULL;
 	}
-
-	lunatik_putobject(xtable->runtime);
-	xtable->runtime = NULL;
+	lunatik_freestats(&xtable->stats);
 }
 
 LUNATIK_NEWLIB(xtable, luaxtable_lib, &luaxtable_class, luanetfilter_flags);
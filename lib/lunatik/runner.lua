@@ -32,7 +32,7 @@ end
 -- Creates a new Lunatik runtime for the given script and registers it.
 -- Throws an error if a script with the same name is already running.
 -- @tparam string script The path or name of the Lua script to run. The ".lua" extension will be trimmed.
--- @param ... Additional arguments to pass to the script's main function.
+-- @param ... Additional arguments to pass to `lunatik.runtime` (i.e., `sleep` and `resched`).
 -- @treturn table The created Lunatik runtime object.
 -- @raise error if the script is already running.
 function runner.run(script, ...)
@@ -83,25 +83,32 @@ function runner.stop(script)
 	stop(env.runtimes, script)
 end
 
+--- Collects the names of all currently running scripts.
+-- @local
+-- @function scripts
+-- @treturn table An array of script names.
+local function scripts()
+	local list = {}
+	for script in rcu.pairs(env.runtimes, 64, true) do
+		table.insert(list, script)
+	end
+	return list
+end
+
 --- Lists the names of all currently running scripts.
--- Iterates over the `env.runtimes` RCU table to collect script names.
+-- Iterates over the keys of the `env.runtimes` RCU table to collect script names.
 -- @treturn string A comma-separated string of running script names, or an empty string if no scripts are running.
 function runner.list()
-	local list = {}
-	rcu.map(env.runtimes, function (script)
-		table.insert(list, script)
-	end)
-	-- The original code `table.concat(list, ', ')` correctly returns an empty string
-	-- if `list` is empty, so no change to the code logic is needed or made here.
-	return table.concat(list, ', ')
+	return table.concat(scripts(), ', ')
 end
 
 --- Shuts down all running scripts and their threads.
--- Iterates over `env.runtimes` and calls `runner.stop` for each script.
+-- Collects the names in `env.runtimes` first and then calls `runner.stop` for each script;
+-- thus, removing entries doesn't disturb the iteration.
 function runner.shutdown()
-	rcu.map(env.runtimes, function (script)
+	for _, script in ipairs(scripts()) do
 		runner.stop(script)
-	end)
+	end
 end
 
 --- Initializes the runner's internal state.
@@ -10,6 +10,10 @@
 #include <linux/spinlock.h>
 #include <linux/slab.h>
 #include <linux/kref.h>
+#include <linux/llist.h>
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include <linux/workqueue.h>
 #include <linux/errname.h>
 
 #include <lua.h>
@@ -110,6 +114,7 @@ typedef struct lunatik_object_s {
 	};
 	bool sleep;
 	gfp_t gfp;
+	struct llist_node deferred;
 } lunatik_object_t;
 
 extern lunatik_object_t *lunatik_env;
@@ -119,6 +124,15 @@ static inline int lunatik_trylock(lunatik_object_t *object)
 	return object->sleep ? mutex_trylock(&object->mutex) : spin_trylock(&object->spin);
 }
 
+/* for holding two locks of the same class (e.g., copying between two objects) */
+static inline void lunatik_locknested(lunatik_object_t *object)
+{
+	if (object->sleep)
+		mutex_lock_nested(&object->mutex, SINGLE_DEPTH_NESTING);
+	else
+		spin_lock_nested(&object->spin, SINGLE_DEPTH_NESTING);
+}
+
 int lunatik_runtime(lunatik_object_t **pruntime, const char *script, bool sleep);
 int lunatik_stop(lunatik_object_t *runtime);
 
@@ -147,16 +161,20 @@ static inline void *lunatik_checknull(lua_State *L, void *ptr)
 
 #define lunatik_checkalloc(L, s)	(lunatik_checknull((L), lunatik_malloc((L), (s))))
 
+static inline void lunatik_throw(lua_State *L, int ret)
+{
+	const char *err = errname(-ret);
+	if (likely(err != NULL))
+		lua_pushstring(L, err);
+	else
+		lua_pushinteger(L, -ret);
+	lua_error(L);
+}
+
 #define lunatik_tryret(L, ret, op, ...)				\
 do {								\
-	if ((ret = op(__VA_ARGS__)) < 0) {			\
-		const char *err = errname(-ret);		\
-		if (likely(err != NULL))			\
-			lua_pushstring(L, err);			\
-		else						\
-			lua_pushinteger(L, -ret);		\
-		lua_error(L);					\
-	}							\
+	if ((ret = op(__VA_ARGS__)) < 0)			\
+		lunatik_throw(L, ret);				\
 } while (0)
 
 #define lunatik_try(L, op, ...)					\
@@ -213,8 +231,11 @@ lunatik_object_t *lunatik_createobject(const lunatik_class_t *class, size_t size
 lunatik_object_t **lunatik_checkpobject(lua_State *L, int ix);
 void lunatik_cloneobject(lua_State *L, lunatik_object_t *object);
 void lunatik_releaseobject(struct kref *kref);
+void lunatik_flushobjects(void);
+long lunatik_pendingobjects(void);
 int lunatik_closeobject(lua_State *L);
 int lunatik_deleteobject(lua_State *L);
+int lunatik_monitor(lua_State *L);
 int lunatik_monitorobject(lua_State *L);
 
 #define LUNATIK_ERR_NULLPTR	"null-pointer dereference"
@@ -360,6 +381,31 @@ static inline void lunatik_optcfunction(lua_State *L, int idx, const char *field
 	}
 }
 
+/* callbacks are resolved once (at registration) into registry references;
+ * thus, dispatching them costs a single array lookup and a single pcall */
+static inline int lunatik_refcallback(lua_State *L, int idx, const char *field)
+{
+	if (lua_getfield(L, idx, field) != LUA_TFUNCTION) {
+		lua_pop(L, 1);
+		return LUA_NOREF;
+	}
+	return luaL_ref(L, LUA_REGISTRYINDEX); /* pop callback */
+}
+
+static inline int lunatik_checkcallback(lua_State *L, int idx, const char *field)
+{
+	lunatik_checkfield(L, idx, field, LUA_TFUNCTION);
+	return luaL_ref(L, LUA_REGISTRYINDEX); /* pop callback */
+}
+
+static inline void lunatik_unrefcallback(lua_State *L, int *ref)
+{
+	luaL_unref(L, LUA_REGISTRYINDEX, *ref);
+	*ref = LUA_NOREF;
+}
+
+#define lunatik_pushcallback(L, ref)	(lua_rawgeti((L), LUA_REGISTRYINDEX, (ref)) == LUA_TFUNCTION)
+
 #define lunatik_checkbounds(L, idx, val, min, max)	luaL_argcheck(L, val >= min && val <= max, idx, "out of bounds")
 
 static inline unsigned int lunatik_checkuint(lua_State *L, int idx)
@@ -389,5 +435,50 @@ static inline void lunatik_unregisterobject(lua_State *L, lunatik_object_t *obje
 	lua_pop(L, 1); /* pop nil */
 }
 
+#define LUNATIK_STAT_NVERDICTS	(8)
+#define LUNATIK_STAT_NAMELEN	(64)
+
+typedef struct lunatik_stat_s {
+	u64 calls;
+	u64 errors;
+	u64 fallbacks;
+	u64 nsecs;
+	u64 verdicts[LUNATIK_STAT_NVERDICTS];
+} lunatik_stat_t;
+
+typedef struct lunatik_stats_s {
+	lunatik_stat_t __percpu *percpu;
+	const lunatik_reg_t *verdicts;
+	struct dentry *dentry;
+	struct work_struct work;
+	const char *class;
+	char name[LUNATIK_STAT_NAMELEN];
+} lunatik_stats_t;
+
+int lunatik_newstats(lunatik_stats_t *stats, const char *class, const char *name, const lunatik_reg_t *verdicts, gfp_t gfp);
+void lunatik_freestats(lunatik_stats_t *stats);
+void lunatik_pushstats(lua_State *L, lunatik_stats_t *stats);
+void lunatik_statinit(void);
+void lunatik_statexit(void);
+
+#define lunatik_statinc(stats, field)	this_cpu_inc((stats)->percpu->field)
+
+static inline u64 lunatik_statbegin(lunatik_stats_t *stats)
+{
+	lunatik_statinc(stats, calls);
+	return ktime_get_ns();
+}
+
+static inline void lunatik_statend(lunatik_stats_t *stats, u64 begin)
+{
+	this_cpu_add(stats->percpu->nsecs, ktime_get_ns() - begin);
+}
+
+static inline void lunatik_statverdict(lunatik_stats_t *stats, int verdict)
+{
+	if (verdict >= 0 && verdict < LUNATIK_STAT_NVERDICTS)
+		lunatik_statinc(stats, verdicts[verdict]);
+}
+
 #endif
 
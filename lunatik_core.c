@@ -21,6 +21,7 @@
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
 #include <linux/module.h>
 #include <linux/mm.h>
+#include <linux/sched.h>
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -83,6 +84,18 @@ static void *lunatik_alloc(void *ud, void *optr, size_t osize, size_t nsize)
 	return nptr;
 }
 
+static void lunatik_reschedhook(lua_State *L, lua_Debug *ar)
+{
+	(void)ar;
+	cond_resched();
+}
+
+static inline void lunatik_setresched(lua_State *L, int count)
+{
+	if (count > 0)
+		lua_sethook(L, lunatik_reschedhook, LUA_MASKCOUNT, count);
+}
+
 static inline void lunatik_runerror(lua_State *L, const char *errmsg)
 {
 	if (L)
@@ -259,7 +272,7 @@ static int lunatik_runscript(lua_State *L)
 	return 1; /* callback */
 }
 
-static int lunatik_newruntime(lunatik_object_t **pruntime, lua_State *Lfrom, const char *script, bool sleep)
+static int lunatik_newruntime(lunatik_object_t **pruntime, lua_State *Lfrom, const char *script, bool sleep, int resched)
 {
 	lunatik_object_t *runtime;
 	lua_State *L;
@@ -281,6 +294,8 @@ static int lunatik_newruntime(lunatik_object_t **pruntime, lua_State *Lfrom, con
 
 	runtime->gfp = GFP_KERNEL; /* might use kvmalloc while running in process */
 	lua_setallocf(L, lunatik_alloc, runtime);
+	if (sleep)
+		lunatik_setresched(L, resched);
 
 	lua_pushcfunction(L, lunatik_runscript);
 	lua_pushlightuserdata(L, (void *)script);
@@ -299,7 +314,7 @@ static int lunatik_newruntime(lunatik_object_t **pruntime, lua_State *Lfrom, con
 
 int lunatik_runtime(lunatik_object_t **pruntime, const char *script, bool sleep)
 {
-	return lunatik_newruntime(pruntime, NULL, script, sleep);
+	return lunatik_newruntime(pruntime, NULL, script, sleep, 0);
 }
 EXPORT_SYMBOL(lunatik_runtime);
 
@@ -320,6 +335,10 @@ EXPORT_SYMBOL(lunatik_runtime);
 * @tparam[opt=true] boolean sleep If `true` (default), the runtime can sleep (e.g., for I/O operations) and uses `GFP_KERNEL` for allocations.
 *   If `false`, the runtime operates in an atomic context, cannot sleep, and uses `GFP_ATOMIC` for allocations.
 *   This is crucial for runtimes used in contexts that cannot sleep, like Netfilter hooks.
+* @tparam[opt=0] integer resched If greater than zero, a sleepable runtime calls `cond_resched()`
+*   every `resched` Lua instructions; thus, long-running scripts (e.g., loops over large tables)
+*   yield the CPU when needed, without explicitly calling `linux.schedule()`.
+*   It is ignored by non-sleepable runtimes.
 * @treturn runtime A Lunatik runtime object. This object can be used to interact with the runtime, for example, to resume it if it yields or to stop it.
 * @raise Error if the Lua state or runtime cannot be allocated, or if the script fails to load or execute.
 * @within lunatik
@@ -328,9 +347,11 @@ static int lunatik_lruntime(lua_State *L)
 {
 	const char *script = luaL_checkstring(L, 1);
 	bool sleep = (bool)(lua_gettop(L) >= 2 ? lua_toboolean(L, 2) : true);
+	lua_Integer resched = luaL_optinteger(L, 3, 0);
 
+	lunatik_checkbounds(L, 3, resched, 0, INT_MAX);
 	lunatik_object_t **pruntime = lunatik_newpobject(L, 1);
-	if (lunatik_newruntime(pruntime, L, script, sleep) != 0)
+	if (lunatik_newruntime(pruntime, L, script, sleep, (int)resched) != 0)
 		lua_error(L);
 	lunatik_setclass(L, &lunatik_class);
 	return 1;
@@ -342,11 +363,18 @@ LUNATIK_NEWLIB(lunatik_stub, lunatik_stub_lib, NULL, NULL);
 
 static int __init lunatik_init(void)
 {
+#ifdef LUNATIK_RUNTIME
+	lunatik_statinit();
+#endif
         return 0;
 }
 
 static void __exit lunatik_exit(void)
 {
+#ifdef LUNATIK_RUNTIME
+	lunatik_flushobjects();
+	lunatik_statexit();
+#endif
 }
 
 module_init(lunatik_init);
@@ -4,6 +4,14 @@
 */
 
 #define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/moduleparam.h>
+#include <linux/workqueue.h>
+#include <linux/llist.h>
+#include <linux/atomic.h>
+#include <linux/preempt.h>
+#include <linux/module.h>
+#include <linux/string.h>
+
 #include <lua.h>
 #include <lauxlib.h>
 
@@ -56,12 +64,31 @@ lunatik_object_t **lunatik_checkpobject(lua_State *L, int ix)
 }
 EXPORT_SYMBOL(lunatik_checkpobject);
 
+/* subclasses (e.g., "data.layout") are named after their libraries and registered on demand */
+static void lunatik_requireclass(lua_State *L, const lunatik_class_t *class)
+{
+	const char *dot = strchr(class->name, '.');
+
+	if (dot == NULL) {
+		lunatik_require(L, class->name);
+		return;
+	}
+
+	lua_getglobal(L, "require");
+	lua_pushlstring(L, class->name, dot - class->name);
+	lua_call(L, 1, 0);
+	if (luaL_getmetatable(L, class->name) == LUA_TNIL)
+		lunatik_newclass(L, class);
+	lua_pop(L, 1);
+}
+
 void lunatik_cloneobject(lua_State *L, lunatik_object_t *object)
 {
-	lunatik_require(L, object->class->name);
-	lunatik_object_t **pobject = lunatik_newpobject(L, 1);
 	const lunatik_class_t *class = object->class;
+	lunatik_object_t **pobject;
 
+	lunatik_requireclass(L, class);
+	pobject = lunatik_newpobject(L, 1);
 	lunatik_checkclass(L, class);
 	lunatik_setclass(L, class);
 	*pobject = object;
@@ -94,9 +121,8 @@ int lunatik_closeobject(lua_State *L)
 }
 EXPORT_SYMBOL(lunatik_closeobject);
 
-void lunatik_releaseobject(struct kref *kref)
+static inline void lunatik_freeobject(lunatik_object_t *object)
 {
-	lunatik_object_t *object = container_of(kref, lunatik_object_t, kref);
 	void *private = object->private;
 
 	if (private != NULL)
@@ -105,8 +131,83 @@ void lunatik_releaseobject(struct kref *kref)
 	lunatik_freelock(object);
 	kfree(object);
 }
+
+/* final releases issued in atomic context (e.g., GC inside a hook) are deferred to a worker;
+ * thus, class release callbacks (e.g., unregistering hooks) never run on the packet path */
+static LLIST_HEAD(lunatik_deferred);
+static atomic_long_t lunatik_pending = ATOMIC_LONG_INIT(0);
+
+/* deferred releases run code (and read classes) of the modules that own them;
+ * thus, these modules are pinned until the release is done */
+static inline struct module *lunatik_classowner(const lunatik_class_t *class)
+{
+	struct module *owner;
+
+	preempt_disable();
+	owner = __module_address((unsigned long)class);
+	preempt_enable();
+	return owner;
+}
+
+static void lunatik_releasework(struct work_struct *work)
+{
+	struct llist_node *list = llist_reverse_order(llist_del_all(&lunatik_deferred));
+	lunatik_object_t *object, *n;
+
+	llist_for_each_entry_safe(object, n, list, deferred) {
+		struct module *owner = lunatik_classowner(object->class);
+
+		lunatik_freeobject(object);
+		module_put(owner);
+		atomic_long_dec(&lunatik_pending);
+	}
+}
+
+static DECLARE_WORK(lunatik_releaser, lunatik_releasework);
+
+static int lunatik_getpending(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "%ld\n", lunatik_pendingobjects());
+}
+
+static const struct kernel_param_ops lunatik_pending_ops = {
+	.get = lunatik_getpending,
+};
+
+module_param_cb(pending_releases, &lunatik_pending_ops, NULL, 0444);
+MODULE_PARM_DESC(pending_releases, "number of object releases waiting to be run by the worker");
+
+void lunatik_releaseobject(struct kref *kref)
+{
+	lunatik_object_t *object = container_of(kref, lunatik_object_t, kref);
+
+	/* objects that sleep are only handled in process context; preemptible() is
+	 * always false without CONFIG_PREEMPT_COUNT, so the others are deferred then */
+	if (object->sleep || preemptible()) {
+		lunatik_freeobject(object);
+		return;
+	}
+
+	__module_get(lunatik_classowner(object->class));
+	atomic_long_inc(&lunatik_pending);
+	if (llist_add(&object->deferred, &lunatik_deferred))
+		schedule_work(&lunatik_releaser);
+}
 EXPORT_SYMBOL(lunatik_releaseobject);
 
+void lunatik_flushobjects(void)
+{
+	if (current_work() != &lunatik_releaser)
+		flush_work(&lunatik_releaser);
+}
+EXPORT_SYMBOL(lunatik_flushobjects);
+
+long lunatik_pendingobjects(void)
+{
+	return atomic_long_read(&lunatik_pending);
+}
+EXPORT_SYMBOL(lunatik_pendingobjects);
+
 int lunatik_deleteobject(lua_State *L)
 {
 	lunatik_object_t **pobject = lunatik_checkpobject(L, 1);
@@ -119,7 +220,7 @@ int lunatik_deleteobject(lua_State *L)
 }
 EXPORT_SYMBOL(lunatik_deleteobject);
 
-static int lunatik_monitor(lua_State *L)
+int lunatik_monitor(lua_State *L)
 {
 	int ret, n = lua_gettop(L);
 	lunatik_object_t *object = lunatik_checkobject(L, 1);
@@ -135,6 +236,7 @@ static int lunatik_monitor(lua_State *L)
 		lua_error(L);
 	return lua_gettop(L);
 }
+EXPORT_SYMBOL(lunatik_monitor);
 
 int lunatik_monitorobject(lua_State *L)
 {
@@ -0,0 +1,168 @@
+/*
+* SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+* SPDX-License-Identifier: MIT OR GPL-2.0-only
+*/
+
+#define pr_fmt(fmt) KBUILD_MODNAME ": " fmt
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/mutex.h>
+#include <linux/atomic.h>
+#include <linux/workqueue.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+
+#include "lunatik.h"
+
+#ifdef LUNATIK_RUNTIME
+
+/* hook statistics are exported as <debugfs>/lunatik/<class>/<name>.<id> */
+static struct dentry *lunatik_statroot;
+static DEFINE_MUTEX(lunatik_statmutex);
+static atomic_t lunatik_statid = ATOMIC_INIT(0);
+
+static void lunatik_sumstats(lunatik_stats_t *stats, lunatik_stat_t *sum)
+{
+	int cpu;
+
+	memset(sum, 0, sizeof(lunatik_stat_t));
+	if (stats->percpu == NULL)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		lunatik_stat_t *stat = per_cpu_ptr(stats->percpu, cpu);
+		int i;
+
+		sum->calls += stat->calls;
+		sum->errors += stat->errors;
+		sum->fallbacks += stat->fallbacks;
+		sum->nsecs += stat->nsecs;
+		for (i = 0; i < LUNATIK_STAT_NVERDICTS; i++)
+			sum->verdicts[i] += stat->verdicts[i];
+	}
+}
+
+#define lunatik_foreachverdict(stats, reg)	\
+	for (reg = (stats)->verdicts; reg != NULL && reg->name != NULL; reg++)	\
+		if (reg->value >= 0 && reg->value < LUNATIK_STAT_NVERDICTS)
+
+static int lunatik_stats_show(struct seq_file *m, void *v)
+{
+	lunatik_stats_t *stats = (lunatik_stats_t *)m->private;
+	const lunatik_reg_t *reg;
+	lunatik_stat_t sum;
+
+	lunatik_sumstats(stats, &sum);
+	seq_printf(m, "calls %llu\n", sum.calls);
+	seq_printf(m, "errors %llu\n", sum.errors);
+	seq_printf(m, "fallbacks %llu\n", sum.fallbacks);
+	seq_printf(m, "nsecs %llu\n", sum.nsecs);
+	lunatik_foreachverdict(stats, reg)
+		seq_printf(m, "%s %llu\n", reg->name, sum.verdicts[reg->value]);
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(lunatik_stats);
+
+static struct dentry *lunatik_statdir(const char *class)
+{
+	struct dentry *dir;
+
+	mutex_lock(&lunatik_statmutex);
+	if ((dir = debugfs_lookup(class, lunatik_statroot)) != NULL)
+		dput(dir); /* class directories are only removed with the root */
+	else
+		dir = debugfs_create_dir(class, lunatik_statroot);
+	mutex_unlock(&lunatik_statmutex);
+	return dir;
+}
+
+static void lunatik_statfile(struct work_struct *work)
+{
+	lunatik_stats_t *stats = container_of(work, lunatik_stats_t, work);
+	struct dentry *dir;
+
+	if (IS_ERR_OR_NULL(lunatik_statroot))
+		return;
+
+	dir = lunatik_statdir(stats->class);
+	if (!IS_ERR_OR_NULL(dir))
+		stats->dentry = debugfs_create_file(stats->name, 0444, dir, stats, &lunatik_stats_fops);
+}
+
+/* hooks are usually registered by non-sleepable runtimes; thus, we defer the
+ * debugfs entry creation to a work item whenever we are not allowed to block */
+int lunatik_newstats(lunatik_stats_t *stats, const char *class, const char *name, const lunatik_reg_t *verdicts, gfp_t gfp)
+{
+	INIT_WORK(&stats->work, lunatik_statfile);
+	stats->verdicts = verdicts;
+	stats->dentry = NULL;
+	stats->class = class;
+	snprintf(stats->name, LUNATIK_STAT_NAMELEN, "%s.%u", name, (unsigned int)atomic_inc_return(&lunatik_statid));
+
+	if ((stats->percpu = alloc_percpu_gfp(lunatik_stat_t, gfp)) == NULL)
+		return -ENOMEM;
+
+	if (gfpflags_allow_blocking(gfp))
+		lunatik_statfile(&stats->work);
+	else
+		schedule_work(&stats->work);
+	return 0;
+}
+EXPORT_SYMBOL(lunatik_newstats);
+
+/* must be called on process context (e.g., from a class release) */
+void lunatik_freestats(lunatik_stats_t *stats)
+{
+	if (stats->percpu == NULL)
+		return;
+
+	cancel_work_sync(&stats->work);
+	debugfs_remove(stats->dentry);
+	stats->dentry = NULL;
+	free_percpu(stats->percpu);
+	stats->percpu = NULL;
+}
+EXPORT_SYMBOL(lunatik_freestats);
+
+#define lunatik_setstat(L, sum, field)			\
+do {							\
+	lua_pushinteger((L), (lua_Integer)(sum).field);	\
+	lua_setfield((L), -2, #field);			\
+} while (0)
+
+void lunatik_pushstats(lua_State *L, lunatik_stats_t *stats)
+{
+	const lunatik_reg_t *reg;
+	lunatik_stat_t sum;
+
+	lunatik_sumstats(stats, &sum);
+	lua_createtable(L, 0, 5);
+	lunatik_setstat(L, sum, calls);
+	lunatik_setstat(L, sum, errors);
+	lunatik_setstat(L, sum, fallbacks);
+	lunatik_setstat(L, sum, nsecs);
+
+	lua_newtable(L); /* verdicts */
+	lunatik_foreachverdict(stats, reg) {
+		lua_pushinteger(L, (lua_Integer)sum.verdicts[reg->value]);
+		lua_setfield(L, -2, reg->name);
+	}
+	lua_setfield(L, -2, "verdicts");
+}
+EXPORT_SYMBOL(lunatik_pushstats);
+
+void lunatik_statinit(void)
+{
+	lunatik_statroot = debugfs_create_dir("lunatik", NULL);
+}
+
+void lunatik_statexit(void)
+{
+	debugfs_remove_recursive(lunatik_statroot);
+	lunatik_statroot = NULL;
+}
+
+#endif /* LUNATIK_RUNTIME */
+
@@ -0,0 +1,46 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+local bloom = require"bloom"
+local data = require"data"
+local test = require"util".test
+
+test("bloom filters have no false negatives", function()
+	local f = bloom.new(1000, 1000)
+	for i = 1, 1000 do
+		f:add("key" .. i)
+	end
+	for i = 1, 1000 do
+		assert(f:contains("key" .. i))
+	end
+
+	local fp = 0
+	for i = 1, 10000 do
+		if f:contains("other" .. i) then fp = fp + 1 end
+	end
+	assert(fp < 50, "false-positive rate should be close to 1/1000, got " .. fp .. "/10000")
+
+	local s = f:stats()
+	assert(s.entries == 1000 and s.capacity == 1000 and s.rate == 1000)
+	assert(s.hashes == 10 and s.memory >= s.bits // 8)
+end)
+
+test("bloom filters build whole generations and match data ranges", function()
+	local f = bloom.new(0)
+	f:build{"github.com", "gitlab.com"}
+	assert(f:contains("github.com") and f:contains("gitlab.com"))
+	assert(f:stats().entries == 2)
+
+	f:build("ebpf.io\n\nlua.org\n", 10000)
+	assert(f:contains("lua.org") and f:contains("ebpf.io"))
+	assert(not f:contains("github.com") or not f:contains("gitlab.com"), "old generation should be replaced")
+	assert(f:stats().entries == 2 and f:stats().rate == 10000)
+
+	local d = data.new(16)
+	d:setstring(0, "\3www\7lua.org\0")
+	assert(f:contains(d, 5, 7))
+	assert(not pcall(f.contains, f, d, 10, 7), "lookups must stay in bounds")
+	assert(not pcall(f.build, f, {"ok", {}}))
+	assert(f:contains("lua.org"), "failed builds must keep the current generation")
+end)
@@ -0,0 +1,36 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+local data = require"data"
+local test = require"util".test
+
+test("data atomic operations", function()
+	local d = data.new(16)
+	d:fill(0, 16)
+	d:atomic_add(0, 5)
+	assert(d:atomic_fetch_add(0, 2) == 5)
+	assert(d:atomic_read_acquire(0) == 7)
+	assert(d:atomic_xchg(0, 1) == 7)
+	assert(d:atomic_cmpxchg(0, 2, 3) == 1, "cmpxchg must fail on mismatch")
+	assert(d:atomic_cmpxchg(0, 1, 3) == 1 and d:getint32(0) == 3)
+	d:atomic_or(0, 0xf0)
+	d:atomic_and(0, 0x30)
+	assert(d:getint32(0) == 0x30)
+	d:atomic64_set_release(8, 1 << 40)
+	d:atomic64_add(8, 1)
+	assert(d:atomic64_read_acquire(8) == (1 << 40) + 1)
+	assert(not pcall(d.atomic_add, d, 2, 1), "unaligned offset should fail")
+	assert(not pcall(d.atomic64_add, d, 12, 1), "out of bounds should fail")
+end)
+
+test("data atomic operations pin memory", function()
+	local d = data.buffer(8)
+	d:append("abcd")
+	d:atomic_add(0, 1)
+	d:append("efgh")
+	assert(not pcall(d.append, d, "i"), "pinned memory must not grow")
+	assert(not pcall(d.resize, d, 16), "pinned memory must not grow")
+	d:resize(4)
+	assert(#d == 4)
+end)
@@ -0,0 +1,22 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+local data = require"data"
+local test = require"util".test
+
+test("data.buffer appends values", function()
+	local b = data.buffer(4)
+	assert(#b == 0 and tostring(b) == "")
+	b:append("read", ": ", 42, "\n"):append(-1)
+	assert(tostring(b) == "read: 42\n-1")
+	local d = data.new(3)
+	d:setstring(0, "abc")
+	b:resize(0)
+	b:append(d, d:slice(1))
+	assert(tostring(b) == "abcbc")
+	b:append(b)
+	assert(tostring(b) == "abcbcabcbc", "appending itself")
+	assert(not pcall(b.append, b, {}), "tables can't be appended")
+	assert(not pcall(d:slice(0).append, d:slice(0), "x"), "slices can't grow")
+end)
@@ -0,0 +1,42 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+local data = require"data"
+local test = require"util".test
+
+-- sample IPv4 header; its checksum (offset 10) is 0xb861
+local header = "\x45\x00\x00\x73\x00\x00\x40\x00\x40\x11\x00\x00\xc0\xa8\x00\x01\xc0\xa8\x00\xc7"
+
+local function new()
+	local d = data.new(#header)
+	d:setstring(0, header)
+	d:setuint16(10, d:checksum(0, #header))
+	return d
+end
+
+test("data:checksum of an IPv4 header", function()
+	local d = new()
+	assert(d:unpack(">H", 10) == 0xb861, "unexpected checksum")
+	assert(d:checksum(0, #header) == 0, "a valid header must sum up to zero")
+end)
+
+test("data:checksum with seed", function()
+	local d = new()
+	local _, partial = d:checksum(0, 10)
+	assert(d:checksum(10, 10, partial) == d:checksum(0, 20))
+end)
+
+test("data:csumreplace4 matches a full recomputation", function()
+	local d = new()
+	local old = d:getuint32(16)
+	local new = old ~ 0x01010101
+	d:setuint32(16, new)
+	d:csumreplace4(10, old, new)
+	assert(d:checksum(0, #header) == 0, "incremental update must keep the header valid")
+
+	local oldid = d:getuint16(4)
+	d:setuint16(4, 0x1234)
+	d:csumreplace2(10, oldid, 0x1234)
+	assert(d:checksum(0, #header) == 0)
+end)
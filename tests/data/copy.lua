@@ -0,0 +1,33 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+local data = require"data"
+local test = require"util".test
+
+test("data:copy between objects", function()
+	local src, dst = data.new(8), data.new(8)
+	src:setstring(0, "abcdefgh")
+	dst:fill(0, 8, string.byte("."))
+	src:copy(dst, 2, 4, 4)
+	assert(tostring(dst) == "..efgh..")
+	assert(not pcall(src.copy, src, dst, 6, 0, 4), "out of bounds destination")
+	assert(not pcall(src.copy, src, "dst", 0, 0, 4), "destination must be data")
+end)
+
+test("data:copy handles overlapping regions", function()
+	local d = data.new(8)
+	d:setstring(0, "abcdefgh")
+	d:copy(d, 2, 0, 6)
+	assert(tostring(d) == "ababcdef")
+end)
+
+test("data:compare", function()
+	local a, b = data.new(4), data.new(4)
+	a:setstring(0, "abcd")
+	b:setstring(0, "abce")
+	assert(a:compare(0, b, 0, 3) == 0)
+	assert(a:compare(0, b, 0, 4) == -1)
+	assert(b:compare(0, a, 0, 4) == 1)
+	assert(a:compare(1, a, 1, 2) == 0)
+end)
@@ -0,0 +1,36 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+local data = require"data"
+local test = require"util".test
+
+local function new(s)
+	local d = data.new(#s)
+	d:setstring(0, s)
+	return d
+end
+
+test("data:find plain", function()
+	local d = new("GET /index.html HTTP/1.1\r\n")
+	local s, e = d:find("index", 0, nil, true)
+	assert(s == 5 and e == 10)
+	assert(d:find("HTTP", 10) == 16, "search starts at offset")
+	assert(d:find("HTTP", 0, 16) == nil, "search ends at offset + length")
+	assert(d:find("\r\n", 0, nil, true) == 24)
+	assert(d:find("html.", 0, nil, true) == nil)
+end)
+
+test("data:find and data:match patterns", function()
+	local d = new("\0\0Host: example.com\r\n")
+	local s, e, host = d:find("Host: ([^\r]*)")
+	assert(s == 2 and e == 19 and host == "example.com")
+	assert(d:match("Host: ([^\r]*)") == "example.com")
+	assert(d:match("^Host", 2) == "Host", "anchor at offset")
+	assert(d:match("^Host") == nil)
+	assert(d:match("()com") == 16, "position captures are data offsets")
+	assert(d:match("%d+") == nil)
+	assert(d:match("\r\n$") == "\r\n")
+	assert(not pcall(d.match, d, "[a", 0), "malformed pattern should fail")
+	assert(not pcall(d.find, d, "a", #d + 1), "out of bounds should fail")
+end)
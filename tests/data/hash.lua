@@ -0,0 +1,27 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+local data = require"data"
+local test = require"util".test
+
+test("data:hash is deterministic", function()
+	local d = data.new(16)
+	d:setstring(0, "0123456789abcdef")
+	assert(d:hash(0, 8) == d:hash(0, 8))
+	assert(d:hash(0, 8, 1) ~= d:hash(0, 8, 2), "seed must change the hash")
+	assert(d:hash(0, 8) == d:hash(0, 8, 0), "default seed is 0")
+	local key = string.rep("k", 16)
+	assert(d:hash(0, 8, key) == d:hash(0, 8, key))
+	assert(not pcall(d.hash, d, 0, 8, "short key"), "siphash keys have 16 bytes")
+end)
+
+test("data:hashranges concatenates regions", function()
+	local d = data.new(16)
+	d:setstring(0, "0123456789abcdef")
+	local c = data.new(6)
+	c:setstring(0, "01cdef")
+	assert(d:hashranges(7, 0, 2, 12, 4) == c:hash(0, 6, 7))
+	assert(not pcall(d.hashranges, d, 0, 0), "ranges come in pairs")
+	assert(not pcall(d.hashranges, d, 0, 10, 10), "out of bounds range")
+end)
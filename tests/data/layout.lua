@@ -0,0 +1,40 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+local data = require"data"
+local test = require"util".test
+
+local udp = data.layout{ {"sport", "be16"}, {"dport", "be16"}, {"len", "be16"}, {"check", "be16"} }
+
+test("data.layout reads fields", function()
+	local d = data.new(12)
+	d:setstring(0, "\0\0\0\0\x30\x39\x00\x35\x00\x08\xff\xff")
+	assert(#udp == 8)
+	assert(udp:get(d, 4, "sport") == 12345)
+	assert(udp:get(d, 4, "dport") == 53)
+	local t = {}
+	assert(udp:read(d, 4, t) == t, "read must reuse the table")
+	assert(t.len == 8 and t.check == 0xffff)
+	assert(not pcall(udp.get, udp, d, 4, "nope"), "unknown field should fail")
+	assert(not pcall(udp.read, udp, d, 6), "out of bounds should fail")
+end)
+
+test("data.layout writes fields", function()
+	local d = data.new(8)
+	d:fill(0, 8, 0xaa)
+	udp:write(d, 0, {dport = 53, len = 8})
+	assert(d:getuint16(0) == 0xaaaa, "absent fields must be preserved")
+	assert(d:getstring(2, 4) == "\x00\x35\x00\x08")
+	assert(not pcall(udp.write, udp, d, 0, {len = 0x10000}), "overflow should fail")
+end)
+
+test("data.layout types and offsets", function()
+	local l = data.layout{ {"a", "i8"}, {"b", "le32"}, {"mac", "c6", 8} }
+	assert(#l == 14)
+	local d = data.new(14)
+	l:write(d, 0, {a = -1, b = 1, mac = "\1\2\3\4\5\6"})
+	assert(l:get(d, 0, "a") == -1 and d:getstring(1, 4) == "\1\0\0\0")
+	assert(l:get(d, 0, "mac") == "\1\2\3\4\5\6")
+	assert(not pcall(data.layout, { {"x", "u12"} }), "invalid type should fail")
+end)
@@ -0,0 +1,46 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+local data = require"data"
+local test = require"util".test
+
+test("data:pack/unpack round trip", function()
+	local d = data.new(16)
+	local off = d:pack(0, ">BHI4", 0x45, 0x1234, 0xdeadbeef)
+	assert(off == 7, "unexpected offset " .. off)
+	local a, b, c, next = d:unpack(">BHI4")
+	assert(a == 0x45 and b == 0x1234 and c == 0xdeadbeef)
+	assert(next == 7)
+	assert(d:getbyte(1) == 0x12 and d:getbyte(2) == 0x34, "big-endian layout expected")
+end)
+
+test("data:unpack is string.unpack compatible", function()
+	local fmt = "<i2 c3 z s1 !4 i4"
+	local s = string.pack(fmt, -2, "abc", "zero", "len", 42)
+	local d = data.new(#s)
+	d:setstring(0, s)
+	local x = table.pack(string.unpack(fmt, s))
+	local y = table.pack(d:unpack(fmt))
+	assert(x.n == y.n)
+	for i = 1, x.n - 1 do
+		assert(x[i] == y[i], "mismatch on value " .. i)
+	end
+	assert(x[x.n] == y[y.n] + 1, "offsets are 0-indexed")
+end)
+
+test("data:pack writes nothing on errors", function()
+	local d = data.new(4)
+	d:setuint32(0, 0)
+	assert(not pcall(d.pack, d, 0, "BBBBB", 1, 2, 3, 4, 5), "out of bounds pack should fail")
+	assert(not pcall(d.pack, d, 0, "BB", 1, 256), "overflow should fail")
+	assert(d:getuint32(0) == 0, "data must be untouched")
+end)
+
+test("data:unpack out of bounds", function()
+	local d = data.new(3)
+	d:setstring(0, "abc")
+	assert(not pcall(d.unpack, d, ">I4"))
+	assert(not pcall(d.unpack, d, "B", 4))
+	assert(not pcall(d.unpack, d, "z"), "unfinished string should fail")
+end)
@@ -0,0 +1,21 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+local data = require"data"
+local test = require"util".test
+
+test("data.percpu aggregates per-CPU copies", function()
+	local d = data.percpu(16)
+	assert(#d == 16)
+	assert(d:sum32(0) == 0 and d:sum64(8) == 0, "per-CPU data starts zeroed")
+	d:setuint32(0, 3)
+	d:setuint64(8, 5)
+	assert(d:sum32(0) == 3)
+	assert(d:sum64(8) == 5)
+	local all = d:snapshot()
+	assert(#all % #d == 0 and #all >= #d)
+	assert(#d:snapshot(0) == #d)
+	assert(not pcall(d.resize, d, 32), "per-CPU data can't be resized")
+	assert(not pcall(data.new(8).sum32, data.new(8), 0), "sum32 requires per-CPU data")
+end)
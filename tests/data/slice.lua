@@ -0,0 +1,35 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+local data = require"data"
+local test = require"util".test
+
+test("data:slice shares memory", function()
+	local d = data.new(8)
+	d:setstring(0, "abcdefgh")
+	local s = d:slice(2, 4)
+	assert(#s == 4 and tostring(s) == "cdef")
+	s:setbyte(0, string.byte("X"))
+	assert(d:getstring(2, 1) == "X", "slice must write through its parent")
+	local ss = s:slice(1)
+	assert(tostring(ss) == "def", "slice of a slice")
+	assert(not pcall(d.slice, d, 6, 4), "out of bounds slice should fail")
+end)
+
+test("data:slice keeps its parent alive", function()
+	local s = data.new(4):slice(0, 2)
+	collectgarbage()
+	s:setuint16(0, 0xffff)
+	assert(s:getuint16(0) == 0xffff)
+end)
+
+test("data:slice is invalidated on resize", function()
+	local d = data.new(4)
+	local s = d:slice(0, 2)
+	d:resize(64)
+	local ok, err = pcall(s.getbyte, s, 0)
+	assert(not ok and err:find"invalidated", "stale slice must fail, got: " .. tostring(err))
+	local t = d:slice(0)
+	assert(not pcall(t.resize, t, 1), "slices cannot be resized")
+end)
@@ -0,0 +1,32 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+local matcher = require"matcher"
+local data = require"data"
+local test = require"util".test
+
+test("matcher finds the first and all patterns in one pass", function()
+	local m = matcher.new{"he", "she", "his", "hers"}
+	assert(#m == 4)
+
+	local id, pos = m:find("ushers")
+	assert(id == 2 and pos == 1, "'she' ends first")
+	assert(m:find("xyz") == nil)
+
+	local all = m:findall("ushers ushers")
+	assert(#all == 3 and all[1] == 2 and all[2] == 1 and all[3] == 4)
+	assert(#m:findall("ushers", 2) == 2, "searches start at the offset")
+	assert(m:find("ushers", 0, 2) == nil, "searches stop at the length")
+end)
+
+test("matcher runs over data ranges and folds case", function()
+	local m = matcher.new({"github.com", "gitlab.com"}, true)
+	local d = data.new(16)
+	d:setstring(0, "www.GitLab.COM")
+	local id, pos = m:find(d, 0, 14)
+	assert(id == 2 and pos == 4)
+	assert(not pcall(m.find, m, d, 10, 7), "searches must stay in bounds")
+	assert(matcher.new{"abc"}:find("ABC") == nil)
+	assert(not pcall(matcher.new, {"ok", ""}), "empty patterns are invalid")
+end)
@@ -0,0 +1,49 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+local rcu = require"rcu"
+local net = require"net"
+local data = require"data"
+local af = require"socket".af
+local test = require"util".test
+
+test("rcu.lpm matches the longest IPv4 prefix", function()
+	local t = rcu.lpm(af.INET)
+	t:insert(net.aton("10.0.0.0"), 8, "wide")
+	t:insert(net.aton("10.1.0.0"), 16, "narrow")
+	t:insert(net.aton("10.1.2.3"), 32, 42)
+	t:insert(net.aton("10.255.255.255"), 8, "wide") -- host bits are ignored
+	assert(#t == 3)
+
+	local v, len = t:lookup(net.aton("10.1.9.9"))
+	assert(v == "narrow" and len == 16)
+	assert(t:lookup(net.aton("10.2.0.1")) == "wide")
+	assert(t:lookup(net.aton("10.1.2.3")) == 42)
+	assert(t:lookup(net.aton("11.0.0.1")) == nil)
+	assert(t:lookup("\10\1\2\3") == 42, "binary addresses are in network byte order")
+
+	local header = data.new(20)
+	header:setbyte(16, 10)
+	header:setbyte(17, 1)
+	assert(t:lookup(header, 16) == "narrow")
+	assert(not pcall(t.lookup, t, header, 17), "lookups must stay in bounds")
+
+	assert(t:delete(net.aton("10.1.0.0"), 16))
+	assert(not t:delete(net.aton("10.1.0.0"), 16))
+	assert(t:lookup(net.aton("10.1.9.9")) == "wide")
+	assert(t:lookup(net.aton("10.1.2.3")) == 42)
+	assert(#t == 2)
+end)
+
+test("rcu.lpm supports IPv6 and a default route", function()
+	local t = rcu.lpm(af.INET6)
+	local prefix = "\x20\x01\x0d\xb8" .. string.rep("\0", 12)
+	t:insert(string.rep("\0", 16), 0, false)
+	t:insert(prefix, 32, true)
+	assert(t:lookup("\x20\x01\x0d\xb8" .. string.rep("\1", 12)) == true)
+	local v, len = t:lookup(string.rep("\xff", 16))
+	assert(v == false and len == 0)
+	assert(not pcall(t.insert, t, prefix, 129, true))
+	assert(not pcall(t.lookup, t, "\0\0\0\0"))
+end)
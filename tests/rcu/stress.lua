@@ -0,0 +1,72 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+
+-- Writer scalability stress test of rcu tables; each kernel thread
+-- replaces its own keys in a shared table, so writers only contend
+-- when their buckets share a lock stripe. Comparing the throughput
+-- for increasing numbers of threads shows how writers scale across CPUs.
+--
+-- Usage (from the REPL):
+-- > stress = require("tests.rcu.stress")
+-- > return stress.run(1)
+-- > return stress.run(8, 100000)
+
+local lunatik = require("lunatik")
+local thread  = require("thread")
+local linux   = require("linux")
+local rcu     = require("rcu")
+
+local env = lunatik._ENV
+
+local script = "tests/rcu/writer"
+
+local stress = {}
+
+local function finished(t, threads)
+	local done, nsecs = 0, 0
+	rcu.map(t, function (k, v)
+		if k:match("^done:") then
+			done = done + 1
+			nsecs = math.max(nsecs, v)
+		end
+	end)
+	return done == threads, nsecs
+end
+
+--- Runs `threads` writers doing `ops` replacements each over `keys` keys of their own.
+-- @tparam integer threads number of writer threads
+-- @tparam[opt=100000] integer ops number of writes per thread
+-- @tparam[opt=1024] integer keys number of distinct keys per thread
+-- @treturn string report as a JSON object (latency in nanoseconds)
+function stress.run(threads, ops, keys)
+	local t = rcu.table(threads * (keys or 1024))
+	t.ops = ops or 100000
+	t.keys = keys or 1024
+	env.rcustress = t
+
+	local writers = {}
+	for i = 1, threads do
+		local runtime = lunatik.runtime(script)
+		table.insert(writers, {runtime = runtime, thread = thread.run(runtime, "rcustress" .. i)})
+	end
+
+	local done, nsecs
+	repeat
+		linux.schedule(100)
+		done, nsecs = finished(t, threads)
+	until done
+
+	for _, writer in ipairs(writers) do
+		writer.thread:stop()
+		writer.runtime:stop()
+	end
+	env.rcustress = nil
+
+	local stats = rcu.stats(t)
+	return string.format('{"threads":%d,"ops":%d,"nsecs":%d,"throughput":%d,"entries":%d,"buckets":%d}',
+		threads, t.ops, nsecs, t.ops * threads * 1000000000 // math.max(nsecs, 1), stats.entries, stats.buckets)
+end
+
+return stress
@@ -0,0 +1,123 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+local rcu = require"rcu"
+local data = require"data"
+local linux = require"linux"
+local test = require"util".test
+
+local function settle(t, check)
+	for _ = 1, 100 do
+		if check(rcu.stats(t)) then return true end
+		linux.schedule(10)
+	end
+	return false
+end
+
+test("rcu.table grows and shrinks with its load", function()
+	local t = rcu.table(16)
+	local value = data.new(1)
+	local n = 4096
+	for i = 1, n do
+		t["key" .. i] = value
+	end
+	assert(rcu.stats(t).entries == n)
+	assert(settle(t, function(s) return s.load <= 100 end), "table should grow")
+	for i = 1, n do
+		assert(t["key" .. i], "lookups must survive resizes")
+	end
+	assert(t["key"] == nil and t["key1" .. n] == nil, "keys must match exactly")
+
+	for i = 1, n do
+		t["key" .. i] = nil
+	end
+	assert(rcu.stats(t).entries == 0)
+	assert(settle(t, function(s) return s.buckets == 16 end), "table should shrink to its initial size")
+	assert(rcu.stats(t).resizes >= 2)
+end)
+
+test("rcu.table stores scalar values inline", function()
+	local t = rcu.table()
+	t.count = 42
+	t.blocked = true
+	t.allowed = false
+	t.name = "lunatik"
+	assert(t.count == 42 and t.blocked == true and t.allowed == false)
+	assert(t.name == "lunatik")
+	t.count = t.count + 1
+	assert(t.count == 43)
+	assert(not pcall(function() t.name = string.rep("x", 65) end), "strings are limited to 64 bytes")
+	assert(not pcall(function() t.table = {} end), "tables can't be stored")
+	local seen = 0
+	rcu.map(t, function(k, v)
+		assert(t[k] == v)
+		seen = seen + 1
+	end)
+	assert(seen == 4)
+end)
+
+test("rcu.build publishes a new generation at once", function()
+	local t = rcu.table()
+	t.old = true
+	t.kept = 1
+	local builder
+	rcu.build(t, function(b)
+		builder = b
+		for i = 1, 1000 do
+			b["key" .. i] = i
+		end
+		b.kept = 2
+		assert(t.old and t.kept == 1, "readers must keep seeing the former generation")
+	end)
+	assert(t.old == nil and t.kept == 2 and t.key1000 == 1000)
+	assert(rcu.stats(t).entries == 1001)
+	assert(rcu.stats(builder).entries == 0, "builder must be left empty")
+
+	assert(not pcall(rcu.build, t, function(b)
+		b.partial = true
+		error("aborted")
+	end))
+	assert(t.partial == nil and t.kept == 2, "failed builds must not be published")
+end)
+
+test("rcu.key handles index any table", function()
+	local t, u = rcu.table(), rcu.table()
+	local key = rcu.key("runtimes")
+	assert(tostring(key) == "runtimes")
+	t[key] = 1
+	u.runtimes = 2
+	assert(t.runtimes == 1 and u[key] == 2)
+	t.prefix = true
+	assert(t.pre == nil and t.prefixes == nil, "prefixes must not match")
+	t[key] = nil
+	assert(t.runtimes == nil)
+end)
+
+test("rcu.pairs iterates in batches", function()
+	local t = rcu.table(16)
+	local value = data.new(1)
+	for i = 1, 100 do
+		t["key" .. i] = i % 2 == 0 and value or i
+	end
+
+	local seen, n = {}, 0
+	for k, v in rcu.pairs(t, 7) do
+		assert(not seen[k], "keys must be visited once")
+		seen[k], n = v, n + 1
+	end
+	assert(n == 100 and seen.key3 == 3 and type(seen.key4) == "userdata")
+
+	n = 0
+	for k, v in pairs(t) do n = n + 1 end
+	assert(n == 100, "__pairs must iterate the table")
+
+	for k, v in rcu.pairs(t, 100, true) do
+		assert(v == nil and t[k] ~= nil, "key-only iteration must not copy values")
+	end
+
+	for k, v in rcu.pairs(t, 10) do
+		break -- releases the remaining references of the batch
+	end
+	assert(not pcall(rcu.pairs, t, 0))
+end)
@@ -0,0 +1,27 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+
+-- Writer thread spawned by tests/rcu/stress; it keeps replacing its own
+-- set of keys and then reports how long it took (in nanoseconds).
+
+local lunatik = require("lunatik")
+local thread  = require("thread")
+local linux   = require("linux")
+
+return function()
+	local t = lunatik._ENV.rcustress
+	local ops, keys = t.ops, t.keys
+	local id = thread.current():task().pid .. ":"
+
+	local start = linux.time()
+	for i = 1, ops do
+		t[id .. (i % keys)] = i
+	end
+	t["done:" .. id] = linux.difftime(linux.time(), start)
+
+	while not thread.shouldstop() do
+		linux.schedule(100)
+	end
+end
@@ -0,0 +1,127 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+
+-- Kernel helper of the runtime scalability benchmark; it runs on the
+-- driver runtime and is driven by tests/runtime/report.lua (user space).
+--
+-- Usage (from the REPL):
+-- > bench = require("tests.runtime.bench")
+-- > bench.create(10000)
+-- > bench.destroy()
+-- > return bench.report()
+
+local lunatik = require("lunatik")
+local runner  = require("lunatik.runner")
+local linux   = require("linux")
+
+local env = lunatik._ENV
+
+local script = "tests/runtime/target"
+local prefix = "tests/runtime/bench#"
+
+local bench = {}
+local state
+
+local function elapsed(f, ...)
+	local start = linux.time()
+	local ok, ret = pcall(f, ...)
+	return linux.difftime(linux.time(), start), ok, ret
+end
+
+local function sample(name)
+	state.samples[name] = state.samples[name] or {}
+	return state.samples[name]
+end
+
+local function percentiles(samples)
+	local n = #samples
+	if n == 0 then
+		return '{"n":0}'
+	end
+	table.sort(samples)
+	local function p(q)
+		return samples[math.max(1, (n * q + 99) // 100)]
+	end
+	local sum = 0
+	for _, v in ipairs(samples) do
+		sum = sum + v
+	end
+	return string.format('{"n":%d,"avg":%d,"p50":%d,"p90":%d,"p99":%d,"max":%d}',
+		n, sum // n, p(50), p(90), p(99), samples[n])
+end
+
+local function footprint(runtime)
+	local ok, d = pcall(runtime.resume, runtime)
+	return ok and d:getnumber(0) or nil
+end
+
+--- Creates `n` runtimes and keeps them referenced by `env.runtimes`.
+-- @tparam integer n number of runtimes
+-- @tparam[opt=false] boolean atomic creates non-sleepable runtimes
+function bench.create(n, atomic)
+	assert(state == nil, "benchmark is already running; call bench.destroy() first")
+	state = {n = n, failed = 0, samples = {}, runtimes = {}}
+	local sleep = not atomic
+
+	for i = 1, n do
+		local t, ok, runtime = elapsed(lunatik.runtime, script, sleep)
+		if ok then
+			table.insert(sample("create"), t)
+			table.insert(state.runtimes, runtime)
+			table.insert(sample("insert"), (elapsed(function ()
+				env.runtimes[prefix .. i] = runtime
+			end)))
+			if sleep then
+				table.insert(sample("footprint"), footprint(runtime))
+			end
+		else
+			state.failed = state.failed + 1
+		end
+	end
+	table.insert(sample("list"), (elapsed(runner.list)))
+end
+
+--- Stops every runtime created by `bench.create` and then measures the `runner.run` path.
+-- @tparam[opt=100] integer cycles number of `runner.run`/`runner.stop` cycles
+function bench.destroy(cycles)
+	assert(state ~= nil, "benchmark isn't running; call bench.create() first")
+	for i, runtime in ipairs(state.runtimes) do
+		table.insert(sample("remove"), (elapsed(function ()
+			env.runtimes[prefix .. i] = nil
+		end)))
+		table.insert(sample("teardown"), (elapsed(runtime.stop, runtime)))
+	end
+	state.runtimes = {}
+	collectgarbage()
+
+	for _ = 1, cycles or 100 do
+		local t, ok = elapsed(runner.run, script)
+		if ok then
+			table.insert(sample("runner_run"), t)
+			table.insert(sample("runner_stop"), (elapsed(runner.stop, script)))
+		else
+			state.failed = state.failed + 1
+		end
+	end
+end
+
+--- Returns the benchmark report as a JSON object and resets the benchmark.
+-- Latencies are in nanoseconds; footprints are in bytes.
+-- @treturn string report
+function bench.report()
+	assert(state ~= nil, "benchmark isn't running; call bench.create() first")
+	local fields = {
+		string.format('"runtimes":%d', state.n),
+		string.format('"failed":%d', state.failed),
+	}
+	local names = {"create", "teardown", "insert", "remove", "list", "runner_run", "runner_stop", "footprint"}
+	for _, name in ipairs(names) do
+		table.insert(fields, string.format('"%s":%s', name, percentiles(sample(name))))
+	end
+	state = nil
+	return "{" .. table.concat(fields, ",") .. "}"
+end
+
+return bench
@@ -0,0 +1,58 @@
+#!/usr/bin/lua5.4
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+
+-- Runtime scalability benchmark (user space side).
+-- It drives tests/runtime/bench through /dev/lunatik and adds the slab
+-- usage, sampled from /proc/meminfo, to the report printed as JSON.
+--
+-- Usage:
+-- $ sudo lunatik load
+-- $ sudo make tests_install
+-- $ sudo lua5.4 tests/runtime/report.lua [runtimes] [cycles] [atomic]
+--
+-- e.g., sudo lua5.4 tests/runtime/report.lua 10000 100 > report.json
+
+local device = "/dev/lunatik"
+
+local runtimes = tonumber(arg[1]) or 10000
+local cycles = tonumber(arg[2]) or 100
+local atomic = arg[3] == "atomic"
+
+local function dostring(chunk)
+	do
+		local loader <close> = assert(io.open(device, "r+"))
+		loader:write(chunk)
+	end
+	local reader <close> = assert(io.open(device, "r"))
+	return reader:read("a")
+end
+
+local function call(fmt, ...)
+	local chunk = string.format("return require('tests.runtime.bench')." .. fmt, ...)
+	local result = dostring(chunk)
+	if result ~= "" and result:sub(1, 1) ~= "{" then
+		error(result)
+	end
+	return result
+end
+
+local function slab() -- in kB
+	for line in io.lines("/proc/meminfo") do
+		local kb = line:match("^Slab:%s+(%d+)")
+		if kb then return tonumber(kb) end
+	end
+end
+
+local before = slab()
+call("create(%d, %s)", runtimes, tostring(atomic))
+local peak = slab()
+call("destroy(%d)", cycles)
+local after = slab()
+local report = call("report()")
+
+local perruntime = runtimes > 0 and ((peak - before) * 1024) // runtimes or 0
+print(string.format('{"bench":%s,"slab":{"before":%d,"peak":%d,"after":%d,"per_runtime":%d}}',
+	report, before, peak, after, perruntime))
@@ -0,0 +1,16 @@
+--
+-- SPDX-FileCopyrightText: (c) 2026 Ring Zero Desenvolvimento de Software LTDA
+-- SPDX-License-Identifier: MIT OR GPL-2.0-only
+--
+
+-- Minimal script instantiated by tests/runtime/bench; it reports the
+-- memory footprint of its own Lua state (in bytes, see LUNATIK_GCCOUNT).
+
+local footprint = collectgarbage("count")
+local data = require("data")
+
+return function()
+	local d = data.new(8)
+	d:setnumber(0, footprint)
+	return d
+end